@@ -0,0 +1,38 @@
+// Alias-table sampling vs std::discrete_distribution on fgen-style IRD
+// weights (epsilon everywhere, a few spikes) for increasing k.
+//
+//   build/alias-bench --benchmark_format=json
+
+#include <benchmark/benchmark.h>
+#include <random>
+#include "alias.h"
+
+static vec<f64> fgen_weights(i64 k) {
+    vec<f64> w(k, 0.00001);
+    for (auto s : {i64(3), k / 10, k / 2, k - 1})
+        w[s] = 1 - 0.00001;
+    return w;
+}
+
+static void bm_discrete_distribution(benchmark::State &state) {
+    auto w = fgen_weights(state.range(0));
+    std::discrete_distribution<i64> dis(w.begin(), w.end());
+    std::mt19937_64 rng(42);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(dis(rng));
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void bm_alias_table(benchmark::State &state) {
+    auto w = fgen_weights(state.range(0));
+    alias_table dis(w.begin(), w.end());
+    std::mt19937_64 rng(42);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(dis(rng));
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bm_discrete_distribution)->RangeMultiplier(10)->Range(20, 1000000);
+BENCHMARK(bm_alias_table)->RangeMultiplier(10)->Range(20, 1000000);
+
+BENCHMARK_MAIN();
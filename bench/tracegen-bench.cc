@@ -0,0 +1,314 @@
+// Throughput of the generation engines and output paths.
+//
+//   build/tracegen-bench --benchmark_format=json --benchmark_out=bench.json
+//
+// Every benchmark reports items_per_second (records/s) and ns_per_record,
+// the wall-clock nanoseconds per record of its timed loop.
+// Generator state is built outside the timed loop; each iteration produces
+// one chunk of chunk_size records. Footprints above 10^7 need many GB of RAM
+// and a long setup, so they are only registered up to
+// $TRACEGEN_BENCH_MAX_FOOTPRINT (default 10^7, at most 10^9).
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include "gen-addresses.h"
+#include "kd-gen.h"
+#include "libtracegen.h"
+#include "rng.h"
+#include "sharded.h"
+#include "stack-gen.h"
+#include "trace-stream.h"
+
+using bench_rng = block_rng<mt64>;
+
+constexpr i64 unbounded = std::numeric_limits<i64>::max();
+
+using bench_clock = std::chrono::steady_clock;
+
+// Wall-clock time of a benchmark's timed loop, started where it is declared.
+// count() reports it as records/s and a plain ns_per_record counter;
+// pause() and resume() stand in for state.PauseTiming() and ResumeTiming().
+class record_timer {
+    bench_clock::time_point start = bench_clock::now(), paused_at;
+    bench_clock::duration paused{};
+
+public:
+    void pause(benchmark::State &state) {
+        state.PauseTiming();
+        paused_at = bench_clock::now();
+    }
+
+    void resume(benchmark::State &state) {
+        paused += bench_clock::now() - paused_at;
+        state.ResumeTiming();
+    }
+
+    void count(benchmark::State &state, i64 per_iteration) const {
+        auto records = (double)state.iterations() * per_iteration;
+        auto ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start - paused).count();
+        state.SetItemsProcessed((int64_t)records);
+        state.counters["ns_per_record"] = ns / records;
+    }
+};
+
+template <typename Gen>
+static void run_chunks(benchmark::State &state, Gen &gen) {
+    vec<i64> out(chunk_size);
+    record_timer timer;
+    for (auto _ : state) {
+        gen.fill(out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    timer.count(state, chunk_size);
+}
+
+// Library output goes to stdout; keep it out of the benchmark report.
+template <typename F>
+static auto quietly(F &&f) {
+    std::fflush(stdout);
+    auto saved = stdout;
+    stdout = std::fopen("/dev/null", "w");
+    auto result = f();
+    std::fclose(stdout);
+    stdout = saved;
+    return result;
+}
+
+// === IRD presets and fgen ===
+
+static const char *ird_specs[] = {
+    "b", "c", "d", "e", "f",
+    "fgen:1000:0.00001:3,5,10,20",
+    "fgen:10000:0.00001:3,50,500,5000",
+    "fgen:100000:0.00001:3,50,500,50000",
+};
+
+template <template <typename> typename Sched>
+static void bm_ird(benchmark::State &state) {
+    auto spec = ird_specs[state.range(0)];
+    state.SetLabel(spec);
+    auto ird = quietly([&] { return parse_ird(spec); });
+    bench_rng rng = bench_rng::stream(42, stream_main);
+    gen_addresses<Sched<tadr>, uniform_sampler, bench_rng> gen(1000000, unbounded, 0, ird,
+                                                                uniform_dist(1000000), rng);
+    run_chunks(state, gen);
+}
+BENCHMARK(bm_ird<heap_scheduler>)->DenseRange(0, std::size(ird_specs) - 1);
+BENCHMARK(bm_ird<bucket_scheduler>)->DenseRange(0, std::size(ird_specs) - 1);
+
+// === IRM types (p_irm = 1) ===
+
+static const char *irm_specs[] = {
+    "zipf:1.2,20", "zipf:0.8,10000", "pareto:1,1.5,10", "uniform:0", "normal:500000,1000", "2,8",
+    "zipfr:1.2,20", "zipfr:0.8,10000", "zipfr:0.8,1000000", "paretor:1,1.5,10",
+};
+
+static void bm_irm(benchmark::State &state) {
+    auto spec = irm_specs[state.range(0)];
+    state.SetLabel(spec);
+    auto irm = quietly([&] { return parse_irm(spec, 1000000); });
+    auto ird = quietly([] { return parse_ird("b"); });
+    bench_rng rng = bench_rng::stream(42, stream_main);
+    std::visit(
+        [&](auto &d_irm) {
+            using Irm = std::decay_t<decltype(d_irm)>;
+            gen_addresses<bucket_scheduler<tadr>, Irm, bench_rng> gen(1000000, unbounded, 1, ird, d_irm,
+                                                                      rng);
+            run_chunks(state, gen);
+        },
+        irm);
+}
+BENCHMARK(bm_irm)->DenseRange(0, std::size(irm_specs) - 1);
+
+// === Footprint scaling (preset b, 50% IRM) ===
+
+template <template <typename> typename Sched>
+static void bm_footprint(benchmark::State &state) {
+    auto m = state.range(0);
+    auto ird = quietly([] { return parse_ird("b"); });
+    auto irm = quietly([&] { return zipf_dist(1.2, 20, m); });
+    bench_rng rng = bench_rng::stream(42, stream_main);
+    gen_addresses<Sched<tadr>, class_sampler, bench_rng> gen(m, unbounded, 0.5, ird, irm, rng);
+    run_chunks(state, gen);
+}
+
+static void footprints(benchmark::internal::Benchmark *b) {
+    i64 max = 10000000;
+    if (auto env = std::getenv("TRACEGEN_BENCH_MAX_FOOTPRINT"))
+        max = std::min<i64>(std::atoll(env), 1000000000);
+    for (i64 m = 1000; m <= max; m *= 10)
+        b->Arg(m);
+    b->Unit(benchmark::kMillisecond);
+}
+BENCHMARK(bm_footprint<heap_scheduler>)->Apply(footprints);
+BENCHMARK(bm_footprint<bucket_scheduler>)->Apply(footprints);
+
+// === Sharded IRD generation (--threads N, preset b) ===
+
+static void bm_threads(benchmark::State &state) {
+    auto ird = quietly([] { return parse_ird("b"); });
+    auto incr = [ird](i64, auto &rng) mutable { return ird(rng); };
+    sharded_gen<heap_scheduler<tadr>, decltype(incr), no_irm, bench_rng> gen(1000000, unbounded, 0, no_irm{},
+                                                                           state.range(0), 42, incr);
+    run_chunks(state, gen);
+}
+BENCHMARK(bm_threads)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+
+// === Stack depth targets (--stack-depths, preset b, 50% IRM) ===
+
+static void bm_stack_depths(benchmark::State &state) {
+    auto m = state.range(0);
+    auto depths = quietly([] { return parse_ird("b"); });
+    auto irm = quietly([&] { return zipf_dist(1.2, 20, m); });
+    bench_rng rng = bench_rng::stream(42, stream_main);
+    stack_gen<class_sampler, bench_rng> gen(m, unbounded, 0.5, depths, irm, rng);
+    run_chunks(state, gen);
+}
+BENCHMARK(bm_stack_depths)->Apply(footprints);
+
+// === Footprint samples (--sample-rate 1/N of a 10^7 footprint) ===
+
+// Through libtracegen, which builds the sample. At the lower rates the
+// sample is smaller than the fgen IRD support.
+static void bm_sample_rate(benchmark::State &state) {
+    tracegen::config c;
+    c.addresses = 10000000;
+    c.length = unbounded / 2;
+    c.p_irm = 0.2;
+    c.ird = "fgen:5000:0.00001:3,50,500,4000";
+    c.sample_rate = 1.0 / state.range(0);
+    auto gen = quietly([&] { return std::make_unique<tracegen::generator>(c); });
+    vec<trace_record> out(chunk_size);
+    record_timer timer;
+    for (auto _ : state) {
+        gen->fill(out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    timer.count(state, chunk_size);
+}
+BENCHMARK(bm_sample_rate)->RangeMultiplier(100)->Range(100, 1000000);
+
+// === kd_gen group counts ===
+
+static void kd_tables(i64 groups, vec<ird_sampler> &irds, vec<double> &pop) {
+    for (i64 g = 0; g < groups; g++) {
+        irds.push_back(quietly([] { return parse_ird("fgen:100:0.005:3,5,10,20"); }));
+        pop.push_back(1.0 / (g + 1));
+    }
+}
+
+static void bm_kd_groups(benchmark::State &state) {
+    vec<ird_sampler> irds;
+    vec<double> pop;
+    kd_tables(state.range(0), irds, pop);
+    bench_rng rng = bench_rng::stream(42, stream_main);
+    kd_gen<heap_scheduler<tadr>, bench_rng> gen(1000000, unbounded, irds, pop, rng);
+    run_chunks(state, gen);
+}
+BENCHMARK(bm_kd_groups)->RangeMultiplier(2)->Range(1, 64);
+
+// Per-group schedulers (--group-schedulers): groups x threads.
+static void bm_kd_group_schedulers(benchmark::State &state) {
+    vec<ird_sampler> irds;
+    vec<double> pop;
+    kd_tables(state.range(0), irds, pop);
+    kd_group_gen<heap_scheduler<tadr>, bench_rng> gen(1000000, unbounded, irds, pop, 42, state.range(1));
+    run_chunks(state, gen);
+}
+BENCHMARK(bm_kd_group_schedulers)->ArgsProduct({{1, 2, 4, 8, 16, 32, 64}, {1, 4}})->UseRealTime();
+
+// Building per-group generators, which creates one stream per group: reports
+// the setup time of each engine's group streams.
+template <typename E>
+static void bm_kd_group_setup(benchmark::State &state) {
+    vec<ird_sampler> irds;
+    vec<double> pop;
+    kd_tables(state.range(0), irds, pop);
+    for (auto _ : state) {
+        kd_group_gen<heap_scheduler<tadr>, block_rng<E>> gen(10000, unbounded, irds, pop, 42, 1);
+        benchmark::DoNotOptimize(&gen);
+    }
+}
+BENCHMARK(bm_kd_group_setup<mt64>)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_kd_group_setup<xoshiro256pp>)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_kd_group_setup<pcg64>)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_kd_group_setup<philox4x64>)->Arg(64)->Unit(benchmark::kMillisecond);
+
+// === Output paths ===
+
+static vec<trace_record> sample_records() {
+    vec<trace_record> records(chunk_size);
+    std::mt19937_64 rng(42);
+    for (auto &r : records)
+        r = {(i64)(rng() & 1), 4096 * (i64)(1 + rng() % 4), 4096 * (i64)(rng() % 100000000)};
+    return records;
+}
+
+// Op and size draws of the post-processing stage.
+static void bm_post_processor(benchmark::State &state) {
+    post_processor<bench_rng> post(0.7, parse_request_sizes("1,1,1:1,2,4"), 4096, 42);
+    vec<i64> addrs(chunk_size);
+    std::iota(addrs.begin(), addrs.end(), 0);
+    vec<trace_record> out(chunk_size);
+    record_timer timer;
+    for (auto _ : state) {
+        post.apply(addrs, out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    timer.count(state, chunk_size);
+}
+BENCHMARK(bm_post_processor);
+
+static void bm_text_writer(benchmark::State &state) {
+    auto records = sample_records();
+    text_writer writer(str("/dev/null"), "stdio", (int)state.range(0));
+    record_timer timer;
+    for (auto _ : state)
+        writer.write(records);
+    timer.count(state, chunk_size);
+    writer.finish();
+}
+BENCHMARK(bm_text_writer)->Arg(1)->Arg(4)->UseRealTime();
+
+static void bm_bin_writer(benchmark::State &state) {
+    auto records = sample_records();
+    auto path = std::filesystem::temp_directory_path() / "tracegen-bench.bin";
+    // bounded file: the writer is recreated whenever it is full
+    constexpr u64 capacity = 256 * chunk_size;
+    std::unique_ptr<bin_writer> writer;
+    u64 written = capacity;
+    record_timer timer;
+    for (auto _ : state) {
+        if (written == capacity) {
+            timer.pause(state);
+            if (writer)
+                writer->finish();
+            writer = std::make_unique<bin_writer>(path.string(), capacity, 42, "");
+            written = 0;
+            timer.resume(state);
+        }
+        writer->write(records);
+        written += chunk_size;
+    }
+    timer.count(state, chunk_size);
+    writer->finish();
+    std::filesystem::remove(path);
+}
+BENCHMARK(bm_bin_writer);
+
+static void bm_arrow_writer(benchmark::State &state) {
+    auto records = sample_records();
+    arrow_writer writer("/dev/null", 42, "", 1 << 16);
+    record_timer timer;
+    for (auto _ : state)
+        writer.write(records);
+    timer.count(state, chunk_size);
+    writer.finish();
+}
+BENCHMARK(bm_arrow_writer);
+
+BENCHMARK_MAIN();
@@ -4,56 +4,21 @@
 #include <fmt/printf.h>
 #include <iostream>
 #include <random>
-#include "tracegen-utils.h"
+#include <span>
+#include "cli.h"
+#include "libtracegen.h"
+#include "stats.h"
+#include "trace-stream.h"
 
 namespace po = boost::program_options;
 
-struct tadr {
-    i64 ird;
-    i64 addr;
-};
-
-bool tadr_cmp(const tadr &a, const tadr &b) { return a.ird > b.ird; }
-
-tadr heappop(vec<tadr>& heap) {
-    std::pop_heap(heap.begin(), heap.end(), tadr_cmp);
-    tadr min = heap.back();
-    heap.pop_back();
-    return min;
-}
-
-void heappush(vec<tadr>& heap, i64 ird, i64 addr) {
-    heap.push_back({ird, addr});
-    std::push_heap(heap.begin(), heap.end(), tadr_cmp);
-}
-
-vec<i64> td_gen(i64 addrs, i64 length, f64 p_irm, dist d_ird, dist d_irm, std::mt19937_64 &rng) {
-    vec<tadr> irds;
-    for (i64 a = 0; a < addrs; a++)
-        irds.push_back({d_ird(rng), a});
-    std::make_heap(irds.begin(), irds.end(), tadr_cmp);
-    std::uniform_real_distribution<> d_is_irm(0, 1);
-    vec<i64> trace;
-    for (i64 i = 0; i < length; i++) {
-        if (d_is_irm(rng) < p_irm) {
-            auto addr = d_irm(rng);
-            assert(addr < addrs);
-            trace.push_back(addr);
-        } else {
-            auto ird_sample = d_ird(rng);
-            assert(ird_sample >= 0 && ird_sample < addrs);
-            tadr min_ird = heappop(irds);
-            trace.push_back(min_ird.addr);
-            heappush(irds, min_ird.ird + ird_sample, min_ird.addr);
-        }
-    }
-    return trace;
-}
-
 int main(int argc, char **argv) {
+    stats::timer parse_timer(stats::parse);
     i64 length, num_addrs, seed, blocksize;
     f64 p_irm, frac_read;
     str ird_arg, irm_arg, sizedist_arg;
+    output_options out_opts;
+    engine_options engine_opts;
     
     po::options_description desc("Allowed options");
     desc.add_options()
@@ -68,6 +33,8 @@ int main(int argc, char **argv) {
         ("rwratio,r", po::value<f64>(&frac_read)->default_value(1), "Fraction of addresses that are reads")
         ("sizedist,z", po::value<str>(&sizedist_arg)->default_value("1:1"), "Request size distribution")
     ;
+    add_output_options(desc, out_opts);
+    add_engine_options(desc, engine_opts);
     
     po::variables_map vm;
     try {
@@ -82,23 +49,34 @@ int main(int argc, char **argv) {
         return 1;
     }
     po::notify(vm);
+    parse_timer.stop();
     
     fmt::print("Generating trace with parameters:\nAddresses: {}\nLength: {}\nProbability of IRM: {}\nSeed: {}\n", 
                num_addrs, length, p_irm, seed);
     
-    std::mt19937_64 rng(seed);
-    auto ird = parse_ird(ird_arg);
-    // use pop = False for 2d-gen
-    auto irm = parse_irm(irm_arg, num_addrs, false);
-    auto sizedist = parse_request_sizes(sizedist_arg);
-    auto addrs = td_gen(num_addrs, length, p_irm, ird, irm, rng);
-    
-    std::uniform_real_distribution<> d_is_read(0, 1);
-    for (auto addr : addrs) {
-        auto is_read = (d_is_read(rng) < frac_read);
-        auto size = sizedist(rng);
-        fmt::print("{:d} {} {}\n", !is_read, size * blocksize, addr * blocksize);
-    }
+    tracegen::generator gen({.addresses = num_addrs,
+                             .length = length,
+                             .p_irm = p_irm,
+                             .seed = seed,
+                             .blocksize = blocksize,
+                             .ird = ird_arg,
+                             .irm = irm_arg,
+                             .rwratio = frac_read,
+                             .sizedist = sizedist_arg,
+                             .scheduler = engine_opts.scheduler,
+                             .threads = engine_opts.threads,
+                             .rng = engine_opts.rng,
+                             .hugepages = engine_opts.hugepages,
+                             .lazy_init = engine_opts.lazy_init,
+                             .sample_rate = engine_opts.sample_rate,
+                             .stack_depths = engine_opts.stack_depths,
+                             .fast_paths = engine_opts.fast_paths},
+                            engine_opts.resume);
+
+    auto writer = open_writer(out_opts, gen.length() - gen.position(), seed, blocksize, params_string(vm),
+                              engine_opts.threads, engine_opts.sample_rate);
+    tracegen::write_trace(gen, *writer, {engine_opts.checkpoint, engine_opts.checkpoint_every});
     
+    stats::report(out_opts.stats);
     return 0;
 }
@@ -0,0 +1,118 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include "rng.h"
+#include "utils.h"
+
+/**
+ * Walker/Vose alias table: O(n) construction, O(1) sampling from one 64-bit
+ * random number and a single table lookup. The high half of r * n selects
+ * the column and the low half is compared against the column's threshold.
+ *
+ * Every discrete distribution in the project samples through this class.
+ * The table is immutable and shared between copies, so samplers can be
+ * copied into worker threads cheaply.
+ */
+class alias_table {
+    struct column {
+        u64 threshold;  // keep the column with probability threshold / 2^64
+        u64 alias;
+    };
+
+    std::shared_ptr<const vec<column>> table;
+
+public:
+    alias_table() = default;
+
+    template <typename It>
+    alias_table(It first, It last) {
+        vec<f64> w(first, last);
+        auto n = w.size();
+        assert(n > 0);
+        f64 sum = 0;
+        for (auto x : w)
+            sum += x;
+        assert(sum > 0);
+
+        vec<column> cols(n);
+        vec<u64> small, large;
+        for (size_t i = 0; i < n; i++) {
+            w[i] = w[i] * n / sum;
+            (w[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            auto s = small.back(), l = large.back();
+            small.pop_back();
+            cols[s] = {to_threshold(w[s]), l};
+            w[l] -= 1.0 - w[s];
+            if (w[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // leftovers are 1 up to rounding error
+        for (auto i : large)
+            cols[i] = {std::numeric_limits<u64>::max(), i};
+        for (auto i : small)
+            cols[i] = {std::numeric_limits<u64>::max(), i};
+        table = std::make_shared<const vec<column>>(std::move(cols));
+    }
+
+    size_t size() const { return table->size(); }
+
+    // Exact probability of each outcome under sample(), as encoded by the
+    // thresholds (so it reflects their 2^-64 rounding, not the input weights).
+    vec<f64> probabilities() const {
+        auto &cols = *table;
+        vec<f64> p(cols.size(), 0.0);
+        for (size_t i = 0; i < cols.size(); i++) {
+            auto keep = cols[i].threshold / 18446744073709551616.0;
+            p[i] += keep;
+            p[cols[i].alias] += 1.0 - keep;
+        }
+        for (auto &x : p)
+            x /= cols.size();
+        return p;
+    }
+
+    template <typename R> i64 operator()(R &rng) const {
+        static_assert(R::min() == 0 && R::max() == std::numeric_limits<u64>::max(),
+                      "alias_table needs a full 64-bit generator");
+        return sample((u64)rng());
+    }
+
+    // out[i] = the sample of the i-th draw from rng; the draws are taken in
+    // bulk, so the result equals out.size() calls of operator().
+    template <typename R> void sample_n(R &rng, std::span<i64> out) const {
+        u64 draws[256];
+        for (size_t i = 0; i < out.size(); i += std::size(draws)) {
+            auto k = std::min(std::size(draws), out.size() - i);
+            draw_n(rng, std::span(draws, k));
+            for (size_t j = 0; j < k; j++)
+                out[i + j] = sample(draws[j]);
+        }
+    }
+
+    // Column for a given uniform 64-bit value.
+    i64 sample(u64 r) const {
+        auto &cols = *table;
+        auto m = (unsigned __int128)r * cols.size();
+        auto idx = (u64)(m >> 64);
+        auto &c = cols[idx];
+        return (i64)((u64)m < c.threshold ? idx : c.alias);
+    }
+
+private:
+    static u64 to_threshold(f64 p) {
+        if (p >= 1.0)
+            return std::numeric_limits<u64>::max();
+        return (u64)(p * 18446744073709551616.0);
+    }
+};
+
+#endif // ALIAS_H
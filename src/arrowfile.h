@@ -0,0 +1,354 @@
+#ifndef ARROWFILE_H
+#define ARROWFILE_H
+
+// Columnar trace format written by `--format=arrow`: the Arrow IPC file
+// format (Feather v2), which Arrow and the engines built on it (pandas,
+// Polars) map and query without conversion.
+//
+// Schema (little-endian, no nulls):
+//
+//   op       bool, bit-packed, true for writes
+//   size     int64 request size in bytes, dictionary-encoded with int32
+//            indices (dictionary id 0)
+//   offset   int64 offset in bytes
+//
+// plus custom metadata tracegen.params and tracegen.seed, the header fields
+// of tracefile.h. The records are written as record batches of up to
+// `batch_size` records, and the size dictionary as one dictionary batch
+// after them, when all sizes are known (the file format allows that, and
+// needs no delta dictionaries, which not every reader supports); buffers
+// are 64-byte aligned. A file is only readable once finished. This header
+// only needs the standard library; the flatbuffer metadata (Schema.fbs,
+// Message.fbs and File.fbs of the Arrow format) is encoded by hand.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "tracefile.h"
+
+namespace arrowfile {
+
+constexpr char magic[6] = {'A', 'R', 'R', 'O', 'W', '1'};
+
+namespace detail {
+
+/**
+ * Minimal flatbuffer builder. Objects are written front to back: a table,
+ * then the objects it references, whose offsets are patched into it once
+ * written (flatbuffer offsets only point forward). Each vtable is written
+ * just before its table.
+ */
+class flatbuffer {
+public:
+    using object = std::function<size_t(flatbuffer &)>; // writes an object, returns its position
+
+    struct field {
+        uint16_t id;
+        uint8_t size; // of a scalar; 0 for a reference
+        uint64_t value;
+        object ref;
+    };
+    using table = std::vector<field>;
+
+    std::vector<uint8_t> buf;
+
+    void pad_to(size_t align) { buf.resize((buf.size() + align - 1) / align * align, 0); }
+
+    void set(size_t at, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; i++)
+            buf[at + i] = (uint8_t)(value >> (8 * i));
+    }
+
+    size_t put(uint64_t value, size_t size) {
+        pad_to(size);
+        auto at = buf.size();
+        buf.resize(at + size);
+        set(at, value, size);
+        return at;
+    }
+
+    size_t write(const table &t) {
+        uint16_t slots = 0;
+        for (auto &f : t)
+            slots = std::max<uint16_t>(slots, f.id + 1);
+        // fields by decreasing size after the vtable offset, each aligned
+        std::vector<size_t> order(t.size());
+        for (size_t i = 0; i < t.size(); i++)
+            order[i] = i;
+        auto width = [](const field &f) { return f.size ? f.size : 4; };
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return width(t[a]) > width(t[b]); });
+        std::vector<uint16_t> where(slots, 0);
+        size_t length = 4;
+        for (auto i : order) {
+            length = (length + width(t[i]) - 1) / width(t[i]) * width(t[i]);
+            where[t[i].id] = (uint16_t)length;
+            length += width(t[i]);
+        }
+        pad_to(2);
+        auto vtable = buf.size();
+        put(4 + 2 * slots, 2);
+        put(length, 2);
+        for (auto w : where)
+            put(w, 2);
+        pad_to(8); // so offsets within the table align like absolute ones
+        auto start = buf.size();
+        buf.resize(start + length, 0);
+        set(start, start - vtable, 4);
+        for (auto &f : t)
+            if (f.size)
+                set(start + where[f.id], f.value, f.size);
+        for (auto &f : t)
+            if (!f.size) {
+                auto at = start + where[f.id];
+                set(at, f.ref(*this) - at, 4);
+            }
+        return start;
+    }
+
+    // The finished buffer with t as its root, padded to 8 bytes.
+    std::vector<uint8_t> finish(const table &t) {
+        buf.clear();
+        put(0, 4);
+        set(0, write(t), 4);
+        pad_to(8);
+        return std::move(buf);
+    }
+
+    static object string(std::string s) {
+        return [s](flatbuffer &b) {
+            auto at = b.put(s.size(), 4);
+            b.buf.insert(b.buf.end(), s.begin(), s.end());
+            b.buf.push_back(0);
+            return at;
+        };
+    }
+
+    // Vector of 8-byte aligned structs, given as their bytes.
+    static object structs(std::vector<uint8_t> bytes, size_t count) {
+        return [bytes, count](flatbuffer &b) {
+            b.pad_to(8);
+            b.buf.resize(b.buf.size() + 4, 0);
+            auto at = b.put(count, 4);
+            b.buf.insert(b.buf.end(), bytes.begin(), bytes.end());
+            return at;
+        };
+    }
+
+    static object tables(std::vector<table> ts) {
+        return [ts](flatbuffer &b) {
+            auto at = b.put(ts.size(), 4);
+            b.buf.resize(b.buf.size() + 4 * ts.size(), 0);
+            for (size_t i = 0; i < ts.size(); i++) {
+                auto slot = at + 4 + 4 * i;
+                b.set(slot, b.write(ts[i]) - slot, 4);
+            }
+            return at;
+        };
+    }
+
+    static object nested(table t) {
+        return [t](flatbuffer &b) { return b.write(t); };
+    }
+};
+
+using table = flatbuffer::table;
+using fb = flatbuffer;
+
+// Enum values of the Arrow format.
+constexpr uint64_t metadata_v5 = 4;
+constexpr uint64_t header_schema = 1, header_dictionary_batch = 2, header_record_batch = 3;
+constexpr uint64_t type_int = 2, type_bool = 6;
+
+inline table int_type(int bits) { return {{0, 4, (uint64_t)bits, {}}, {1, 1, 1, {}}}; }
+
+inline void append(std::vector<uint8_t> &out, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        out.push_back((uint8_t)(value >> (8 * i)));
+}
+
+inline table schema(const std::vector<std::pair<std::string, std::string>> &metadata) {
+    auto column = [](const char *name, uint64_t type_type, table type) {
+        return table{{0, 0, 0, fb::string(name)},
+                     {1, 1, 0, {}},
+                     {2, 1, type_type, {}},
+                     {3, 0, 0, fb::nested(type)},
+                     {5, 0, 0, fb::tables({})}};
+    };
+    auto size = column("size", type_int, int_type(64));
+    size.push_back({4, 0, 0, fb::nested({{0, 8, 0, {}}, {1, 0, 0, fb::nested(int_type(32))}, {2, 1, 0, {}}})});
+    std::vector<table> kv;
+    for (auto &[k, v] : metadata)
+        kv.push_back({{0, 0, 0, fb::string(k)}, {1, 0, 0, fb::string(v)}});
+    return {{0, 2, 0, {}},
+            {1, 0, 0, fb::tables({column("op", type_bool, {}), size, column("offset", type_int, int_type(64))})},
+            {2, 0, 0, fb::tables(kv)}};
+}
+
+// RecordBatch table: `length` rows, one node per column, buffers (offset, length) in the body.
+inline table record_batch(uint64_t length, size_t columns, const std::vector<std::pair<uint64_t, uint64_t>> &buffers) {
+    std::vector<uint8_t> nodes, bufs;
+    for (size_t i = 0; i < columns; i++) {
+        append(nodes, length, 8);
+        append(nodes, 0, 8);
+    }
+    for (auto [off, len] : buffers) {
+        append(bufs, off, 8);
+        append(bufs, len, 8);
+    }
+    return {{0, 8, length, {}}, {1, 0, 0, fb::structs(nodes, columns)}, {2, 0, 0, fb::structs(bufs, buffers.size())}};
+}
+
+inline std::vector<uint8_t> message(uint64_t header_type, table header, uint64_t body_length) {
+    return fb().finish({{0, 2, metadata_v5, {}},
+                        {1, 1, header_type, {}},
+                        {2, 0, 0, fb::nested(header)},
+                        {3, 8, body_length, {}}});
+}
+
+// Message body: the buffers, each padded to 64 bytes.
+class body {
+public:
+    std::vector<uint8_t> bytes;
+    std::vector<std::pair<uint64_t, uint64_t>> buffers;
+
+    void add(const void *data, size_t n) {
+        buffers.push_back({bytes.size(), n});
+        auto at = bytes.size();
+        bytes.resize((at + n + 63) / 64 * 64, 0);
+        if (n > 0)
+            std::memcpy(bytes.data() + at, data, n);
+    }
+
+    void empty() { buffers.push_back({bytes.size(), 0}); } // validity bitmap of a column without nulls
+};
+
+} // namespace detail
+
+// File block of the footer: where a dictionary or record batch message is.
+struct block {
+    uint64_t offset;
+    uint32_t metadata_length; // continuation marker, length and flatbuffer
+    uint64_t body_length;
+};
+
+/**
+ * Encodes a trace into the bytes of an Arrow IPC file: start() once, add()
+ * records, batch() to encode the added records as one record batch, and
+ * finish() for the footer. Each call appends to `out`.
+ */
+class encoder {
+    std::vector<std::pair<std::string, std::string>> metadata;
+    uint64_t position = 0;
+    std::vector<block> dictionaries, batches;
+
+    std::unordered_map<int64_t, int32_t> codes;
+    std::vector<int64_t> sizes;
+    int64_t last_size = -1;
+    int32_t last_code = 0;
+
+    std::vector<uint8_t> ops;
+    std::vector<int32_t> size_codes;
+    std::vector<int64_t> offsets;
+    size_t n = 0;
+
+    void emit(std::vector<uint8_t> &out, std::vector<uint8_t> meta, const std::vector<uint8_t> &body,
+              std::vector<block> *index) {
+        meta.resize(meta.size() + (64 - (position + 8 + meta.size()) % 64) % 64, 0); // body 64-byte aligned
+        if (index)
+            index->push_back({position, (uint32_t)(8 + meta.size()), body.size()});
+        detail::append(out, 0xffffffff, 4);
+        detail::append(out, meta.size(), 4);
+        out.insert(out.end(), meta.begin(), meta.end());
+        out.insert(out.end(), body.begin(), body.end());
+        position += 8 + meta.size() + body.size();
+    }
+
+    static std::vector<uint8_t> blocks(const std::vector<block> &bs) {
+        std::vector<uint8_t> bytes;
+        for (auto &b : bs) {
+            detail::append(bytes, b.offset, 8);
+            detail::append(bytes, b.metadata_length, 8); // int32 and padding
+            detail::append(bytes, b.body_length, 8);
+        }
+        return bytes;
+    }
+
+public:
+    explicit encoder(std::vector<std::pair<std::string, std::string>> metadata) : metadata(std::move(metadata)) {}
+
+    void start(std::vector<uint8_t> &out) {
+        out.insert(out.end(), magic, magic + sizeof(magic));
+        out.resize(out.size() + 2, 0);
+        position = 8;
+        emit(out, detail::message(detail::header_schema, detail::schema(metadata), 0), {}, nullptr);
+    }
+
+    void add(int64_t op, int64_t size, int64_t offset) {
+        if (size != last_size) {
+            auto [it, fresh] = codes.try_emplace(size, (int32_t)sizes.size());
+            if (fresh)
+                sizes.push_back(size);
+            last_size = size;
+            last_code = it->second;
+        }
+        if (n % 8 == 0)
+            ops.push_back(0);
+        ops.back() |= (op != 0) << (n % 8);
+        size_codes.push_back(tracefile::le((uint32_t)last_code));
+        offsets.push_back(tracefile::le((uint64_t)offset));
+        n++;
+    }
+
+    size_t pending() const { return n; }
+
+    void batch(std::vector<uint8_t> &out) {
+        detail::body body;
+        body.empty();
+        body.add(ops.data(), ops.size());
+        body.empty();
+        body.add(size_codes.data(), 4 * n);
+        body.empty();
+        body.add(offsets.data(), 8 * n);
+        emit(out, detail::message(detail::header_record_batch, detail::record_batch(n, 3, body.buffers),
+                                  body.bytes.size()),
+             body.bytes, &batches);
+        ops.clear();
+        size_codes.clear();
+        offsets.clear();
+        n = 0;
+    }
+
+    void finish(std::vector<uint8_t> &out) {
+        if (n > 0)
+            batch(out);
+        // the size dictionary, complete now; the file format allows it after the batches using it
+        detail::body dict;
+        std::vector<uint64_t> values;
+        for (auto s : sizes)
+            values.push_back(tracefile::le((uint64_t)s));
+        dict.empty();
+        dict.add(values.data(), 8 * values.size());
+        detail::table dictionary_batch{
+            {0, 8, 0, {}}, {1, 0, 0, detail::fb::nested(detail::record_batch(values.size(), 1, dict.buffers))}};
+        emit(out, detail::message(detail::header_dictionary_batch, dictionary_batch, dict.bytes.size()), dict.bytes,
+             &dictionaries);
+        detail::append(out, 0xffffffff, 4); // end-of-stream marker
+        detail::append(out, 0, 4);
+        auto footer = detail::fb().finish({{0, 2, detail::metadata_v5, {}},
+                                           {1, 0, 0, detail::fb::nested(detail::schema(metadata))},
+                                           {2, 0, 0, detail::fb::structs(blocks(dictionaries), dictionaries.size())},
+                                           {3, 0, 0, detail::fb::structs(blocks(batches), batches.size())}});
+        out.insert(out.end(), footer.begin(), footer.end());
+        detail::append(out, footer.size(), 4);
+        out.insert(out.end(), magic, magic + sizeof(magic));
+    }
+};
+
+} // namespace arrowfile
+
+#endif // ARROWFILE_H
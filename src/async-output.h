@@ -0,0 +1,426 @@
+#ifndef ASYNC_OUTPUT_H
+#define ASYNC_OUTPUT_H
+
+// Asynchronous output for the byte-stream writers (--io thread|uring). The
+// generating thread copies formatted bytes into one of a few large aligned
+// buffers; full buffers travel over a lock-free single-producer queue to an
+// I/O thread that writes them while the next one fills, and come back over a
+// second queue once written.
+//
+// With --io uring, regular files and block devices are opened with O_DIRECT
+// and the I/O thread keeps every buffer in flight through io_uring (raw
+// syscalls, no liburing), so the device queue stays full. Pipes, terminals,
+// kernels without io_uring and file systems refusing O_DIRECT fall back to
+// write(2) on the I/O thread.
+
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include "utils.h"
+
+// Bounded single-producer single-consumer queue; push() blocks while full
+// and pop() while empty (C++20 atomic wait, no locks).
+template <typename T>
+class spsc_queue {
+    vec<T> slots;
+    u64 mask;
+    alignas(64) std::atomic<u64> head{0}; // next slot to pop
+    alignas(64) std::atomic<u64> tail{0}; // next slot to push
+
+public:
+    explicit spsc_queue(size_t capacity) : slots(std::bit_ceil(capacity)), mask(slots.size() - 1) {}
+
+    void push(const T &x) {
+        auto t = tail.load(std::memory_order_relaxed);
+        for (auto h = head.load(std::memory_order_acquire); t - h == slots.size();
+             h = head.load(std::memory_order_acquire))
+            head.wait(h, std::memory_order_acquire);
+        slots[t & mask] = x;
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+    }
+
+    T pop() {
+        auto h = head.load(std::memory_order_relaxed);
+        for (auto t = tail.load(std::memory_order_acquire); t == h; t = tail.load(std::memory_order_acquire))
+            tail.wait(t, std::memory_order_acquire);
+        T x = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return x;
+    }
+
+    bool try_pop(T &x) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == h)
+            return false;
+        x = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return true;
+    }
+};
+
+// Minimal io_uring: queue reads and writes at explicit offsets, submit them
+// in batches and reap completions.
+class uring {
+    int ring = -1;
+    void *sq_ptr = MAP_FAILED, *cq_ptr = MAP_FAILED;
+    size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+    unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+    io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+    io_uring_cqe *cqes;
+    unsigned unsubmitted = 0;
+
+    static int enter(int ring, unsigned submit, unsigned wait, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, ring, submit, wait, flags, nullptr, 0);
+    }
+
+public:
+    uring() = default;
+    uring(const uring &) = delete;
+    uring &operator=(const uring &) = delete;
+
+    ~uring() {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED)
+            munmap(sq_ptr, sq_len);
+        if (ring >= 0)
+            ::close(ring);
+    }
+
+    // False if the kernel (or a seccomp filter) does not offer io_uring.
+    bool open(unsigned entries) {
+        io_uring_params p{};
+        ring = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (ring < 0)
+            return false;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_len = cq_len = std::max(sq_len, cq_len);
+        sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED)
+            return false;
+        cq_ptr = single ? sq_ptr
+                        : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+                               IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+            return false;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe *)mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+                                    IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        auto sq = (char *)sq_ptr, cq = (char *)cq_ptr;
+        sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned *)(sq + p.sq_off.array);
+        cq_head = (unsigned *)(cq + p.cq_off.head);
+        cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    // Queues an operation without submitting it; the caller keeps at most
+    // `entries` prepared or in flight.
+    void prepare(uint8_t opcode, int fd, const void *buf, unsigned len, u64 offset, u64 data) {
+        auto tail = *sq_tail;
+        auto idx = tail & *sq_mask;
+        auto &sqe = sqes[idx];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = (u64)buf;
+        sqe.len = len;
+        sqe.off = offset;
+        sqe.user_data = data;
+        sq_array[idx] = idx;
+        std::atomic_ref(*sq_tail).store(tail + 1, std::memory_order_release);
+        unsubmitted++;
+    }
+
+    // Submits everything prepared in one system call.
+    bool submit() {
+        while (unsubmitted > 0) {
+            int r = enter(ring, unsubmitted, 0, 0);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            unsubmitted -= r;
+        }
+        return true;
+    }
+
+    bool write(int fd, const void *buf, unsigned len, u64 offset, u64 data) {
+        prepare(IORING_OP_WRITE, fd, buf, len, offset, data);
+        return submit();
+    }
+
+    // A completion if one is ready: (user data, bytes transferred or -errno).
+    bool reap(std::pair<u64, int> &done) {
+        auto head = *cq_head;
+        if (head == std::atomic_ref(*cq_tail).load(std::memory_order_acquire))
+            return false;
+        auto &cqe = cqes[head & *cq_mask];
+        done = {cqe.user_data, cqe.res};
+        std::atomic_ref(*cq_head).store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waits for a completion.
+    std::pair<u64, int> wait() {
+        std::pair<u64, int> done;
+        while (!reap(done))
+            if (enter(ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                return {0, -errno};
+        return done;
+    }
+};
+
+/**
+ * Byte stream to a file descriptor through an I/O thread. write() only
+ * blocks when every buffer is queued; errors from the I/O thread are fatal
+ * on the next call. flush() waits until everything written so far is out.
+ * A flush of a partial buffer ends O_DIRECT for the rest of the file, since
+ * direct writes must stay aligned.
+ */
+class async_output {
+    static constexpr size_t align = 4096;
+    static constexpr size_t buffer_size = 8 << 20;
+    static constexpr size_t buffers = 4;
+
+    struct slot {
+        uint32_t buffer;
+        uint32_t len; // < buffer_size only for flushes; 0 stops the thread
+    };
+
+    int fd;
+    bool owned;
+    str path;
+    bool direct = false, use_uring = false, seekable = false;
+    vec<char *> bufs;
+    spsc_queue<slot> full{buffers + 1}, empty{buffers};
+    std::atomic<int> error{0};
+    std::thread worker;
+
+    uint32_t cur = 0;
+    size_t used = 0;
+    u64 offset = 0; // I/O thread: file position of the next buffer
+
+    void fail(int err) {
+        int none = 0;
+        error.compare_exchange_strong(none, err);
+    }
+
+    // write(2) until done; EINTR and short writes are retried.
+    bool write_all(const char *p, size_t n, u64 at) {
+        while (n > 0) {
+            auto r = seekable ? ::pwrite(fd, p, n, at) : ::write(fd, p, n);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0 && errno == EINVAL && direct) {
+                end_direct();
+                continue;
+            }
+            if (r <= 0) {
+                fail(r < 0 ? errno : EIO);
+                return false;
+            }
+            p += r;
+            n -= r;
+            at += r;
+        }
+        return true;
+    }
+
+    void end_direct() {
+        if (!direct)
+            return;
+        direct = false;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    }
+
+    void run_sync() {
+        for (;;) {
+            auto s = full.pop();
+            if (s.len == 0)
+                return;
+            if (s.len % align)
+                end_direct();
+            write_all(bufs[s.buffer], s.len, offset);
+            offset += s.len;
+            empty.push({s.buffer, 0});
+        }
+    }
+
+    // Every buffer can be in flight at once; completions return them.
+    void run_uring(uring &ring) {
+        vec<uint32_t> lens(buffers);
+        vec<u64> offsets(buffers);
+        size_t inflight = 0;
+        auto complete = [&] {
+            auto [b, res] = ring.wait();
+            inflight--;
+            if (res < 0)
+                fail(-res);
+            else if ((uint32_t)res < lens[b]) // short write: finish it synchronously
+                write_all(bufs[b] + res, lens[b] - res, offsets[b] + res);
+            empty.push({(uint32_t)b, 0});
+        };
+        for (;;) {
+            slot s;
+            if (inflight > 0 && !full.try_pop(s)) {
+                complete();
+                continue;
+            }
+            if (inflight == 0)
+                s = full.pop();
+            if (s.len == 0 || s.len % align) {
+                // stop or partial flush: drain, then write synchronously
+                while (inflight > 0)
+                    complete();
+                if (s.len == 0)
+                    return;
+                end_direct();
+                write_all(bufs[s.buffer], s.len, offset);
+                offset += s.len;
+                empty.push({s.buffer, 0});
+                continue;
+            }
+            lens[s.buffer] = s.len;
+            offsets[s.buffer] = offset;
+            if (!ring.write(fd, bufs[s.buffer], s.len, offset, s.buffer)) {
+                fail(errno ? errno : EIO);
+                empty.push({s.buffer, 0});
+            } else {
+                inflight++;
+            }
+            offset += s.len;
+        }
+    }
+
+    void check() {
+        if (auto err = error.load(std::memory_order_relaxed))
+            log_fatal("Cannot write {}: {}", path, std::strerror(err));
+    }
+
+    void submit(size_t len) {
+        full.push({cur, (uint32_t)len});
+        cur = empty.pop().buffer;
+        used = 0;
+        check();
+    }
+
+public:
+    // io is "thread" or "uring"; path "-" is stdout.
+    async_output(const str &path, const str &io) : path(path) {
+        ensure_fatal(io == "thread" || io == "uring", "Invalid I/O mode: {} (expected stdio, thread or uring)",
+                     io);
+        if (path == "-") {
+            std::fflush(stdout); // anything printed before the trace goes first
+            fd = STDOUT_FILENO;
+            owned = false;
+        } else {
+            auto flags = O_WRONLY | O_CREAT | O_TRUNC;
+            fd = io == "uring" ? ::open(path.c_str(), flags | O_DIRECT, 0644) : -1;
+            direct = fd >= 0;
+            if (fd < 0) // e.g. tmpfs refuses O_DIRECT
+                fd = ::open(path.c_str(), flags, 0644);
+            ensure_fatal(fd >= 0, "Cannot open output file {}: {}", path, std::strerror(errno));
+            owned = true;
+        }
+        // stdout keeps its shared file position, so it is always written in order with write(2)
+        struct stat st;
+        seekable = owned && fstat(fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+        if (!seekable)
+            end_direct();
+        for (size_t i = 0; i < buffers; i++) {
+            auto p = (char *)std::aligned_alloc(align, buffer_size);
+            ensure_fatal(p, "Cannot allocate output buffers");
+            bufs.push_back(p);
+        }
+        for (uint32_t i = 1; i < buffers; i++)
+            empty.push({i, 0});
+
+        auto ring = std::make_unique<uring>();
+        use_uring = io == "uring" && seekable && ring->open(buffers);
+        if (!use_uring)
+            end_direct();
+        worker = use_uring ? std::thread([this, r = std::move(ring)] { run_uring(*r); })
+                       : std::thread([this] { run_sync(); });
+    }
+
+    async_output(const async_output &) = delete;
+    async_output &operator=(const async_output &) = delete;
+
+    ~async_output() {
+        close();
+        for (auto p : bufs)
+            std::free(p);
+    }
+
+    void write(const void *data, size_t n) {
+        auto p = (const char *)data;
+        while (n > 0) {
+            auto k = std::min(n, buffer_size - used);
+            std::memcpy(bufs[cur] + used, p, k);
+            used += k;
+            p += k;
+            n -= k;
+            if (used == buffer_size)
+                submit(used);
+        }
+    }
+
+    void flush() {
+        if (used > 0)
+            submit(used);
+        // every buffer back means every write completed
+        vec<slot> back;
+        for (size_t i = 0; i + 1 < buffers; i++)
+            back.push_back(empty.pop());
+        for (auto &s : back)
+            empty.push(s);
+        check();
+    }
+
+    // Overwrites bytes at a file offset after flushing (header fix-ups);
+    // false if the output is not seekable.
+    bool patch(u64 at, const void *data, size_t n) {
+        flush();
+        if (!seekable)
+            return false;
+        end_direct();
+        return ::pwrite(fd, data, n, at) == (ssize_t)n;
+    }
+
+    void close() {
+        if (!worker.joinable())
+            return;
+        if (used > 0)
+            submit(used);
+        full.push({0, 0});
+        worker.join();
+        if (owned)
+            ::close(fd);
+        check();
+    }
+};
+
+#endif // ASYNC_OUTPUT_H
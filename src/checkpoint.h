@@ -0,0 +1,183 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Generator snapshots for --checkpoint/--resume. Stateful components (RNG
+// engines, schedulers, samplers with hidden state, generators) provide
+//
+//   void save(state_writer &w) const
+//   void load(state_reader &r)
+//
+// writing their fields in a fixed order; everything derived from the
+// command line (alias tables, intervals, group popularities) is rebuilt from
+// the config instead. Snapshots are raw native-endian images meant to be
+// resumed by the same build, not an interchange format.
+//
+// File layout: magic "TRGNCKPT", u32 version, the generator key (the config
+// without its length, see libtracegen.cc), the number of records produced,
+// then the state of the pipeline.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <unistd.h>
+#include "utils.h"
+
+class state_writer {
+    vec<uint8_t> buf;
+
+public:
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    void put(const T &x) {
+        auto p = (const uint8_t *)&x;
+        buf.insert(buf.end(), p, p + sizeof(T));
+    }
+
+    template <typename T, typename A>
+    void put(const std::vector<T, A> &v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        put((u64)v.size());
+        auto p = (const uint8_t *)v.data();
+        buf.insert(buf.end(), p, p + v.size() * sizeof(T));
+    }
+
+    void put(const str &s) {
+        put((u64)s.size());
+        buf.insert(buf.end(), s.begin(), s.end());
+    }
+
+    const vec<uint8_t> &bytes() const { return buf; }
+};
+
+class state_reader {
+    std::span<const uint8_t> data;
+    size_t pos = 0;
+
+    const uint8_t *take(size_t n) {
+        ensure_fatal(n <= data.size() - pos, "Truncated checkpoint");
+        auto p = data.data() + pos;
+        pos += n;
+        return p;
+    }
+
+public:
+    explicit state_reader(std::span<const uint8_t> data) : data(data) {}
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    void get(T &x) {
+        std::memcpy((void *)&x, take(sizeof(T)), sizeof(T));
+    }
+
+    template <typename T, typename A>
+    void get(std::vector<T, A> &v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        u64 n;
+        get(n);
+        ensure_fatal(n <= (data.size() - pos) / sizeof(T), "Truncated checkpoint");
+        v.resize(n);
+        std::memcpy((void *)v.data(), take(n * sizeof(T)), n * sizeof(T));
+    }
+
+    void get(str &s) {
+        u64 n;
+        get(n);
+        auto p = take(n);
+        s.assign((const char *)p, n);
+    }
+
+    bool done() const { return pos == data.size(); }
+};
+
+// State of x if it has any; samplers without save()/load() are stateless.
+template <typename T>
+void save_state(state_writer &w, const T &x) {
+    if constexpr (requires { x.save(w); })
+        x.save(w);
+}
+
+template <typename T>
+void load_state(state_reader &r, T &x) {
+    if constexpr (requires { x.load(r); })
+        x.load(r);
+}
+
+namespace checkpoint {
+
+inline constexpr char magic[8] = {'T', 'R', 'G', 'N', 'C', 'K', 'P', 'T'};
+inline constexpr uint32_t version = 1;
+
+// "{}" in a --checkpoint path stands for the record count, so periodic
+// checkpoints can be kept side by side instead of replacing each other.
+inline str path_for(const str &pattern, u64 records) {
+    auto at = pattern.find("{}");
+    if (at == str::npos)
+        return pattern;
+    return pattern.substr(0, at) + std::to_string(records) + pattern.substr(at + 2);
+}
+
+inline state_writer header(const str &key, u64 records) {
+    state_writer head;
+    head.put(magic);
+    head.put(version);
+    head.put(key);
+    head.put(records);
+    return head;
+}
+
+// The file write() would produce, in memory.
+inline vec<uint8_t> image(const str &key, u64 records, const state_writer &state) {
+    auto data = header(key, records).bytes();
+    data.insert(data.end(), state.bytes().begin(), state.bytes().end());
+    return data;
+}
+
+// Writes header and state to path.tmp, syncs it and renames it over path,
+// so a crash leaves either the previous snapshot or the new one.
+inline void write(const str &path, const str &key, u64 records, const state_writer &state) {
+    auto head = header(key, records);
+    auto tmp = path + ".tmp";
+    auto f = std::fopen(tmp.c_str(), "wb");
+    ensure_fatal(f, "Cannot open checkpoint {}: {}", tmp, std::strerror(errno));
+    auto ok = std::fwrite(head.bytes().data(), 1, head.bytes().size(), f) == head.bytes().size() &&
+              std::fwrite(state.bytes().data(), 1, state.bytes().size(), f) == state.bytes().size() &&
+              std::fflush(f) == 0 && ::fsync(fileno(f)) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    ensure_fatal(ok, "Cannot write checkpoint {}: {}", tmp, std::strerror(errno));
+    ensure_fatal(std::rename(tmp.c_str(), path.c_str()) == 0, "Cannot rename {} to {}: {}", tmp, path,
+                 std::strerror(errno));
+}
+
+// Whole file; read_header() parses the front of it.
+inline vec<uint8_t> slurp(const str &path) {
+    auto f = std::fopen(path.c_str(), "rb");
+    ensure_fatal(f, "Cannot open checkpoint {}: {}", path, std::strerror(errno));
+    std::fseek(f, 0, SEEK_END);
+    vec<uint8_t> data(std::ftell(f));
+    std::rewind(f);
+    auto ok = std::fread(data.data(), 1, data.size(), f) == data.size();
+    std::fclose(f);
+    ensure_fatal(ok, "Cannot read checkpoint {}: {}", path, std::strerror(errno));
+    return data;
+}
+
+// Checks the header and returns (key, records); r is left at the state.
+inline std::pair<str, u64> read_header(state_reader &r, const str &path) {
+    char m[8];
+    uint32_t v;
+    r.get(m);
+    ensure_fatal(std::memcmp(m, magic, sizeof(m)) == 0, "{} is not a tracegen checkpoint", path);
+    r.get(v);
+    ensure_fatal(v == version, "Unsupported checkpoint version {} in {}", v, path);
+    str key;
+    u64 records;
+    r.get(key);
+    r.get(records);
+    return {key, records};
+}
+
+} // namespace checkpoint
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,176 @@
+#ifndef CLI_H
+#define CLI_H
+
+// Command-line options shared by trace-gen, 2d-tracegen and kd-tracegen.
+
+#include <boost/program_options.hpp>
+#include <fmt/core.h>
+#include "libtracegen.h"
+#include "mrc.h"
+#include "replay.h"
+#include "trace-stream.h"
+#include "utils.h"
+
+struct output_options {
+    str format;
+    str output;
+    str stats; // empty unless --stats was given
+    f64 mrc_sample = 1;
+    i64 mrc_points = 1000;
+    str compress;
+    int compress_level;
+    int compress_threads;
+    str io;
+    i64 batch_size;
+    replay_options replay;
+};
+
+inline void add_output_options(boost::program_options::options_description &desc,
+                               output_options &opts) {
+    namespace po = boost::program_options;
+    // clang-format off
+    desc.add_options()
+        ("format", po::value<str>(&opts.format)->default_value("text"),
+            "Output format: text (\"<op> <size> <offset>\" lines), bin (packed records, see tracefile.h), "
+            "packed (delta-coded, compressed blocks, see tracepack.h), "
+            "arrow (Arrow IPC file of op, size and offset columns, see arrowfile.h), "
+            "mrc (LRU miss-ratio curve of the trace instead of the trace itself) "
+            "or replay (issue the reads and writes against the output file or block device)")
+        ("output,o", po::value<str>(&opts.output)->default_value("-"),
+            "Output file, '-' for stdout (bin and replay require a file)")
+        ("stats", po::value<str>(&opts.stats)->implicit_value("text")->notifier([](const str &f) {
+                ensure_fatal(f == "text" || f == "json", "Invalid stats format: {} (expected text or json)", f);
+            }),
+            "Report phase timings and counters on stderr at exit; --stats=json for a JSON object")
+        ("mrc-sample", po::value<f64>(&opts.mrc_sample),
+            "--format=mrc: SHARDS sampling rate in (0, 1]; below 1 the curve is approximate "
+            "but memory and time shrink with the rate (default 1, exact)")
+        ("mrc-points", po::value<i64>(&opts.mrc_points),
+            "--format=mrc: number of cache sizes on the curve (default 1000)")
+        ("compress", po::value<str>(&opts.compress)->default_value(tracepack::default_codec_name()),
+            "--format=packed: block compression, zstd, lz4 or none (default: the best compiled in)")
+        ("compress-level", po::value<int>(&opts.compress_level)->default_value(3),
+            "--format=packed: zstd level, or LZ4 acceleration")
+        ("compress-threads", po::value<int>(&opts.compress_threads)->default_value(2),
+            "--format=packed: blocks compressed in the background at once (0: inline)")
+        ("batch-size", po::value<i64>(&opts.batch_size)->default_value(1 << 16),
+            "--format=arrow: records per record batch")
+        ("io", po::value<str>(&opts.io)->default_value("stdio")->notifier([](const str &m) {
+                ensure_fatal(m == "stdio" || m == "thread" || m == "uring",
+                             "Invalid I/O mode: {} (expected stdio, thread or uring)", m);
+            }),
+            "Output I/O for text, packed and arrow: stdio, thread (write(2) on a background thread) or uring "
+            "(io_uring with O_DIRECT on files and block devices; falls back to thread)")
+        ("iops", po::value<f64>(&opts.replay.iops)->default_value(0),
+            "--format=replay: target I/O rate (0: as fast as the queue depth allows)")
+        ("arrivals", po::value<str>(&opts.replay.arrivals)->default_value("fixed"),
+            "--format=replay: inter-arrival gaps at --iops, fixed or poisson (exponential)")
+        ("queue-depth", po::value<int>(&opts.replay.queue_depth)->default_value(32),
+            "--format=replay: most I/Os outstanding at once")
+        ("latency", po::value<str>(&opts.replay.latency),
+            "--format=replay: write the per-op latency histograms to this file")
+    ;
+    // clang-format on
+}
+
+struct engine_options {
+    str scheduler;
+    int threads;
+    str rng;
+    bool hugepages;
+    bool lazy_init;
+    f64 sample_rate = 1;
+    bool stack_depths;
+    bool fast_paths;
+    str checkpoint;
+    i64 checkpoint_every;
+    str resume;
+};
+
+inline void add_engine_options(boost::program_options::options_description &desc,
+                               engine_options &opts) {
+    namespace po = boost::program_options;
+    // clang-format off
+    desc.add_options()
+        ("scheduler", po::value<str>(&opts.scheduler)->default_value("heap"),
+            "IRD scheduler: heap (binary heap, reference order), bucket (O(1) circular bucket queue) "
+            "or compact (the heap in 8 bytes per address, same trace; for footprints up to 2^32)")
+        ("threads", po::value<int>(&opts.threads)->default_value(1),
+            "Generate IRD accesses on N threads, each owning a shard of the addresses "
+            "(deterministic for a given seed and N, but a different trace than N = 1)")
+        ("rng", po::value<str>(&opts.rng)->default_value("mt"),
+            "Random engine: mt (std::mt19937_64), xoshiro (xoshiro256++), pcg (PCG64) "
+            "or philox (counter-based Philox4x64-10)")
+        ("hugepages", po::bool_switch(&opts.hugepages),
+            "Back the compact scheduler (or the --stack-depths stack) with transparent huge pages")
+        ("lazy-init", po::bool_switch(&opts.lazy_init),
+            "Draw the initial schedule as per-time counts and add addresses as they first come due, "
+            "so startup does not scale with the footprint (single-threaded; a different trace)")
+        ("sample-rate", po::value<f64>(&opts.sample_rate),
+            "Generate only the accesses to a hash sample of this fraction of the addresses, in "
+            "proportionally fewer records; --format=mrc scales the curve back up (default 1, all)")
+        ("stack-depths", po::bool_switch(&opts.stack_depths),
+            "Read --ird as a distribution of LRU stack depths (class i of k: depths i to i + 1 times "
+            "m / k) and access the address at the drawn depth; single-threaded, up to 2^31 addresses")
+        ("fast-paths", po::bool_switch(&opts.fast_paths),
+            "With -p 0 or -p 1, skip the per-access IRM trial (and, for -p 1, the IRD schedule); "
+            "single-threaded, and a different trace than without")
+        ("checkpoint", po::value<str>(&opts.checkpoint),
+            "Save the generator state to this file at the end of the trace (and every "
+            "--checkpoint-every records); {} in the name is replaced by the record count")
+        ("checkpoint-every", po::value<i64>(&opts.checkpoint_every)->default_value(0),
+            "Records between checkpoints (0: only at the end)")
+        ("resume", po::value<str>(&opts.resume),
+            "Continue the trace from a checkpoint of the same parameters; a larger --length "
+            "extends it. Only the records after the checkpoint are written")
+    ;
+    // clang-format on
+}
+
+// Writer for the output options; see make_writer(), packed_writer,
+// arrow_writer, mrc_writer and replay_writer. sample_rate is the
+// generator's (config::sample_rate).
+inline std::unique_ptr<trace_writer> open_writer(const output_options &opts, u64 records, i64 seed,
+                                                 i64 blocksize, const str &params, int threads = 1,
+                                                 f64 sample_rate = 1) {
+    if (opts.format == "mrc")
+        return std::make_unique<mrc_writer>(opts.output, blocksize, opts.mrc_sample, opts.mrc_points,
+                                            sample_rate);
+    if (opts.format == "replay")
+        return std::make_unique<replay_writer>(opts.output, blocksize, seed, opts.replay);
+    if (opts.format == "arrow")
+        return std::make_unique<arrow_writer>(opts.output, seed, params, opts.batch_size, opts.io);
+    if (opts.format == "packed")
+        return std::make_unique<packed_writer>(opts.output, blocksize, records, seed, params, opts.compress,
+                                               opts.compress_level, opts.compress_threads, opts.io);
+    return make_writer(opts.format, opts.output, records, seed, params, opts.io, threads);
+}
+
+// "name=value ..." for every generator parameter that was given or
+// defaulted (config::is_parameter); stored in the header of binary traces so
+// a trace records how it was generated. Output and run options are left out.
+inline str params_string(const boost::program_options::variables_map &vm) {
+    str s;
+    for (auto &[name, v] : vm) {
+        if (!tracegen::config::is_parameter(name))
+            continue;
+        auto &val = v.value();
+        str text;
+        if (auto p = boost::any_cast<str>(&val))
+            text = *p;
+        else if (auto p = boost::any_cast<i64>(&val))
+            text = fmt::format("{}", *p);
+        else if (auto p = boost::any_cast<f64>(&val))
+            text = fmt::format("{}", *p);
+        else if (auto p = boost::any_cast<int>(&val))
+            text = fmt::format("{}", *p);
+        else if (auto p = boost::any_cast<bool>(&val))
+            text = *p ? "true" : "false";
+        else
+            continue;
+        s += fmt::format("{}{}={}", s.empty() ? "" : " ", name, text);
+    }
+    return s;
+}
+
+#endif // CLI_H
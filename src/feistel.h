@@ -0,0 +1,91 @@
+#ifndef FEISTEL_H
+#define FEISTEL_H
+
+#include <algorithm>
+#include <bit>
+#include "utils.h"
+
+/**
+ * Keyed pseudo-random permutation of [0, n) in O(1) memory: a balanced
+ * four-round Feistel network over the smallest even number of bits covering
+ * n, with cycle walking to stay inside the domain (fewer than four rounds of
+ * walking on average, as the network's domain is below 4n). inverse() runs
+ * the rounds backwards, walking the same cycles the other way.
+ */
+class feistel_permutation {
+    u64 n = 1;
+    int half = 1;
+    u64 mask = 1;
+    u64 keys[4] = {};
+
+    static u64 mix(u64 z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    u64 network(u64 x) const {
+        u64 l = x >> half, r = x & mask;
+        for (auto k : keys) {
+            auto f = mix(r ^ k) & mask;
+            auto t = r;
+            r = l ^ f;
+            l = t;
+        }
+        return (l << half) | r;
+    }
+
+    u64 inverse_network(u64 x) const {
+        u64 l = x >> half, r = x & mask;
+        for (int i = 3; i >= 0; i--) {
+            auto t = l;
+            l = r ^ (mix(l ^ keys[i]) & mask);
+            r = t;
+        }
+        return (l << half) | r;
+    }
+
+public:
+    feistel_permutation() = default;
+
+    feistel_permutation(u64 n, u64 key) : n(n) {
+        auto bits = std::max(2, (int)std::bit_width(n > 1 ? n - 1 : 1));
+        half = (bits + 1) / 2;
+        mask = (1ULL << half) - 1;
+        for (int i = 0; i < 4; i++)
+            keys[i] = mix(key + (u64)(i + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    u64 size() const { return n; }
+
+    u64 operator()(u64 x) const {
+        do
+            x = network(x);
+        while (x >= n);
+        return x;
+    }
+
+    // y such that (*this)(y) == x.
+    u64 inverse(u64 x) const {
+        do
+            x = inverse_network(x);
+        while (x >= n);
+        return x;
+    }
+};
+
+/**
+ * Hash sample of exactly take of the addresses [first, first + count): those
+ * the permutation keyed by key maps below take, found by inverting it, in
+ * increasing order. O(take log take), whatever count is.
+ */
+inline vec<i64> sample_range(i64 first, i64 count, i64 take, u64 key) {
+    feistel_permutation perm(count, key);
+    vec<i64> out(take);
+    for (i64 y = 0; y < take; y++)
+        out[y] = first + (i64)perm.inverse(y);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+#endif // FEISTEL_H
@@ -0,0 +1,151 @@
+#ifndef GEN_ADDRESSES_H
+#define GEN_ADDRESSES_H
+
+#include <cassert>
+#include <numeric>
+#include <random>
+#include <span>
+
+#include "scheduler.h"
+#include "stats.h"
+#include "tracegen-utils.h"
+#include "utils.h"
+
+/**
+We take in the following arguments:
+
+- addrs: footprint size (number of unique addresses)
+- length: length of trace (in addresses)
+- p_irm: probability of the trace that is IRM (float between 0 and 1)
+- d_ird: sampler used to generate IRDs
+- d_irm: sampler used to generate IRMs (one of the irm_dist alternatives)
+- rng: random number generator
+
+Sched is the scheduler engine ordering IRD accesses (see scheduler.h) and Rng
+the random engine (see rng.h). The class is instantiated per (scheduler, IRM
+sampler, engine), so sampling is inlined into the loop. The trace is produced
+incrementally: each call to fill() writes the next out.size() addresses
+(fewer at the end of the trace).
+
+Mix is drawn except for the --fast-paths loops (see irm_mix): with never, Irm
+may be std::monostate and no trials are drawn; with always, Sched is unused
+and no schedule is built.
+ */
+template <typename Sched, typename Irm, typename Rng,
+          irm_mix Mix = irm_mix::drawn>
+class gen_addresses
+{
+    i64 addrs, remaining;
+    bernoulli_sampler is_irm;
+    ird_sampler d_ird;
+    Irm d_irm;
+    Rng &rng;
+    Sched irds;
+
+    void fill_mixed(std::span<i64> out)
+    {
+        size_t irm_count = 0;
+        for (size_t i = 0; i < out.size(); i++) {
+            // if it is IRM, draw from the IRM dist and continue; the decision
+            // shares the engine with the IRD and IRM draws, so it cannot be
+            // drawn for the whole chunk up front
+            if (is_irm(rng)) {
+                auto addr = d_irm(rng);
+                assert(addr < addrs);
+                out[i] = addr;
+                irm_count++;
+                continue;
+            }
+
+            // otherwise, draw from the IRD dist
+            auto ird_sample = d_ird(rng);
+            assert(ird_sample >= 0 && ird_sample < (i64)d_ird.dis.size());
+
+            auto min_ird = irds.pop();
+            out[i] = min_ird.addr;
+            irds.push({.ird = min_ird.ird + ird_sample, .addr = min_ird.addr});
+        }
+        stats::add(stats::irm_accesses, irm_count);
+        stats::add(stats::ird_accesses, out.size() - irm_count);
+        stats::add(stats::sched_pops, out.size() - irm_count);
+    }
+
+    // -p 0: the IRD draws do not depend on the schedule, so the chunk's are
+    // drawn first, into out, and replaced by the addresses they schedule.
+    void fill_ird(std::span<i64> out)
+    {
+        d_ird.sample_n(rng, out);
+        for (auto &x : out) {
+            auto min_ird = irds.pop();
+            irds.push({.ird = min_ird.ird + x, .addr = min_ird.addr});
+            x = min_ird.addr;
+        }
+        stats::add(stats::ird_accesses, out.size());
+        stats::add(stats::sched_pops, out.size());
+    }
+
+    // -p 1: the IRM draws alone.
+    void fill_irm(std::span<i64> out)
+    {
+        sample_n(d_irm, rng, out);
+        stats::add(stats::irm_accesses, out.size());
+    }
+
+  public:
+    gen_addresses(i64 addrs, i64 length, f64 p_irm, ird_sampler d_ird,
+                  Irm d_irm, Rng &rng)
+        : addrs(addrs), remaining(length), is_irm(p_irm),
+          d_ird(std::move(d_ird)), d_irm(std::move(d_irm)), rng(rng)
+    {
+        stats::timer init_timer(stats::init);
+        if constexpr (Mix == irm_mix::always) {
+            // no schedule
+        } else if constexpr (is_lazy_scheduler<Sched>) {
+            // every address starts at a time in [0, k) drawn from the ird dist
+            auto probs = this->d_ird.dis.probabilities();
+            vec<i64> times(probs.size());
+            std::iota(times.begin(), times.end(), 0);
+            irds.init_lazy({{0, addrs, std::move(times), std::move(probs)}},
+                           rng);
+        } else {
+            // for each address, associate with it an ird drawn from the ird
+            // dist
+            irds.init(addrs, [&](i64 a) {
+                return tadr{.ird = this->d_ird(rng), .addr = a};
+            });
+        }
+        stats::max(stats::max_sched_size, irds.size());
+    }
+
+    size_t fill(std::span<i64> out)
+    {
+        auto n = (size_t)std::min<i64>(out.size(), remaining);
+        if constexpr (Mix == irm_mix::always)
+            fill_irm(out.first(n));
+        else if constexpr (Mix == irm_mix::never)
+            fill_ird(out.first(n));
+        else
+            fill_mixed(out.first(n));
+        remaining -= n;
+        return n;
+    }
+
+    // The engine belongs to the caller and is saved with it.
+    void save(state_writer &w) const
+    {
+        save_state(w, d_irm);
+        if constexpr (Mix != irm_mix::always)
+            irds.save(w);
+    }
+
+    // Restores the state saved after `done` records of this trace.
+    void load(state_reader &r, i64 done)
+    {
+        load_state(r, d_irm);
+        if constexpr (Mix != irm_mix::always)
+            irds.load(r);
+        remaining -= done;
+    }
+};
+
+#endif // GEN_ADDRESSES_H
@@ -0,0 +1,71 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include "utils.h"
+
+/**
+ * Histogram of non-negative integers in log-linear buckets: values below
+ * 2^sub_bits are exact, and each power-of-two range above is split into
+ * 2^sub_bits buckets, so a bucket's bounds are within 1/2^sub_bits of each
+ * other at any scale and the whole u64 range takes 1920 buckets. Used for
+ * replay latencies (replay.h) and reuse times (trace-fit).
+ */
+class log_histogram {
+    static constexpr int sub_bits = 5;
+    static constexpr u64 sub = 1 << sub_bits;
+
+    vec<u64> counts = vec<u64>((64 - sub_bits + 1) * sub, 0);
+    u64 n = 0, max_value = 0;
+    f64 sum = 0;
+
+    static size_t bucket(u64 x) {
+        if (x < sub)
+            return x;
+        int shift = std::bit_width(x) - 1 - sub_bits;
+        return (shift + 1) * sub + ((x >> shift) - sub);
+    }
+
+    static u64 lower(size_t b) { return b < sub ? b : (sub + b % sub) << (b / sub - 1); }
+
+public:
+    void add(u64 x, u64 times = 1) {
+        counts[bucket(x)] += times;
+        n += times;
+        sum += (f64)x * times;
+        max_value = std::max(max_value, x);
+    }
+
+    void merge(const log_histogram &other) {
+        for (size_t b = 0; b < counts.size(); b++)
+            counts[b] += other.counts[b];
+        n += other.n;
+        sum += other.sum;
+        max_value = std::max(max_value, other.max_value);
+    }
+
+    u64 count() const { return n; }
+    f64 mean() const { return n ? sum / n : 0; }
+    u64 max() const { return max_value; }
+
+    // Upper bound of the bucket holding the q-quantile.
+    u64 percentile(f64 q) const {
+        u64 rank = std::max<u64>(1, (u64)std::ceil(q * n)), seen = 0;
+        for (size_t b = 0; b < counts.size(); b++)
+            if ((seen += counts[b]) >= rank)
+                return std::min(max_value, lower(b + 1) - 1);
+        return max_value;
+    }
+
+    // f(lower bound, upper bound (exclusive), count) for every non-empty bucket, in order.
+    template <typename F>
+    void each(F &&f) const {
+        for (size_t b = 0; b < counts.size(); b++)
+            if (counts[b])
+                f(lower(b), b + 1 < counts.size() ? lower(b + 1) : max_value + 1, counts[b]);
+    }
+};
+
+#endif // HISTOGRAM_H
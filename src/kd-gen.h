@@ -0,0 +1,253 @@
+#ifndef KD_GEN_H
+#define KD_GEN_H
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <span>
+#include "rng.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "thread-pool.h"
+#include "tracegen-utils.h"
+#include "utils.h"
+
+// A group's raw IRD scaled by the group's popularity.
+inline i64 scale_ird(int raw_ird, double pop) {
+    double scaled = (pop == 0.0 ? raw_ird : (double)raw_ird / pop);
+    i64 scaled_ird = (i64)std::llround(scaled);
+    return scaled_ird < 0 ? 0 : scaled_ird;
+}
+
+// scale_ird() of every raw IRD of a group, so an access costs a lookup
+// instead of a division and a rounding.
+inline vec<i64> scaled_steps(const ird_sampler &ird, double pop) {
+    vec<i64> steps(ird.dis.size());
+    for (size_t raw = 0; raw < steps.size(); raw++)
+        steps[raw] = scale_ird(raw, pop);
+    return steps;
+}
+
+// Initial-schedule segment of a group for lazy_scheduler: the group's raw
+// IRD support mapped through its scaling.
+inline lazy_segment scaled_segment(const ird_sampler &ird, const vec<i64> &steps, i64 first, i64 count) {
+    return {first, count, steps, ird.dis.probabilities()};
+}
+
+/**
+ * kd_gen:
+ *   - addrs: number of unique addresses.
+ *   - length: number of trace entries.
+ *   - irds: vector of IRD functions (one per group), parsed via parse_ird().
+ *   - pop: vector of popularity weights (one per group).
+ *   - rng: random number generator (Rng, see rng.h).
+ *
+ * Each address is assigned to a group by equal partitioning. For each address, we sample an initial IRD
+ * from the group's IRD function, scale it by dividing by the popularity weight (rounding to an integer),
+ * and schedule it in a min‑heap. Then, for each access, we pop the item with the smallest IRD, record its address,
+ * sample a new IRD from the same group, add it (scaled) to the current IRD, and push it back.
+ * The trace is produced incrementally through fill(), one chunk at a time. Sched is the scheduler
+ * engine holding the min-heap (or bucket queue), see scheduler.h.
+ */
+template <typename Sched, typename Rng>
+class kd_gen {
+    i64 remaining;
+    vec<ird_sampler> irds;
+    vec<vec<i64>> steps; // scaled IRD per group and raw IRD
+    Rng &rng;
+    int groups;
+    i64 group_size;
+    Sched heap;
+
+    i64 scaled_ird(int group) { return steps[group][irds[group](rng)]; }
+
+    // Groups are not stored in the schedule; they follow from the address.
+    int group_of(i64 addr) const {
+        int group = addr / group_size;
+        return group >= groups ? groups - 1 : group;
+    }
+
+public:
+    kd_gen(i64 addrs, i64 length, const vec<ird_sampler> &irds, const vec<double> &pop, Rng &rng)
+        : remaining(length), irds(irds), rng(rng), groups(irds.size()), group_size(addrs / groups) {
+        stats::timer init_timer(stats::init);
+        for (int g = 0; g < groups; g++)
+            steps.push_back(scaled_steps(irds[g], pop[g]));
+        if constexpr (is_lazy_scheduler<Sched>) {
+            vec<lazy_segment> segments;
+            for (int g = 0; g < groups; g++) {
+                auto first = g * group_size;
+                auto count = g == groups - 1 ? addrs - first : group_size;
+                segments.push_back(scaled_segment(this->irds[g], steps[g], first, count));
+            }
+            heap.init_lazy(segments, rng);
+        } else {
+            heap.init(addrs, [&](i64 a) { return tadr{scaled_ird(group_of(a)), a}; });
+        }
+        stats::max(stats::max_sched_size, heap.size());
+    }
+
+    size_t fill(std::span<i64> out) {
+        auto n = (size_t)std::min<i64>(out.size(), remaining);
+        for (size_t i = 0; i < n; i++) {
+            auto entry = heap.pop();
+            out[i] = entry.addr;
+            entry.ird += scaled_ird(group_of(entry.addr));
+            heap.push(entry);
+        }
+        stats::add(stats::ird_accesses, n);
+        stats::add(stats::sched_pops, n);
+        remaining -= n;
+        return n;
+    }
+
+    // The engine belongs to the caller and is saved with it.
+    void save(state_writer &w) const { heap.save(w); }
+
+    // Restores the state saved after `done` records of this trace.
+    void load(state_reader &r, i64 done) {
+        heap.load(r);
+        remaining -= done;
+    }
+};
+
+/**
+ * kd_gen with one scheduler per group (--group-schedulers). Group g owns its
+ * addresses' schedule and its own random stream (stream_group + g), and
+ * produces its accesses in blocks: pop, draw the group's IRD, push. A
+ * tournament tree over the groups' next due times merges the blocks, ties
+ * going to the lower group, so an access costs O(log groups) in the merge
+ * plus a pop from a small per-group schedule, and scaling is a lookup in
+ * the group's precomputed table.
+ *
+ * Since no group's draws depend on another's, the trace is determined by the
+ * seed alone; with threads > 1, the groups compute their next blocks on a
+ * pool of that many workers while the current ones are merged, one block in
+ * flight per group. The streams differ from kd_gen's single engine, so
+ * traces are statistically equivalent to kd_gen's, not identical.
+ */
+template <typename Sched, typename Rng>
+class kd_group_gen {
+    static constexpr size_t block_size = 1 << 12;
+
+    struct group {
+        Sched sched;
+        Rng rng;
+        ird_sampler ird;
+        vec<i64> steps;
+        vec<tadr> block, next;
+        size_t pos = 0;
+        std::atomic<bool> ready{false}; // next is computed (parallel only)
+
+        void advance() {
+            next.resize(block_size);
+            for (auto &e : next) {
+                e = sched.pop();
+                sched.push({e.ird + steps[ird(rng)], e.addr});
+            }
+        }
+    };
+
+    i64 remaining;
+    vec<std::unique_ptr<group>> groups;
+    tournament_tree merge;
+    std::unique_ptr<work_stealing_pool> pool; // destroyed first, finishing the blocks in flight
+
+    static constexpr i64 idle = std::numeric_limits<i64>::max(); // group without addresses
+
+    void compute_next(group &g) {
+        pool->submit([&g] {
+            g.advance();
+            g.ready.store(true, std::memory_order_release);
+            g.ready.notify_one();
+        });
+    }
+
+    void refill(group &g) {
+        if (pool) {
+            g.ready.wait(false, std::memory_order_acquire);
+            g.ready.store(false, std::memory_order_relaxed);
+            std::swap(g.block, g.next);
+            compute_next(g);
+        } else {
+            g.advance();
+            std::swap(g.block, g.next);
+        }
+        g.pos = 0;
+        stats::add(stats::sched_pops, block_size);
+    }
+
+public:
+    kd_group_gen(i64 addrs, i64 length, const vec<ird_sampler> &irds, const vec<double> &pop, i64 seed,
+                 int threads)
+        : remaining(length) {
+        stats::timer init_timer(stats::init);
+        i64 k = irds.size(), group_size = addrs / k;
+        if (threads > 1)
+            pool = std::make_unique<work_stealing_pool>(std::min<i64>(threads, k));
+        vec<i64> due;
+        for (i64 gi = 0; gi < k; gi++) {
+            auto &g = *groups.emplace_back(std::make_unique<group>());
+            g.rng = Rng::stream(seed, stream_group + gi);
+            g.ird = irds[gi];
+            g.steps = scaled_steps(irds[gi], pop[gi]);
+            auto first = gi * group_size;
+            auto count = gi == k - 1 ? addrs - first : group_size;
+            if constexpr (is_lazy_scheduler<Sched>)
+                g.sched.init_lazy({scaled_segment(g.ird, g.steps, first, count)}, g.rng);
+            else
+                g.sched.init(count, [&](i64 a) { return tadr{g.steps[g.ird(g.rng)], first + a}; });
+            stats::max(stats::max_sched_size, g.sched.size());
+            if (count == 0) {
+                due.push_back(idle);
+                continue;
+            }
+            if (pool)
+                compute_next(g);
+            refill(g);
+            due.push_back(g.block[0].ird);
+        }
+        merge = tournament_tree(due);
+    }
+
+    size_t fill(std::span<i64> out) {
+        auto n = (size_t)std::min<i64>(out.size(), remaining);
+        for (size_t i = 0; i < n; i++) {
+            auto gi = merge.min();
+            auto &g = *groups[gi];
+            out[i] = g.block[g.pos++].addr;
+            if (g.pos == g.block.size())
+                refill(g);
+            merge.update(gi, g.block[g.pos].ird);
+        }
+        stats::add(stats::ird_accesses, n);
+        remaining -= n;
+        return n;
+    }
+
+    // Checkpoints need --threads 1, where nothing runs in the background.
+    void save(state_writer &w) const {
+        for (auto &g : groups) {
+            g->sched.save(w);
+            g->rng.save(w);
+            w.put(g->block);
+            w.put(g->pos);
+        }
+    }
+
+    void load(state_reader &r, i64 done) {
+        vec<i64> due;
+        for (auto &g : groups) {
+            g->sched.load(r);
+            g->rng.load(r);
+            r.get(g->block);
+            r.get(g->pos);
+            due.push_back(g->block.empty() ? idle : g->block[g->pos].ird);
+        }
+        merge = tournament_tree(due);
+        remaining -= done;
+    }
+};
+
+#endif // KD_GEN_H
@@ -4,87 +4,23 @@
 #include <fmt/printf.h>
 #include <iostream>
 #include <random>
-#include "tracegen-utils.h"
+#include <span>
+#include "cli.h"
+#include "libtracegen.h"
+#include "stats.h"
+#include "trace-stream.h"
 
 namespace po = boost::program_options;
 
-struct group_tadr {
-    i64 ird;   
-    i64 addr;   
-    int group;  // group index
-};
-
-bool group_tadr_cmp(const group_tadr &a, const group_tadr &b) {
-    return a.ird > b.ird;
-}
-
-group_tadr heappop(vec<group_tadr> &heap) {
-    std::pop_heap(heap.begin(), heap.end(), group_tadr_cmp);
-    group_tadr min = heap.back();
-    heap.pop_back();
-    return min;
-}
-
-void heappush(vec<group_tadr> &heap, i64 ird, i64 addr, int group) {
-    heap.push_back({ird, addr, group});
-    std::push_heap(heap.begin(), heap.end(), group_tadr_cmp);
-}
-
-/**
- * kd_gen:
- *   - addrs: number of unique addresses.
- *   - length: number of trace entries.
- *   - irds: vector of IRD functions (one per group), parsed via parse_ird().
- *   - pop: vector of popularity weights (one per group).
- *   - rng: random number generator.
- *
- * Each address is assigned to a group by equal partitioning. For each address, we sample an initial IRD
- * from the group's IRD function, scale it by dividing by the popularity weight (rounding to an integer),
- * and schedule it in a min‑heap. Then, for each access, we pop the item with the smallest IRD, record its address,
- * sample a new IRD from the same group, add it (scaled) to the current IRD, and push it back.
- */
-vec<i64> kd_gen(i64 addrs, i64 length, const vec<dist> &irds, const vec<double> &pop, std::mt19937_64 &rng)
-{
-    int groups = irds.size();
-    i64 group_size = addrs / groups;
-    vec<group_tadr> heap;
-    heap.reserve(addrs);
-
-    for (i64 a = 0; a < addrs; a++) {
-        int group = a / group_size;
-        if (group >= groups)
-            group = groups - 1;
-        int raw_ird = irds[group](rng);
-        double scaled = (pop[group] == 0.0 ? raw_ird : (double)raw_ird / pop[group]);
-        i64 init_ird = (i64)std::llround(scaled);
-        if (init_ird < 0)
-            init_ird = 0;
-        heap.push_back({init_ird, a, group});
-    }
-    std::make_heap(heap.begin(), heap.end(), group_tadr_cmp);
-
-    vec<i64> trace;
-    trace.reserve(length);
-    for (i64 i = 0; i < length; i++) {
-        auto entry = heappop(heap);
-        trace.push_back(entry.addr);
-
-        int raw_ird = irds[entry.group](rng);
-        double scaled = (pop[entry.group] == 0.0 ? raw_ird : (double)raw_ird / pop[entry.group]);
-        i64 add_ird = (i64)std::llround(scaled);
-        if (add_ird < 0)
-            add_ird = 0;
-        entry.ird += add_ird;
-        heappush(heap, entry.ird, entry.addr, entry.group);
-    }
-    return trace;
-}
-
 int main(int argc, char **argv) {
+    stats::timer parse_timer(stats::parse);
     i64 length, num_addrs, seed, blocksize;
     f64 frac_read;
     str ird_arg, irm_arg, sizedist_arg;
+    output_options out_opts;
+    engine_options engine_opts;
     int groups;
+    bool group_schedulers;
 
     po::options_description desc("Allowed options");
     desc.add_options()
@@ -102,7 +38,12 @@ int main(int argc, char **argv) {
          "Either a canonical spec (e.g. \"zipf:1.2,2\") or a comma-separated list (e.g. \"2,8\").")
         ("rwratio,r", po::value<f64>(&frac_read)->default_value(1), "Fraction of addresses that are reads")
         ("sizedist,z", po::value<str>(&sizedist_arg)->default_value("1:1"), "Request size distribution")
+        ("group-schedulers", po::bool_switch(&group_schedulers),
+         "One scheduler and random stream per group, merged by due time; --threads N computes "
+         "the groups' next accesses in parallel (same trace for every N, but not the default trace)")
     ;
+    add_output_options(desc, out_opts);
+    add_engine_options(desc, engine_opts);
 
     po::variables_map vm;
     try {
@@ -117,36 +58,36 @@ int main(int argc, char **argv) {
         return 1;
     }
     po::notify(vm);
+    parse_timer.stop();
+    ensure_fatal(groups > 0, "Number of groups must be positive: {}", groups);
 
     fmt::print("Generating trace:\n  addresses={} length={} groups={} seed={}\n",
                num_addrs, length, groups, seed);
 
-    std::mt19937_64 rng(seed);
-    vec<str> ird_parts = split(ird_arg, ";");
-    ensure_fatal(ird_parts.size() == (size_t)groups, "Expected {} IRD specs, got {}", groups, ird_parts.size());
-    vec<dist> irds;
-    for (auto &spec : ird_parts) {
-        irds.push_back(parse_ird(spec));
-    }
-    // use pop = True for kd-gen
-    dist irm_dist = parse_irm(irm_arg, num_addrs, true);
-    vec<double> pop;
-    for (int i = 0; i < groups; i++) {
-        i64 sample = irm_dist(rng);
-        pop.push_back((double)sample / 10000.0);
-    }
-    auto sizedist = parse_request_sizes(sizedist_arg);
-    auto addrs = kd_gen(num_addrs, length, irds, pop, rng);
-
-    std::uniform_real_distribution<> d_is_read(0, 1);
-    for (auto addr : addrs) {
-        bool is_read = (d_is_read(rng) < frac_read);
-        i64 size_in_blocks = sizedist(rng);
-        fmt::print("{:d} {} {}\n",
-                   is_read ? 0 : 1,
-                   size_in_blocks * blocksize,
-                   addr * blocksize);
-    }
-
+    tracegen::generator gen({.addresses = num_addrs,
+                             .length = length,
+                             .seed = seed,
+                             .blocksize = blocksize,
+                             .ird = ird_arg,
+                             .irm = irm_arg,
+                             .groups = groups,
+                             .rwratio = frac_read,
+                             .sizedist = sizedist_arg,
+                             .scheduler = engine_opts.scheduler,
+                             .threads = engine_opts.threads,
+                             .rng = engine_opts.rng,
+                             .hugepages = engine_opts.hugepages,
+                             .lazy_init = engine_opts.lazy_init,
+                             .group_schedulers = group_schedulers,
+                             .sample_rate = engine_opts.sample_rate,
+                             .stack_depths = engine_opts.stack_depths,
+                             .fast_paths = engine_opts.fast_paths},
+                            engine_opts.resume);
+
+    auto writer = open_writer(out_opts, gen.length() - gen.position(), seed, blocksize, params_string(vm),
+                              engine_opts.threads, engine_opts.sample_rate);
+    tracegen::write_trace(gen, *writer, {engine_opts.checkpoint, engine_opts.checkpoint_every});
+
+    stats::report(out_opts.stats);
     return 0;
 }
@@ -0,0 +1,796 @@
+#include "libtracegen.h"
+
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <variant>
+#include "async-output.h"
+#include "checkpoint.h"
+#include "feistel.h"
+#include "gen-addresses.h"
+#include "kd-gen.h"
+#include "rng.h"
+#include "scheduler.h"
+#include "sharded.h"
+#include "stack-gen.h"
+#include "stats.h"
+#include "trace-stream.h"
+#include "tracegen-c.h"
+#include "tracegen-utils.h"
+
+namespace tracegen {
+
+struct generator::source {
+    virtual ~source() = default;
+    virtual size_t fill(std::span<trace_record> out) = 0;
+    virtual void save(state_writer &w) const = 0;
+    virtual void load(state_reader &r, i64 done) = 0;
+    // Records in the whole trace: config::length, or fewer with sample_rate < 1.
+    virtual i64 length() const = 0;
+};
+
+struct table_cache::tables {
+    std::mutex lock;
+    std::map<str, ird_sampler> irds;
+    std::map<str, irm_dist> irms;
+    std::map<str, size_sampler> sizes;
+};
+
+table_cache::table_cache() : impl(std::make_unique<tables>()) {}
+table_cache::~table_cache() = default;
+
+namespace {
+
+using source_ptr = std::unique_ptr<generator::source>;
+
+// Addresses of a --sample-rate generator, in increasing order; it generates
+// their indices.
+using sample_ptr = std::shared_ptr<const vec<i64>>;
+
+// Key of the sampling permutation, fixed so that a footprint's sample is the
+// same for every seed.
+constexpr u64 sample_key = 0x853c49e6748fea9bULL;
+
+// One instantiation of (engine, scheduler, samplers): the address generator
+// and its post-processor, type-erased behind generator::source. The main
+// stream is a member so single-threaded generators can hold a reference to
+// it; make_gen builds the generator in place from that reference. With a
+// sample the generator's addresses are indices into it.
+template <typename Rng, typename Gen>
+class pipeline : public generator::source {
+    Rng rng;
+    post_processor<Rng> post;
+    Gen gen;
+    sample_ptr sample;
+    i64 records;
+    vec<i64> addrs;
+
+public:
+    template <typename F>
+    pipeline(const config &c, post_processor<Rng> post, F make_gen, sample_ptr sample)
+        : rng(Rng::stream(c.seed, stream_main)), post(std::move(post)), gen(make_gen(rng)),
+          sample(std::move(sample)), records(c.length) {}
+
+    size_t fill(std::span<trace_record> out) override {
+        if (addrs.size() < out.size())
+            addrs.resize(out.size());
+        stats::timer gen_timer(stats::generate);
+        auto n = gen.fill(std::span(addrs).first(out.size()));
+        if (sample)
+            for (auto &a : std::span(addrs).first(n))
+                a = (*sample)[a];
+        gen_timer.stop();
+        stats::timer post_timer(stats::post_process);
+        post.apply(std::span(addrs).first(n), out.first(n));
+        post_timer.stop();
+        stats::add(stats::records, n);
+        return n;
+    }
+
+    // Sharded generators have no save(); generator rejects them up front.
+    void save(state_writer &w) const override {
+        if constexpr (requires { gen.save(w); }) {
+            rng.save(w);
+            post.save(w);
+            gen.save(w);
+        } else {
+            log_fatal("Checkpoints need --threads 1");
+        }
+    }
+
+    void load(state_reader &r, i64 done) override {
+        if constexpr (requires { gen.load(r, done); }) {
+            rng.load(r);
+            post.load(r);
+            gen.load(r, done);
+        } else {
+            log_fatal("Checkpoints need --threads 1");
+        }
+    }
+
+    i64 length() const override { return records; }
+};
+
+template <typename Rng, typename Gen, typename F>
+source_ptr make_pipeline(const config &c, post_processor<Rng> post, F make_gen, const sample_ptr &sample) {
+    return std::make_unique<pipeline<Rng, Gen>>(c, std::move(post), make_gen, sample);
+}
+
+// A copy of the table built for key, building it under the cache lock on
+// first use; without a cache every generator builds its own.
+template <typename T, typename F>
+T cached(table_cache *cache, std::map<str, T> table_cache::tables::*map, const str &key, F build) {
+    if (!cache)
+        return build();
+    auto &t = cache->get();
+    std::lock_guard guard(t.lock);
+    auto &m = t.*map;
+    auto it = m.find(key);
+    if (it == m.end())
+        it = m.emplace(key, build()).first;
+    return it->second;
+}
+
+ird_sampler cached_ird(table_cache *cache, const str &spec) {
+    return cached(cache, &table_cache::tables::irds, spec, [&] { return parse_ird(spec); });
+}
+
+irm_dist cached_irm(table_cache *cache, const str &spec, i64 max, bool pop_mode = false) {
+    return cached(cache, &table_cache::tables::irms, fmt::format("{} {} {}", spec, max, pop_mode),
+                  [&] { return parse_irm(spec, max, pop_mode); });
+}
+
+size_sampler cached_sizes(table_cache *cache, const str &spec) {
+    return cached(cache, &table_cache::tables::sizes, spec, [&] { return parse_request_sizes(spec); });
+}
+
+/**
+ * sample_rate < 1 for the IRD/IRM mix. IRD addresses are scheduled
+ * independently of each other, so a hash sample S of R·M addresses
+ * (sample_range) sees the same IRD accesses on its own as in the full trace,
+ * and c becomes the config of that smaller generator: |S| addresses, whose
+ * indices pipeline maps back to S. An IRM draw of the full trace lands in S
+ * with probability Q, the IRM mass of S, and is then distributed as the
+ * mass restricted to S, which irm becomes. A fraction pQ + (1 - p)|S|/M of
+ * the full trace's records are S's, which sets the length and the share of
+ * them that are IRM draws.
+ */
+sample_ptr sample_irm(config &c, irm_dist &irm) {
+    auto take = (i64)std::llround(c.sample_rate * c.addresses);
+    ensure_fatal(take > 0, "--sample-rate {} keeps none of the {} addresses", c.sample_rate, c.addresses);
+    auto sample = std::make_shared<const vec<i64>>(sample_range(0, c.addresses, take, sample_key));
+    auto mass = std::visit(
+        [&](auto &d) -> vec<f64> {
+            if constexpr (requires { d.masses(std::span<const i64>(*sample)); })
+                return d.masses(*sample);
+            log_fatal("--sample-rate needs an IRM distribution over addresses");
+        },
+        irm);
+    f64 q = 0;
+    for (auto x : mass)
+        q += x;
+    auto irm_share = c.p_irm * q, ird_share = (1 - c.p_irm) * take / c.addresses;
+    auto share = irm_share + ird_share;
+    fmt::print("Sampled: {} of {} addresses (rate {}), IRM mass {:.6g}\n", take, c.addresses, c.sample_rate, q);
+    c.addresses = take;
+    c.length = std::llround(c.length * share);
+    c.p_irm = share > 0 ? irm_share / share : 0;
+    if (q == 0)
+        mass.assign(mass.size(), 1); // never drawn, p_irm is 0
+    irm = subset_sampler{alias_table(mass.begin(), mass.end())};
+    return sample;
+}
+
+// --fast-paths: -p 0 or 1 decides every access without a trial.
+bool constant_mix(const config &c) {
+    return c.fast_paths && c.threads <= 1 && (c.p_irm <= 0 || c.p_irm >= 1);
+}
+
+// -p 1 under --fast-paths: the IRM draws alone, without a schedule (the IRD, scheduler and stack
+// options have no effect).
+template <typename Rng>
+source_ptr make_irm_only(const config &c, const post_processor<Rng> &post, const ird_sampler &ird,
+                         irm_dist &irm, const sample_ptr &sample) {
+    return std::visit(
+        [&](auto &d_irm) {
+            using Gen = gen_addresses<heap_scheduler<tadr>, std::decay_t<decltype(d_irm)>, Rng, irm_mix::always>;
+            return make_pipeline<Rng, Gen>(c, post, [&](Rng &rng) {
+                return Gen(c.addresses, c.length, c.p_irm, ird, d_irm, rng);
+            }, sample);
+        },
+        irm);
+}
+
+// trace-gen and 2d-tracegen: IRD accesses mixed with IRM draws.
+source_ptr make_irm_source(const config &cfg, table_cache *cache) {
+    stats::timer parse_timer(stats::parse);
+    auto c = cfg;
+    auto ird = cached_ird(cache, c.ird);
+    auto irm = cached_irm(cache, c.irm, c.addresses);
+    auto sizedist = cached_sizes(cache, c.sizedist);
+    sample_ptr sample;
+    if (c.sample_rate < 1)
+        sample = sample_irm(c, irm);
+    parse_timer.stop();
+
+    return with_rng(c.rng, [&](auto proto) {
+        using Rng = decltype(proto);
+        post_processor<Rng> post(c.rwratio, sizedist, c.blocksize, c.seed);
+        if (constant_mix(c) && c.p_irm >= 1)
+            return make_irm_only(c, post, ird, irm, sample);
+        return with_scheduler<tadr>(c.scheduler, [&](auto sched) {
+            using Sched = decltype(sched);
+            if (constant_mix(c)) {
+                return with_lazy_init(c.lazy_init, sched, [&](auto init_sched) {
+                    using Gen = gen_addresses<decltype(init_sched), std::monostate, Rng, irm_mix::never>;
+                    return make_pipeline<Rng, Gen>(c, post, [&](Rng &rng) {
+                        return Gen(c.addresses, c.length, c.p_irm, ird, {}, rng);
+                    }, sample);
+                });
+            }
+            return std::visit(
+                [&](auto &d_irm) {
+                    using Irm = std::decay_t<decltype(d_irm)>;
+                    if (c.threads > 1) {
+                        auto incr = [ird](i64, auto &rng) mutable { return ird(rng); };
+                        using Gen = sharded_gen<Sched, decltype(incr), Irm, Rng>;
+                        return make_pipeline<Rng, Gen>(c, post, [&](Rng &) {
+                            return Gen(c.addresses, c.length, c.p_irm, d_irm, c.threads, c.seed, incr);
+                        }, sample);
+                    }
+                    return with_lazy_init(c.lazy_init, sched, [&](auto init_sched) {
+                        using Gen = gen_addresses<decltype(init_sched), Irm, Rng>;
+                        return make_pipeline<Rng, Gen>(c, post, [&](Rng &rng) {
+                            return Gen(c.addresses, c.length, c.p_irm, ird, d_irm, rng);
+                        }, sample);
+                    });
+                },
+                irm);
+        }, c.hugepages);
+    });
+}
+
+// --stack-depths: the IRD spec read as a distribution of LRU stack depths,
+// mixed with IRM draws as in make_irm_source (see stack_gen).
+source_ptr make_stack_source(const config &c, table_cache *cache) {
+    stats::timer parse_timer(stats::parse);
+    ensure_fatal(c.threads <= 1, "--stack-depths is single-threaded (got --threads {})", c.threads);
+    ensure_fatal(c.sample_rate == 1, "--stack-depths does not support --sample-rate");
+    ensure_fatal(c.addresses <= std::numeric_limits<int32_t>::max(),
+                 "--stack-depths supports footprints up to 2^31 addresses: {}", c.addresses);
+    auto depth = cached_ird(cache, c.ird);
+    ensure_fatal((i64)depth.dis.size() <= c.addresses, "Fewer addresses ({}) than stack depth classes ({})",
+                 c.addresses, depth.dis.size());
+    auto irm = cached_irm(cache, c.irm, c.addresses);
+    auto sizedist = cached_sizes(cache, c.sizedist);
+    parse_timer.stop();
+
+    return with_rng(c.rng, [&](auto proto) {
+        using Rng = decltype(proto);
+        post_processor<Rng> post(c.rwratio, sizedist, c.blocksize, c.seed);
+        if (constant_mix(c) && c.p_irm >= 1)
+            return make_irm_only(c, post, depth, irm, nullptr);
+        if (constant_mix(c)) {
+            auto make = [&](auto huge_pages) {
+                using Gen = stack_gen<std::monostate, Rng, decltype(huge_pages)::value, irm_mix::never>;
+                return make_pipeline<Rng, Gen>(c, post, [&](Rng &rng) {
+                    return Gen(c.addresses, c.length, c.p_irm, depth, {}, rng);
+                }, nullptr);
+            };
+            return c.hugepages ? make(std::true_type{}) : make(std::false_type{});
+        }
+        return std::visit(
+            [&](auto &d_irm) {
+                auto make = [&](auto huge_pages) {
+                    using Gen = stack_gen<std::decay_t<decltype(d_irm)>, Rng, decltype(huge_pages)::value>;
+                    return make_pipeline<Rng, Gen>(c, post, [&](Rng &rng) {
+                        return Gen(c.addresses, c.length, c.p_irm, depth, d_irm, rng);
+                    }, nullptr);
+                };
+                return c.hugepages ? make(std::true_type{}) : make(std::false_type{});
+            },
+            irm);
+    });
+}
+
+/**
+ * sample_rate < 1 for kd-tracegen: each group is sampled on its own, R times
+ * its size (at least one address), so the smaller generator's groups split
+ * its footprint as kd_gen expects. There is no IRM; a group's addresses are
+ * accessed at a rate inversely proportional to its mean scaled IRD, which
+ * weighs the groups in the length.
+ */
+sample_ptr sample_kd(config &c, const vec<ird_sampler> &irds, const vec<double> &pop) {
+    auto group_size = c.addresses / c.groups;
+    auto per_group = std::max<i64>(1, std::llround(c.sample_rate * group_size));
+    auto sample = std::make_shared<vec<i64>>();
+    f64 full = 0, kept = 0;
+    for (int g = 0; g < c.groups; g++) {
+        auto first = g * group_size;
+        auto count = g == c.groups - 1 ? c.addresses - first : group_size;
+        // the last group's remainder (fewer than groups addresses) is sampled too, which keeps
+        // the smaller footprint's remainder below groups
+        auto take = per_group + (g == c.groups - 1 ? std::llround(c.sample_rate * (count - group_size)) : 0);
+        auto part = sample_range(first, count, take, sample_key + g);
+        sample->insert(sample->end(), part.begin(), part.end());
+        auto probs = irds[g].dis.probabilities();
+        auto steps = scaled_steps(irds[g], pop[g]);
+        f64 mean = 0;
+        for (size_t i = 0; i < steps.size(); i++)
+            mean += probs[i] * steps[i];
+        auto rate = mean > 0 ? 1 / mean : 1;
+        full += count * rate;
+        kept += take * rate;
+    }
+    fmt::print("Sampled: {} of {} addresses (rate {})\n", sample->size(), c.addresses, c.sample_rate);
+    c.addresses = sample->size();
+    c.length = std::llround(c.length * kept / full);
+    return sample;
+}
+
+// kd-tracegen: one IRD distribution per group, scaled by group popularity.
+source_ptr make_kd_source(const config &cfg, table_cache *cache) {
+    stats::timer parse_timer(stats::parse);
+    auto c = cfg;
+    vec<str> ird_parts = split(c.ird, ";");
+    ensure_fatal(ird_parts.size() == (size_t)c.groups, "Expected {} IRD specs, got {}", c.groups,
+                 ird_parts.size());
+    vec<ird_sampler> irds;
+    for (auto &spec : ird_parts)
+        irds.push_back(cached_ird(cache, spec));
+    // use pop = True for kd-gen
+    auto irm_dist = std::get<pop_sampler>(cached_irm(cache, c.irm, c.addresses, true));
+    vec<double> pop;
+    mt64 pop_rng(c.seed); // unused by pop_sampler
+    for (int i = 0; i < c.groups; i++) {
+        i64 sample = irm_dist(pop_rng);
+        pop.push_back((double)sample / 10000.0);
+    }
+    auto sizedist = cached_sizes(cache, c.sizedist);
+    sample_ptr sample;
+    if (c.sample_rate < 1)
+        sample = sample_kd(c, irds, pop);
+    parse_timer.stop();
+
+    return with_rng(c.rng, [&](auto proto) -> source_ptr {
+        using Rng = decltype(proto);
+        post_processor<Rng> post(c.rwratio, sizedist, c.blocksize, c.seed);
+        if (c.group_schedulers) {
+            return with_scheduler<tadr>(
+                c.scheduler,
+                [&](auto sched) {
+                    return with_lazy_init(c.lazy_init, sched, [&](auto init_sched) {
+                        using Gen = kd_group_gen<decltype(init_sched), Rng>;
+                        return make_pipeline<Rng, Gen>(c, post, [&](Rng &) {
+                            return Gen(c.addresses, c.length, irds, pop, c.seed, c.threads);
+                        }, sample);
+                    });
+                },
+                c.hugepages);
+        }
+        if (c.threads > 1) {
+            // shards only see addresses, so the group is recovered from the address
+            i64 group_size = c.addresses / c.groups;
+            vec<vec<i64>> steps;
+            for (int g = 0; g < c.groups; g++)
+                steps.push_back(scaled_steps(irds[g], pop[g]));
+            auto incr = [irds, steps, group_size, groups = c.groups](i64 a, auto &rng) mutable {
+                int group = std::min<i64>(a / group_size, groups - 1);
+                return steps[group][irds[group](rng)];
+            };
+            return with_scheduler<tadr>(c.scheduler, [&](auto sched) {
+                using Gen = sharded_gen<decltype(sched), decltype(incr), no_irm, Rng>;
+                return make_pipeline<Rng, Gen>(c, post, [&](Rng &) {
+                    return Gen(c.addresses, c.length, 0, no_irm{}, c.threads, c.seed, incr);
+                }, sample);
+            }, c.hugepages);
+        }
+        return with_scheduler<tadr>(
+            c.scheduler,
+            [&](auto sched) {
+                return with_lazy_init(c.lazy_init, sched, [&](auto init_sched) {
+                    using Gen = kd_gen<decltype(init_sched), Rng>;
+                    return make_pipeline<Rng, Gen>(
+                        c, post, [&](Rng &rng) { return Gen(c.addresses, c.length, irds, pop, rng); }, sample);
+                });
+            },
+            c.hugepages);
+    });
+}
+
+template <typename T>
+T parse_number(const str &name, const str &value) {
+    T x{};
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), x);
+    ensure_fatal(ec == std::errc() && end == value.data() + value.size(), "Invalid value for {}: {}", name,
+                 value);
+    return x;
+}
+
+} // namespace
+
+// Everything that determines the generator's records except the length, so a
+// snapshot can be resumed into a longer trace of the same generator.
+str generator_key(const config &c) {
+    return fmt::format("addresses={} p_irm={} seed={} blocksize={} ird={} irm={} groups={} rwratio={} "
+                       "sizedist={} scheduler={} threads={} rng={} lazy-init={} group-schedulers={}{}{}{}",
+                       c.addresses, c.p_irm, c.seed, c.blocksize, c.ird, c.irm, c.groups, c.rwratio,
+                       c.sizedist, c.scheduler, c.threads, c.rng, c.lazy_init, c.group_schedulers,
+                       c.sample_rate < 1 ? fmt::format(" sample-rate={}", c.sample_rate) : "",
+                       c.stack_depths ? " stack-depths=true" : "", c.fast_paths ? " fast-paths=true" : "");
+}
+
+namespace {
+
+bool parse_flag(const str &value) { return value == "true" || value == "1"; }
+
+using setter = void (*)(config &, const str &name, const str &value);
+
+// The generator parameters, by name: what config::parse() reads and all that
+// params_string() (cli.h) stores in trace headers.
+const std::map<str, setter> &parameters() {
+    static const std::map<str, setter> table = {
+        {"addresses", [](config &c, const str &n, const str &v) { c.addresses = parse_number<i64>(n, v); }},
+        {"length", [](config &c, const str &n, const str &v) { c.length = parse_number<i64>(n, v); }},
+        {"p_irm", [](config &c, const str &n, const str &v) { c.p_irm = parse_number<f64>(n, v); }},
+        {"seed", [](config &c, const str &n, const str &v) { c.seed = parse_number<i64>(n, v); }},
+        {"blocksize", [](config &c, const str &n, const str &v) { c.blocksize = parse_number<i64>(n, v); }},
+        {"ird", [](config &c, const str &, const str &v) { c.ird = v; }},
+        {"irm", [](config &c, const str &, const str &v) { c.irm = v; }},
+        {"groups", [](config &c, const str &n, const str &v) { c.groups = parse_number<int>(n, v); }},
+        {"rwratio", [](config &c, const str &n, const str &v) { c.rwratio = parse_number<f64>(n, v); }},
+        {"sizedist", [](config &c, const str &, const str &v) { c.sizedist = v; }},
+        {"scheduler", [](config &c, const str &, const str &v) { c.scheduler = v; }},
+        {"threads", [](config &c, const str &n, const str &v) { c.threads = parse_number<int>(n, v); }},
+        {"rng", [](config &c, const str &, const str &v) { c.rng = v; }},
+        {"hugepages", [](config &c, const str &, const str &v) { c.hugepages = parse_flag(v); }},
+        {"lazy-init", [](config &c, const str &, const str &v) { c.lazy_init = parse_flag(v); }},
+        {"group-schedulers", [](config &c, const str &, const str &v) { c.group_schedulers = parse_flag(v); }},
+        {"sample-rate", [](config &c, const str &n, const str &v) { c.sample_rate = parse_number<f64>(n, v); }},
+        {"stack-depths", [](config &c, const str &, const str &v) { c.stack_depths = parse_flag(v); }},
+        {"fast-paths", [](config &c, const str &, const str &v) { c.fast_paths = parse_flag(v); }},
+    };
+    return table;
+}
+
+// Output and run options stored by the headers of traces written before
+// params_string() kept to the generator parameters. This list is closed:
+// options added since never reach a header.
+bool legacy_run_option(const str &name) {
+    return name == "format" || name == "output" || name == "stats" || name.starts_with("mrc-") ||
+           name.starts_with("checkpoint") || name == "resume" || name.starts_with("compress") || name == "io" ||
+           name == "iops" || name == "arrivals" || name == "queue-depth" || name == "latency" ||
+           name == "tenants" || name == "interleave" || name == "batch-size";
+}
+
+} // namespace
+
+bool config::is_parameter(const str &name) { return parameters().contains(name); }
+
+config config::parse(const str &params) {
+    config c;
+    for (auto &item : split(params, " ")) {
+        if (item.empty())
+            continue;
+        auto eq = item.find('=');
+        ensure_fatal(eq != str::npos, "Invalid parameter (expected name=value): {}", item);
+        auto name = item.substr(0, eq), value = item.substr(eq + 1);
+        if (auto it = parameters().find(name); it != parameters().end())
+            it->second(c, name, value);
+        else if (!legacy_run_option(name))
+            log_fatal("Unknown parameter: {}", name);
+    }
+    return c;
+}
+
+namespace {
+
+source_ptr make_source(const config &cfg, table_cache *cache) {
+    ensure_fatal(cfg.addresses > 0, "Number of addresses must be positive: {}", cfg.addresses);
+    ensure_fatal(cfg.length >= 0, "Invalid trace length: {}", cfg.length);
+    ensure_fatal(cfg.sample_rate > 0 && cfg.sample_rate <= 1, "Invalid sample rate: {} (expected 0 < rate <= 1)",
+                 cfg.sample_rate);
+    ensure_fatal(!cfg.lazy_init || cfg.threads <= 1, "--lazy-init is single-threaded (got --threads {})",
+                 cfg.threads);
+    if (cfg.groups > 0) {
+        ensure_fatal(!cfg.stack_depths, "--stack-depths is for the IRD/IRM mix, not kd-tracegen");
+        ensure_fatal(cfg.addresses >= cfg.groups, "Fewer addresses ({}) than groups ({})", cfg.addresses,
+                     cfg.groups);
+        return make_kd_source(cfg, cache);
+    }
+    return cfg.stack_depths ? make_stack_source(cfg, cache) : make_irm_source(cfg, cache);
+}
+
+/**
+ * Merge of independent tenant generators; see the multi-tenant generator
+ * constructor. Each tenant thread fills chunks of records, shifts their
+ * offsets into the tenant's range and stamps their arrival times, and hands
+ * them over through single-producer queues, a few chunks ahead. fill()
+ * takes the record with the earliest arrival through a tournament tree over
+ * the tenants' next records, ties going to the lower tenant, so the merge
+ * takes no locks. Arrival times are non-negative doubles, whose bit
+ * patterns order like the values, so they are the tree's i64 keys as they
+ * are.
+ */
+class tenant_source : public generator::source {
+    static constexpr size_t chunks = 4;
+    static constexpr size_t records_per_chunk = 1 << 12;
+
+    struct chunk {
+        uint32_t index;
+        uint32_t len; // 0: the tenant has stopped
+    };
+
+    struct lane {
+        source_ptr src;
+        i64 base; // bytes before the tenant's range
+        f64 rate;
+        mt64 arrival_rng;
+        u64 arrived = 0;
+        f64 time = 0;
+        vec<vec<trace_record>> records;
+        vec<vec<f64>> times;
+        spsc_queue<chunk> full{chunks + 1}, empty{chunks};
+        std::thread worker;
+        // merge side
+        chunk cur{0, 0};
+        size_t pos = 0;
+        bool done = false;
+    };
+
+    vec<std::unique_ptr<lane>> lanes;
+    bool poisson, started = false;
+    std::atomic<bool> stopping{false};
+    tournament_tree tree;
+    u64 remaining;
+    i64 total;
+
+    f64 next_time(lane &l) {
+        if (poisson)
+            return l.time += std::exponential_distribution<f64>(l.rate)(l.arrival_rng);
+        return ++l.arrived / l.rate; // not accumulated, so fixed gaps do not drift
+    }
+
+    void produce(lane &l) {
+        while (!stopping.load(std::memory_order_relaxed)) {
+            auto c = l.empty.pop();
+            if (stopping.load(std::memory_order_relaxed))
+                break;
+            auto &records = l.records[c.index];
+            auto n = l.src->fill(records);
+            if (n == 0)
+                break;
+            for (size_t i = 0; i < n; i++) {
+                records[i].offset += l.base;
+                l.times[c.index][i] = next_time(l);
+            }
+            l.full.push({c.index, (uint32_t)n});
+        }
+        l.full.push({0, 0});
+    }
+
+    // Moves l to its next record (waiting for its next chunk) and returns the record's key.
+    i64 advance(lane &l) {
+        if (l.pos == l.cur.len) {
+            if (l.cur.len > 0)
+                l.empty.push(l.cur);
+            l.cur = l.full.pop();
+            l.pos = 0;
+            if (l.cur.len == 0) {
+                l.done = true;
+                return std::numeric_limits<i64>::max();
+            }
+        }
+        return std::bit_cast<i64>(l.times[l.cur.index][l.pos]);
+    }
+
+public:
+    tenant_source(const vec<tenant> &tenants, i64 length, const str &arrivals)
+        : poisson(arrivals == "poisson"), remaining(length), total(length) {
+        ensure_fatal(!tenants.empty(), "No tenants");
+        ensure_fatal(arrivals == "poisson" || arrivals == "fixed",
+                     "Invalid tenant arrivals: {} (expected fixed or poisson)", arrivals);
+        i64 base = 0;
+        for (auto &t : tenants) {
+            ensure_fatal(t.rate > 0, "Invalid tenant rate: {}", t.rate);
+            auto cfg = t.cfg;
+            cfg.length = length; // a tenant never needs more than the whole trace
+            auto l = std::make_unique<lane>();
+            l->src = make_source(cfg, nullptr);
+            l->base = base;
+            l->rate = t.rate;
+            l->arrival_rng = mt64::stream(cfg.seed, stream_arrival);
+            for (uint32_t i = 0; i < chunks; i++) {
+                l->records.emplace_back(records_per_chunk);
+                l->times.emplace_back(records_per_chunk);
+                l->empty.push({i, 0});
+            }
+            base += cfg.addresses * cfg.blocksize;
+            lanes.push_back(std::move(l));
+        }
+        for (auto &l : lanes)
+            l->worker = std::thread([this, &l = *l] { produce(l); });
+    }
+
+    ~tenant_source() override {
+        stopping.store(true, std::memory_order_relaxed);
+        // hand every buffer back so blocked tenants see the stop
+        for (auto &l : lanes) {
+            if (!l->done) {
+                if (l->cur.len > 0)
+                    l->empty.push(l->cur);
+                for (auto c = l->full.pop(); c.len > 0; c = l->full.pop())
+                    l->empty.push(c);
+            }
+            l->worker.join();
+        }
+    }
+
+    size_t fill(std::span<trace_record> out) override {
+        if (!started) {
+            vec<i64> keys;
+            for (auto &l : lanes)
+                keys.push_back(advance(*l));
+            tree = tournament_tree(keys);
+            started = true;
+        }
+        size_t n = 0;
+        while (n < out.size() && remaining > 0) {
+            auto i = tree.min();
+            auto &l = *lanes[i];
+            if (l.done)
+                break; // every tenant has stopped
+            out[n++] = l.records[l.cur.index][l.pos++];
+            remaining--;
+            tree.update(i, advance(l));
+        }
+        return n;
+    }
+
+    void save(state_writer &) const override { log_fatal("Checkpoints are not supported with tenants"); }
+    void load(state_reader &, i64) override { log_fatal("Checkpoints are not supported with tenants"); }
+
+    i64 length() const override { return total; }
+};
+
+config combined_config(const vec<tenant> &tenants, i64 length) {
+    config c;
+    c.length = length;
+    c.blocksize = std::numeric_limits<i64>::max();
+    for (auto &t : tenants) {
+        c.addresses += t.cfg.addresses;
+        c.blocksize = std::min(c.blocksize, t.cfg.blocksize);
+    }
+    if (!tenants.empty())
+        c.seed = tenants[0].cfg.seed;
+    return c;
+}
+
+} // namespace
+
+generator::generator(const config &cfg) : cfg(cfg), impl(make_source(cfg, nullptr)) {}
+
+generator::generator(const config &cfg, table_cache &tables) : cfg(cfg), impl(make_source(cfg, &tables)) {}
+
+generator::generator(const config &cfg, const str &resume_from) : generator(cfg) {
+    if (resume_from.empty())
+        return;
+    ensure_fatal(cfg.threads <= 1, "--resume needs --threads 1");
+    stats::timer init_timer(stats::init);
+    restore(checkpoint::slurp(resume_from), resume_from);
+}
+
+void generator::restore(std::span<const uint8_t> data, const str &name) {
+    state_reader r(data);
+    auto [key, done] = checkpoint::read_header(r, name);
+    ensure_fatal(key == generator_key(cfg), "Checkpoint {} is for another generator:\n  {}\nnot\n  {}", name,
+                 key, generator_key(cfg));
+    ensure_fatal(done <= (u64)cfg.length, "Checkpoint {} is {} records in, past the trace length {}", name,
+                 done, cfg.length);
+    impl->load(r, done);
+    ensure_fatal(r.done(), "Trailing data in checkpoint {}", name);
+    produced = done;
+}
+
+generator::generator(const vec<tenant> &tenants, i64 length, const str &arrivals)
+    : cfg(combined_config(tenants, length)), impl(std::make_unique<tenant_source>(tenants, length, arrivals)) {}
+
+generator::generator(generator &&) noexcept = default;
+generator &generator::operator=(generator &&) noexcept = default;
+generator::~generator() = default;
+
+i64 generator::length() const { return impl->length(); }
+
+size_t generator::fill(std::span<trace_record> out) {
+    auto n = impl->fill(out);
+    produced += n;
+    return n;
+}
+
+void generator::save(const str &path) const {
+    ensure_fatal(cfg.threads <= 1, "--checkpoint needs --threads 1");
+    state_writer w;
+    impl->save(w);
+    checkpoint::write(path, generator_key(cfg), produced, w);
+}
+
+vec<uint8_t> generator::snapshot() const {
+    ensure_fatal(cfg.threads <= 1, "Snapshots need --threads 1");
+    state_writer w;
+    impl->save(w);
+    return checkpoint::image(generator_key(cfg), produced, w);
+}
+
+void generator::restore(std::span<const uint8_t> snapshot) {
+    ensure_fatal(cfg.threads <= 1, "Snapshots need --threads 1");
+    ensure_fatal(produced == 0, "Restoring a generator {} records in", produced);
+    restore(snapshot, "snapshot");
+}
+
+
+void write_trace(generator &gen, trace_writer &writer, const checkpoint_options &ck) {
+    ensure_fatal(ck.path.empty() || gen.params().threads <= 1, "--checkpoint needs --threads 1");
+    vec<trace_record> records(chunk_size);
+    auto every = ck.path.empty() ? 0 : (u64)std::max<i64>(ck.every, 0);
+    u64 saved = UINT64_MAX;
+    auto save = [&] {
+        stats::timer out_timer(stats::output);
+        writer.flush();
+        gen.save(checkpoint::path_for(ck.path, gen.position()));
+        saved = gen.position();
+    };
+    for (;;) {
+        // stop chunks at checkpoint boundaries
+        auto want = every ? std::min<u64>(chunk_size, every - gen.position() % every) : chunk_size;
+        auto n = gen.fill(std::span(records).first(want));
+        if (n == 0)
+            break;
+        {
+            stats::timer out_timer(stats::output);
+            writer.write(std::span(records).first(n));
+        }
+        if (every && gen.position() % every == 0)
+            save();
+    }
+    stats::timer out_timer(stats::output);
+    writer.finish();
+    out_timer.stop();
+    if (!ck.path.empty() && saved != gen.position())
+        save();
+}
+
+} // namespace tracegen
+
+// === C interface ===
+
+struct tracegen_generator {
+    tracegen::generator gen;
+};
+
+static_assert(sizeof(tracegen_record) == sizeof(trace_record) &&
+              offsetof(tracegen_record, op) == offsetof(trace_record, op) &&
+              offsetof(tracegen_record, size) == offsetof(trace_record, size) &&
+              offsetof(tracegen_record, offset) == offsetof(trace_record, offset));
+
+extern "C" tracegen_generator *tracegen_create(const char *params) {
+    return new tracegen_generator{tracegen::generator(tracegen::config::parse(params))};
+}
+
+extern "C" size_t tracegen_fill(tracegen_generator *gen, tracegen_record *out, size_t n) {
+    return gen->gen.fill(std::span(reinterpret_cast<trace_record *>(out), n));
+}
+
+extern "C" tracegen_generator *tracegen_resume(const char *params, const char *checkpoint) {
+    return new tracegen_generator{tracegen::generator(tracegen::config::parse(params), checkpoint)};
+}
+
+extern "C" void tracegen_save(const tracegen_generator *gen, const char *checkpoint) {
+    gen->gen.save(checkpoint);
+}
+
+extern "C" void tracegen_destroy(tracegen_generator *gen) { delete gen; }
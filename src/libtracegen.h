@@ -0,0 +1,193 @@
+#ifndef LIBTRACEGEN_H
+#define LIBTRACEGEN_H
+
+// In-process trace generation (libtracegen). A simulator builds a
+// tracegen::generator from the same spec strings the tools take and pulls
+// records straight into its own buffer:
+//
+//   auto cfg = tracegen::config::parse("addresses=100000 length=10000000 p_irm=0.3 ird=c");
+//   tracegen::generator gen(cfg);
+//   vec<trace_record> buf(chunk_size);
+//   while (auto n = gen.fill(buf))
+//       simulate(std::span(buf).first(n));
+//
+// trace-gen, 2d-tracegen and kd-tracegen are thin front ends over this API,
+// so a given config produces the same records in every tool and through the
+// library. C callers use tracegen-c.h.
+
+#include <memory>
+#include <span>
+#include "trace-stream.h"
+#include "utils.h"
+
+namespace tracegen {
+
+/**
+ * Generator parameters, named and defaulted as the command-line options.
+ * groups == 0 selects the IRD/IRM mix of trace-gen and 2d-tracegen (p_irm,
+ * ird, irm); groups > 0 the grouped generator of kd-tracegen, where ird
+ * holds one ;-separated IRD spec per group and irm the group popularities.
+ */
+struct config {
+    i64 addresses = 0;
+    i64 length = 0;
+    f64 p_irm = 0;
+    i64 seed = 42;
+    i64 blocksize = 4096;
+    str ird = "b";
+    str irm = "zipf:1.2,20";
+    int groups = 0;
+    f64 rwratio = 1;
+    str sizedist = "1:1";
+    str scheduler = "heap";
+    int threads = 1;
+    str rng = "mt";
+    bool hugepages = false; // back the compact scheduler (or stack_gen) with huge pages
+    bool lazy_init = false; // initial schedule as per-time counts, see lazy_scheduler
+    bool group_schedulers = false; // kd: one scheduler and stream per group, see kd_group_gen
+    f64 sample_rate = 1; // generate only a hash sample of this fraction of the addresses, see generator
+    bool stack_depths = false; // ird is a distribution of LRU stack depths, see stack_gen
+    bool fast_paths = false; // no IRM trials for p_irm 0 or 1 (a different trace), see irm_mix
+
+    /**
+     * Parses "name=value ..." as written by params_string() (cli.h), so the
+     * parameters stored in a binary trace header recreate its generator.
+     * The output and run options that older headers also stored are ignored.
+     */
+    static config parse(const str &params);
+
+    // Whether parse() reads the parameter; params_string() stores only these.
+    static bool is_parameter(const str &name);
+};
+
+/**
+ * One tenant of a multi-tenant trace: a generator of its own, with its own
+ * footprint, IRD/IRM mix, request sizes and seed, and its request rate
+ * relative to the other tenants. cfg.length is ignored.
+ */
+struct tenant {
+    config cfg;
+    f64 rate = 1;
+};
+
+/**
+ * Distribution tables parsed from config specs (IRD, IRM and size
+ * distributions), built once per distinct spec and shared by every
+ * generator constructed with the cache. Alias tables are immutable and
+ * reference counted, so a generator copies only handles. Thread-safe;
+ * trace-sweep builds all of its jobs from one cache.
+ */
+class table_cache {
+public:
+    struct tables;
+
+    table_cache();
+    ~table_cache();
+    table_cache(const table_cache &) = delete;
+    table_cache &operator=(const table_cache &) = delete;
+
+    tables &get() { return *impl; }
+
+private:
+    std::unique_ptr<tables> impl;
+};
+
+/**
+ * Pulls records of the trace described by a config. Movable, not copyable;
+ * with threads > 1 the shard threads live as long as the generator.
+ */
+class generator {
+public:
+    struct source;
+
+    explicit generator(const config &cfg);
+
+    /**
+     * Continues the trace from a snapshot written by save() (none if
+     * resume_from is empty). cfg must describe the same generator as the
+     * snapshot except for its length, which may grow to extend the trace;
+     * fill() then returns the records after the snapshot. The generator is
+     * built as usual before its state is replaced, so this costs an initial
+     * schedule on top of reading the snapshot. Single-threaded only.
+     */
+    generator(const config &cfg, const str &resume_from);
+
+    // Takes its distribution tables from (and adds them to) tables, which
+    // must outlive the constructor call only.
+    generator(const config &cfg, table_cache &tables);
+
+    /**
+     * Multi-tenant trace of `length` records. Each tenant's generator runs
+     * on its own thread and stamps its records with arrival times at its
+     * rate, fixed 1/rate apart or, with arrivals "poisson", exponentially
+     * distributed; the records are merged by arrival time and tenant t's
+     * offsets are shifted past the address ranges of tenants 0 to t-1. The
+     * merged trace depends only on the tenants' configs, not on thread
+     * timing. params() holds the combined footprint, the length and the
+     * smallest blocksize. No checkpoints.
+     */
+    generator(const vec<tenant> &tenants, i64 length, const str &arrivals = "poisson");
+
+    generator(generator &&) noexcept;
+    generator &operator=(generator &&) noexcept;
+    ~generator();
+
+    // Writes up to out.size() records; returns how many (0 once the trace
+    // is exhausted).
+    size_t fill(std::span<trace_record> out);
+
+    const config &params() const { return cfg; }
+
+    /**
+     * Records in the whole trace: params().length, unless sample_rate < 1.
+     * Then the generator produces only the accesses to a hash sample of
+     * about sample_rate of the addresses (exactly that fraction of each
+     * group with groups > 0) that the full trace would have, IRM draws
+     * included, in fewer records; addresses keep their full-trace values
+     * and an LRU stack distance of the sampled trace is about sample_rate
+     * times that of the full one (SHARDS). The sample depends on the
+     * footprint only, not the seed.
+     */
+    i64 length() const;
+
+    // Records of the trace produced so far, counting those before a resume.
+    u64 position() const { return produced; }
+
+    // Atomically writes a snapshot of the state after position() records,
+    // see checkpoint.h. Single-threaded only.
+    void save(const str &path) const;
+
+    // The snapshot save() writes, in memory.
+    vec<uint8_t> snapshot() const;
+
+    // Continues from a snapshot() or save() of the same generator, as the
+    // resuming constructor does; only before the first fill().
+    void restore(std::span<const uint8_t> snapshot);
+
+private:
+    void restore(std::span<const uint8_t> data, const str &name);
+
+    config cfg;
+    std::unique_ptr<source> impl;
+    u64 produced = 0;
+};
+
+// What checkpoints identify a generator by: configs with equal keys produce
+// the same records, apart from their length.
+str generator_key(const config &c);
+
+// Where and how often write_trace() saves the generator. A "{}" in path is
+// replaced by the record count. every == 0 saves once, at the end.
+struct checkpoint_options {
+    str path; // empty: no checkpoints
+    i64 every = 0;
+};
+
+// Drains gen into writer in chunks of chunk_size records, then finishes it.
+// With a checkpoint path the generator is saved every ck.every records (the
+// writer flushed first) and at the end of the trace.
+void write_trace(generator &gen, trace_writer &writer, const checkpoint_options &ck = {});
+
+} // namespace tracegen
+
+#endif // LIBTRACEGEN_H
@@ -0,0 +1,246 @@
+#ifndef MRC_H
+#define MRC_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <unordered_map>
+#include <fmt/core.h>
+#include "stats.h"
+#include "trace-stream.h"
+#include "utils.h"
+
+// Fenwick (binary indexed) tree of counts over positions [0, size).
+class fenwick {
+    vec<i64> tree;
+
+public:
+    explicit fenwick(size_t n = 0) : tree(n + 1, 0) {}
+
+    size_t size() const { return tree.size() - 1; }
+
+    void add(size_t pos, i64 delta) {
+        for (auto i = pos + 1; i < tree.size(); i += i & -i)
+            tree[i] += delta;
+    }
+
+    // Sum over [0, pos].
+    i64 prefix(size_t pos) const {
+        i64 sum = 0;
+        for (auto i = pos + 1; i > 0; i -= i & -i)
+            sum += tree[i];
+        return sum;
+    }
+
+    // Rebuilds from 0/1 marks in O(n).
+    void assign(const vec<uint8_t> &marks, size_t n) {
+        tree.assign(n + 1, 0);
+        for (size_t i = 1; i <= marks.size(); i++) {
+            tree[i] += marks[i - 1];
+            auto parent = i + (i & -i);
+            if (parent <= n)
+                tree[parent] += tree[i];
+        }
+    }
+};
+
+/**
+ * Exact LRU stack distances (Mattson) over a stream of block addresses.
+ * Every block's most recent access time is marked in a Fenwick tree, so the
+ * distance of an access, i.e. the number of distinct blocks touched since
+ * the previous access to the same block, is a prefix count: O(log n) per
+ * access. Times are renumbered densely whenever the tree fills up, so its
+ * size stays within a small factor of the number of distinct blocks however
+ * long the trace is.
+ *
+ * With sample_rate < 1 only blocks whose hash falls below the rate are
+ * tracked (SHARDS, Waldspurger et al., FAST '15) and their distances are
+ * scaled by 1 / rate: memory and time shrink with the rate, at the cost of
+ * an approximate curve. A trace that is already such a sample (the
+ * generators' --sample-rate) is measured by passing its rate as presampled:
+ * distances are scaled by it as well. The histogram is kept at unscaled
+ * distances, so its size follows the tracked blocks, not the footprint.
+ */
+class stack_distances {
+    static constexpr i64 never = -1;
+    static constexpr size_t min_capacity = 1 << 16;
+
+    f64 rate, scale; // scale: the fraction of the footprint tracked, presampling included
+    u64 threshold;
+    vec<i64> last_dense;                       // exact mode: block -> time
+    std::unordered_map<i64, i64> last_sampled; // sampled modes
+    vec<i64> owner;                            // time -> block, never if stale
+    fenwick marks;
+    i64 now = 0, live = 0;
+
+    vec<u64> hist; // hist[d]: accesses at distance d among the tracked blocks, d >= 1
+    u64 sampled = 0, total = 0, cold = 0;
+
+    static u64 hash(i64 block) {
+        u64 z = (u64)block * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    i64 &last_access(i64 block) {
+        if (scale < 1) // sampled blocks are sparse in a footprint that may be huge
+            return last_sampled.try_emplace(block, never).first->second;
+        if ((size_t)block >= last_dense.size())
+            last_dense.resize(std::max<size_t>(block + 1, last_dense.size() * 2), never);
+        return last_dense[block];
+    }
+
+    // Renumbers live times to [0, live) and resizes the tree.
+    void compact() {
+        auto capacity = std::max<size_t>(min_capacity, 2 * (size_t)live + 2);
+        vec<i64> moved(capacity, never);
+        vec<uint8_t> bits(capacity, 0);
+        i64 t = 0;
+        for (i64 i = 0; i < now; i++) {
+            if (owner[i] == never)
+                continue;
+            last_access(owner[i]) = t;
+            moved[t] = owner[i];
+            bits[t] = 1;
+            t++;
+        }
+        owner = std::move(moved);
+        marks.assign(bits, capacity);
+        now = t;
+    }
+
+public:
+    explicit stack_distances(f64 sample_rate = 1, f64 presampled = 1)
+        : rate(sample_rate), scale(sample_rate * presampled) {
+        ensure_fatal(rate > 0 && rate <= 1, "Invalid sample rate: {} (expected 0 < rate <= 1)", rate);
+        ensure_fatal(presampled > 0 && presampled <= 1, "Invalid sample rate: {} (expected 0 < rate <= 1)",
+                     presampled);
+        threshold = rate < 1 ? (u64)(rate * 18446744073709551616.0) : 0;
+        owner.assign(min_capacity, never);
+        marks = fenwick(min_capacity);
+    }
+
+    void access(i64 block) {
+        total++;
+        if (rate < 1 && hash(block) >= threshold)
+            return;
+        sampled++;
+        if ((size_t)now == owner.size())
+            compact();
+        auto &last = last_access(block);
+        if (last == never) {
+            cold++;
+            live++;
+        } else {
+            auto d = (u64)(live - marks.prefix(last) + 1);
+            if (d >= hist.size())
+                hist.resize(std::max<size_t>(d + 1, hist.size() * 2), 0);
+            hist[d]++;
+            marks.add(last, -1);
+            owner[last] = never;
+        }
+        marks.add(now, 1);
+        owner[now] = block;
+        last = now++;
+    }
+
+    u64 accesses() const { return total; }
+    u64 tracked() const { return sampled; }
+    u64 cold_misses() const { return cold; }
+
+    // Stack distance of the full trace for distance d among the tracked blocks.
+    u64 scaled(u64 d) const { return scale < 1 ? (u64)std::llround(d / scale) : d; }
+
+    // f(distance, accesses) for every (scaled) stack distance seen, in increasing order.
+    template <typename F>
+    void each_distance(F &&f) const {
+        for (size_t d = 1; d < hist.size(); d++)
+            if (hist[d])
+                f(scaled(d), hist[d]);
+    }
+
+    /**
+     * Miss ratio of an LRU cache for `points` sizes evenly spaced up to the
+     * largest distance seen (every size if there are fewer), as
+     * (size in blocks, miss ratio) pairs. Cold misses count as misses at
+     * every size.
+     */
+    vec<std::pair<i64, f64>> curve(i64 points) const {
+        vec<std::pair<i64, f64>> out;
+        if (sampled == 0)
+            return out;
+        i64 max_d = 0;
+        for (i64 d = hist.size() - 1; d > 0; d--)
+            if (hist[d]) {
+                max_d = scaled(d);
+                break;
+            }
+        i64 step = std::max<i64>(1, (max_d + points - 1) / std::max<i64>(points, 1));
+        // misses(c) = cold + accesses with distance > c
+        u64 misses = sampled;
+        i64 d = 0;
+        for (i64 c = 0;; c = std::min(c + step, max_d)) {
+            for (; d < (i64)hist.size() && (i64)scaled(d) <= c; d++)
+                misses -= hist[d];
+            out.push_back({c, (f64)misses / sampled});
+            if (c == max_d)
+                break;
+        }
+        return out;
+    }
+};
+
+/**
+ * Trace sink for --format=mrc: instead of writing records, feeds their block
+ * addresses (offset / blocksize; multi-block requests count once, at their
+ * first block) to stack_distances and writes the LRU miss-ratio curve on
+ * finish(), one "<cache size in blocks> <miss ratio>" line per point after
+ * a '#' header. Reads and writes are both accesses.
+ */
+class mrc_writer : public trace_writer {
+    FILE *out;
+    bool owned = false;
+    i64 blocksize, points;
+    f64 rate;
+    stack_distances sd;
+
+public:
+    // presampled: the rate at which the trace itself was sampled, see stack_distances.
+    mrc_writer(const str &path, i64 blocksize, f64 sample_rate, i64 points, f64 presampled = 1)
+        : blocksize(blocksize), points(points), rate(sample_rate * presampled), sd(sample_rate, presampled) {
+        ensure_fatal(blocksize > 0, "Invalid blocksize: {}", blocksize);
+        ensure_fatal(points > 0, "Invalid number of MRC points: {}", points);
+        if (path == "-") {
+            out = stdout;
+        } else {
+            out = std::fopen(path.c_str(), "w");
+            owned = true;
+            ensure_fatal(out, "Cannot open output file {}: {}", path, std::strerror(errno));
+        }
+    }
+
+    ~mrc_writer() override {
+        if (owned)
+            std::fclose(out);
+    }
+
+    void write(std::span<const trace_record> records) override {
+        for (auto &r : records)
+            sd.access(r.offset / blocksize);
+    }
+
+    void finish() override {
+        fmt::memory_buffer buf;
+        fmt::format_to(std::back_inserter(buf), "# cache_blocks miss_ratio (accesses={} sample_rate={})\n",
+                       sd.accesses(), rate);
+        for (auto [c, mr] : sd.curve(points))
+            fmt::format_to(std::back_inserter(buf), "{} {:.6f}\n", c, mr);
+        std::fwrite(buf.data(), 1, buf.size(), out);
+        std::fflush(out);
+        stats::add(stats::bytes_written, buf.size());
+    }
+};
+
+#endif // MRC_H
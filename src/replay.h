@@ -0,0 +1,386 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+// Replay of the generated trace against a file or block device
+// (--format=replay). Instead of being written out, every record is issued as
+// a read or write of its size at its byte offset, paced to a target rate:
+// each op gets a due time from --iops, at fixed intervals or with
+// exponential (Poisson) inter-arrival gaps, and is submitted once due, with
+// at most --queue-depth ops outstanding. The generator keeps running on the
+// calling thread up to a few chunks ahead of a replay thread that owns the
+// io_uring (raw syscalls, see async-output.h), so generation is not the
+// bottleneck. Latencies go to per-op log-linear histograms, summarised on
+// stdout when the trace ends.
+//
+// A paced op's latency is measured from its due time, not from when it was
+// submitted, so time spent waiting for a free queue slot counts (no
+// coordinated omission). Unpaced (--iops 0) ops are measured from
+// submission.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <random>
+#include <span>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include "async-output.h"
+#include "histogram.h"
+#include "rng.h"
+#include "stats.h"
+#include "trace-stream.h"
+#include "utils.h"
+
+struct replay_options {
+    f64 iops = 0;           // target rate, 0: as fast as the queue depth allows
+    str arrivals = "fixed"; // fixed or poisson inter-arrival gaps
+    int queue_depth = 32;
+    str latency; // histogram dump, empty for none
+};
+
+/**
+ * Trace sink for --format=replay; see the top of this file. The target is
+ * opened read-write (created if missing, never truncated), with O_DIRECT
+ * when the blocksize is a multiple of 4 KiB. Block devices are size-checked;
+ * files grow with the writes and reads past their end complete short.
+ * Without io_uring the ops are issued synchronously, one at a time.
+ */
+class replay_writer : public trace_writer {
+    using clock = std::chrono::steady_clock;
+    static constexpr size_t align = 4096;
+    static constexpr size_t chunks = 4;
+
+    struct chunk {
+        uint32_t index;
+        uint32_t len; // 0 stops the replay thread
+    };
+
+    struct buffer {
+        char *data = nullptr;
+        size_t capacity = 0;
+    };
+
+    // Reads land in their own buffer, so writes keep sending the fill pattern.
+    struct op_slot {
+        buffer bufs[2]; // by op
+        char *buf;
+        i64 op;
+        u64 len, offset;
+        clock::time_point start;
+    };
+
+    str path;
+    replay_options opts;
+    mt64 arrival_rng;
+    int fd = -1;
+    bool direct = false, use_uring = false;
+    u64 device_size = 0; // 0 for files
+    vec<vec<trace_record>> bufs;
+    spsc_queue<chunk> full{chunks + 1}, empty{chunks};
+    std::atomic<int> error{0};
+    std::thread worker;
+
+    // replay thread only, read after join
+    log_histogram hist[2]; // latencies in ns, by op
+    u64 short_reads = 0;
+    f64 elapsed = 0;
+
+    void fail(int err) {
+        int none = 0;
+        error.compare_exchange_strong(none, err);
+    }
+
+    void check() {
+        if (auto err = error.load(std::memory_order_relaxed))
+            log_fatal("Replay I/O on {} failed: {}", path, std::strerror(err));
+    }
+
+    void end_direct() {
+        if (!direct)
+            return;
+        direct = false;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    }
+
+    static char *reserve(buffer &b, size_t len) {
+        if (len > b.capacity) {
+            std::free(b.data);
+            b.capacity = (len + align - 1) / align * align;
+            b.data = (char *)std::aligned_alloc(align, b.capacity);
+            ensure_fatal(b.data, "Cannot allocate a {} byte I/O buffer", b.capacity);
+            std::memset(b.data, 0xa5, b.capacity);
+        }
+        return b.data;
+    }
+
+    // pread/pwrite of the remaining bytes; the bytes done, or -errno.
+    int sync_io(const op_slot &s, u64 done = 0) {
+        while (done < s.len) {
+            auto r = s.op ? ::pwrite(fd, s.buf + done, s.len - done, s.offset + done)
+                          : ::pread(fd, s.buf + done, s.len - done, s.offset + done);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0 && errno == EINVAL && direct) {
+                end_direct();
+                continue;
+            }
+            if (r < 0)
+                return -errno;
+            if (r == 0)
+                break; // end of file
+            done += r;
+        }
+        return (int)done;
+    }
+
+    void complete(op_slot &s, int res) {
+        if (res == -EINVAL) { // misaligned for O_DIRECT on this device: go on buffered
+            end_direct();
+            res = sync_io(s);
+        } else if (res >= 0 && (u64)res < s.len) {
+            res = sync_io(s, res);
+        }
+        auto end = clock::now();
+        if (res < 0) {
+            fail(-res);
+            return;
+        }
+        if (s.op == 0 && (u64)res < s.len)
+            short_reads++;
+        hist[s.op != 0].add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - s.start).count());
+        if (s.op)
+            stats::add(stats::bytes_written, s.len);
+    }
+
+    // Nanoseconds from one due time to the next.
+    f64 gap() {
+        if (opts.iops <= 0)
+            return 0;
+        if (opts.arrivals == "poisson")
+            return std::exponential_distribution<f64>(opts.iops)(arrival_rng) * 1e9;
+        return 1e9 / opts.iops;
+    }
+
+    // Spins (sleeping while far off) until due, reaping completions meanwhile.
+    template <typename Reap>
+    static void wait_until(clock::time_point due, Reap &&reap) {
+        using namespace std::chrono_literals;
+        for (auto now = clock::now(); now < due; now = clock::now()) {
+            if (reap())
+                continue;
+            if (due - now > 200us)
+                std::this_thread::sleep_for(due - now - 100us);
+        }
+    }
+
+    void run(uring *ring) {
+        bool paced = opts.iops > 0;
+        vec<op_slot> slots(ring ? opts.queue_depth : 1);
+        vec<uint32_t> idle;
+        for (uint32_t i = 0; i < slots.size(); i++)
+            idle.push_back(slots.size() - 1 - i);
+        size_t prepared = 0;
+
+        auto finish = [&](std::pair<u64, int> done) {
+            complete(slots[done.first], done.second);
+            idle.push_back(done.first);
+        };
+        auto reap = [&] {
+            std::pair<u64, int> done;
+            if (!ring || !ring->reap(done))
+                return false;
+            finish(done);
+            return true;
+        };
+        auto submit = [&] {
+            if (prepared > 0 && !ring->submit())
+                fail(errno ? errno : EIO);
+            prepared = 0;
+        };
+
+        clock::time_point t0;
+        f64 due_ns = 0;
+        bool started = false;
+        for (;;) {
+            auto c = full.pop();
+            if (c.len == 0)
+                break;
+            if (!started) {
+                t0 = clock::now();
+                started = true;
+            }
+            for (auto &r : std::span(bufs[c.index]).first(c.len)) {
+                if (error.load(std::memory_order_relaxed))
+                    break;
+                auto due = t0 + std::chrono::nanoseconds((i64)due_ns);
+                due_ns += gap();
+                if (paced && clock::now() < due) {
+                    submit(); // the batch that is already due goes out before waiting
+                    wait_until(due, reap);
+                }
+                while (idle.empty() && !reap()) {
+                    submit();
+                    finish(ring->wait());
+                }
+                auto &s = slots[idle.back()];
+                idle.pop_back();
+                s.buf = reserve(s.bufs[r.op != 0], r.size);
+                s.op = r.op;
+                s.len = r.size;
+                s.offset = r.offset;
+                s.start = paced ? due : clock::now();
+                if (ring) {
+                    ring->prepare(s.op ? IORING_OP_WRITE : IORING_OP_READ, fd, s.buf, s.len, s.offset,
+                                  &s - slots.data());
+                    prepared++;
+                } else {
+                    complete(s, sync_io(s));
+                    idle.push_back(&s - slots.data());
+                }
+            }
+            if (ring)
+                submit();
+            empty.push({c.index, 0});
+        }
+        if (ring) {
+            submit();
+            while (idle.size() < slots.size())
+                finish(ring->wait());
+        }
+        if (started)
+            elapsed = std::chrono::duration<f64>(clock::now() - t0).count();
+        for (auto &s : slots)
+            for (auto &b : s.bufs)
+                std::free(b.data);
+    }
+
+    void print_summary() const {
+        u64 ops = hist[0].count() + hist[1].count();
+        fmt::print("replay: {} ops on {} in {:.3f} s, {:.0f} IOPS", ops, path, elapsed,
+                   elapsed > 0 ? ops / elapsed : 0.0);
+        if (opts.iops > 0)
+            fmt::print(" (target {:.0f}, {})", opts.iops, opts.arrivals);
+        fmt::print(", queue depth {}, {}{}\n", use_uring ? opts.queue_depth : 1,
+                   use_uring ? "io_uring" : "pread/pwrite", direct ? " O_DIRECT" : "");
+        const char *names[] = {"read", "write"};
+        for (int op = 0; op < 2; op++) {
+            auto &h = hist[op];
+            if (!h.count())
+                continue;
+            fmt::print("  {:5} {:>10} ops  latency us: mean {:.1f} p50 {:.1f} p90 {:.1f} p99 {:.1f} "
+                       "p99.9 {:.1f} max {:.1f}\n",
+                       names[op], h.count(), h.mean() / 1e3, h.percentile(0.5) / 1e3, h.percentile(0.9) / 1e3,
+                       h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3, h.max() / 1e3);
+        }
+        if (short_reads)
+            fmt::print("  {} reads ended past the end of {}\n", short_reads, path);
+    }
+
+    // "<op> <latency lower bound, ns> <count>" per non-empty bucket.
+    void write_histograms() const {
+        auto out = std::fopen(opts.latency.c_str(), "w");
+        ensure_fatal(out, "Cannot open latency file {}: {}", opts.latency, std::strerror(errno));
+        fmt::memory_buffer buf;
+        fmt::format_to(std::back_inserter(buf), "# op latency_ns count\n");
+        const char *names[] = {"read", "write"};
+        for (int op = 0; op < 2; op++)
+            hist[op].each([&](u64 ns, u64, u64 n) {
+                fmt::format_to(std::back_inserter(buf), "{} {} {}\n", names[op], ns, n);
+            });
+        std::fwrite(buf.data(), 1, buf.size(), out);
+        std::fclose(out);
+    }
+
+    void stop() {
+        if (!worker.joinable())
+            return;
+        full.push({0, 0});
+        worker.join();
+    }
+
+public:
+    replay_writer(const str &path, i64 blocksize, i64 seed, const replay_options &opts)
+        : path(path), opts(opts), arrival_rng(mt64::stream(seed, stream_arrival)) {
+        ensure_fatal(path != "-", "--format=replay requires --output <file or block device>");
+        ensure_fatal(opts.iops >= 0, "Invalid --iops: {}", opts.iops);
+        ensure_fatal(opts.arrivals == "fixed" || opts.arrivals == "poisson",
+                     "Invalid --arrivals: {} (expected fixed or poisson)", opts.arrivals);
+        ensure_fatal(opts.queue_depth > 0 && opts.queue_depth <= 4096, "Invalid --queue-depth: {}",
+                     opts.queue_depth);
+        ensure_fatal(blocksize > 0, "Invalid blocksize: {}", blocksize);
+        // offsets and sizes are blocksize multiples, aligned enough for O_DIRECT at 4 KiB
+        fd = blocksize % align == 0 ? ::open(path.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644) : -1;
+        direct = fd >= 0;
+        if (fd < 0) // e.g. tmpfs refuses O_DIRECT
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        ensure_fatal(fd >= 0, "Cannot open replay target {}: {}", path, std::strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode))
+            ensure_fatal(ioctl(fd, BLKGETSIZE64, &device_size) == 0 && device_size > 0,
+                         "Cannot get the size of {}: {}", path, std::strerror(errno));
+
+        for (uint32_t i = 0; i < chunks; i++) {
+            bufs.emplace_back(chunk_size);
+            empty.push({i, 0});
+        }
+        auto ring = std::make_unique<uring>();
+        use_uring = ring->open(opts.queue_depth);
+        if (!use_uring)
+            ring.reset();
+        worker = std::thread([this, r = std::move(ring)] { run(r.get()); });
+    }
+
+    replay_writer(const replay_writer &) = delete;
+    replay_writer &operator=(const replay_writer &) = delete;
+
+    ~replay_writer() override {
+        stop();
+        ::close(fd);
+    }
+
+    void write(std::span<const trace_record> records) override {
+        while (!records.empty()) {
+            auto n = std::min(records.size(), chunk_size);
+            auto part = records.first(n);
+            if (device_size)
+                for (auto &r : part)
+                    ensure_fatal((u64)(r.offset + r.size) <= device_size,
+                                 "Request of {} bytes at {} is past the end of {} ({} bytes); "
+                                 "use fewer addresses or a smaller blocksize",
+                                 r.size, r.offset, path, device_size);
+            auto c = empty.pop();
+            check();
+            std::copy(part.begin(), part.end(), bufs[c.index].begin());
+            full.push({c.index, (uint32_t)n});
+            records = records.subspan(n);
+        }
+    }
+
+    // Waits until the replay thread has issued every record handed over so far.
+    void flush() override {
+        vec<chunk> back;
+        for (size_t i = 0; i < chunks; i++)
+            back.push_back(empty.pop());
+        for (auto &c : back)
+            empty.push(c);
+        check();
+    }
+
+    void finish() override {
+        stop();
+        check();
+        print_summary();
+        if (!opts.latency.empty())
+            write_histograms();
+    }
+
+};
+
+#endif // REPLAY_H
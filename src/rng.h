@@ -0,0 +1,313 @@
+#ifndef RNG_H
+#define RNG_H
+
+// Random engines selectable with --rng. Every engine is a 64-bit uniform
+// random bit generator with
+//
+//   static E stream(i64 seed, u64 id)   independent stream `id` of a seed
+//   void fill(std::span<u64> out)       bulk generation, same sequence as
+//                                       repeated operator() calls
+//
+// and generators consume them through block_rng, which refills a small
+// buffer with fill() and hands values out one at a time.
+
+#include <array>
+#include <bit>
+#include <limits>
+#include <random>
+#include <span>
+#include <type_traits>
+#include "checkpoint.h"
+#include "utils.h"
+
+// splitmix64 finaliser, used to derive independent seeds from the user seed.
+inline u64 derive_seed(i64 seed, u64 stream) {
+    u64 z = (u64)seed + (stream + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Stream ids passed to E::stream(). Address generation uses stream 0.
+enum rng_stream : u64 {
+    stream_main = 0,
+    stream_op = 1,
+    stream_size = 2,
+    stream_irm = 3,
+    stream_arrival = 4, // inter-arrival gaps (replay, tenants)
+    stream_shard = 1024, // + shard index
+    stream_group = 1 << 20, // + kd group index (--group-schedulers)
+    stream_tenant = 1 << 21, // + tenant index: seeds of tenants that set none
+};
+
+// std::mt19937_64, the original engine. Stream 0, the address stream, is
+// seeded with the plain seed as before; traces from before alias sampling
+// differ anyway, since the distributions consume it differently (README).
+struct mt64 : std::mt19937_64 {
+    using std::mt19937_64::mt19937_64;
+
+    static mt64 stream(i64 seed, u64 id) {
+        return mt64(id == stream_main ? (u64)seed : derive_seed(seed, id));
+    }
+
+    void fill(std::span<u64> out) {
+        for (auto &x : out)
+            x = (*this)();
+    }
+};
+
+// xoshiro256++ (Blackman & Vigna). The fixed streams and shards are 2^128
+// draws apart (jump()); from stream_group on, where ids run into the
+// millions and each jump costs 256 steps, a stream is seeded from
+// derive_seed() instead.
+class xoshiro256pp {
+    std::array<u64, 4> s;
+
+public:
+    using result_type = u64;
+    static constexpr u64 min() { return 0; }
+    static constexpr u64 max() { return std::numeric_limits<u64>::max(); }
+
+    explicit xoshiro256pp(u64 seed = 0) {
+        for (int i = 0; i < 4; i++)
+            s[i] = derive_seed((i64)seed, i);
+    }
+
+    static xoshiro256pp stream(i64 seed, u64 id) {
+        if (id >= stream_group)
+            return xoshiro256pp(derive_seed(seed, id));
+        xoshiro256pp e(seed);
+        for (u64 i = 0; i < id; i++)
+            e.jump();
+        return e;
+    }
+
+    u64 operator()() {
+        u64 result = std::rotl(s[0] + s[3], 23) + s[0];
+        u64 t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = std::rotl(s[3], 45);
+        return result;
+    }
+
+    void fill(std::span<u64> out) {
+        // keep the state in registers for the whole block
+        auto [s0, s1, s2, s3] = s;
+        for (auto &x : out) {
+            x = std::rotl(s0 + s3, 23) + s0;
+            u64 t = s1 << 17;
+            s2 ^= s0;
+            s3 ^= s1;
+            s1 ^= s2;
+            s0 ^= s3;
+            s2 ^= t;
+            s3 = std::rotl(s3, 45);
+        }
+        s = {s0, s1, s2, s3};
+    }
+
+    // Advances by 2^128 draws.
+    void jump() {
+        constexpr u64 poly[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+        std::array<u64, 4> t{};
+        for (auto p : poly)
+            for (int b = 0; b < 64; b++) {
+                if (p & (1ULL << b))
+                    for (int i = 0; i < 4; i++)
+                        t[i] ^= s[i];
+                (*this)();
+            }
+        s = t;
+    }
+};
+
+// PCG64 (XSL-RR 128/64, O'Neill). Streams select the LCG increment.
+class pcg64 {
+    using u128 = unsigned __int128;
+    static constexpr u128 mult = ((u128)0x2360ed051fc65da4ULL << 64) | 0x4385df649fccf645ULL;
+
+    u128 state = 0, inc = 1;
+
+    static u64 output(u128 x) {
+        return std::rotr((u64)(x >> 64) ^ (u64)x, (int)(x >> 122));
+    }
+
+public:
+    using result_type = u64;
+    static constexpr u64 min() { return 0; }
+    static constexpr u64 max() { return std::numeric_limits<u64>::max(); }
+
+    explicit pcg64(u64 seed = 0, u64 seq = 0) {
+        inc = ((u128)seq << 1) | 1;
+        (*this)();
+        state += ((u128)derive_seed((i64)seed, 0) << 64) | seed;
+        (*this)();
+    }
+
+    static pcg64 stream(i64 seed, u64 id) { return pcg64((u64)seed, id); }
+
+    u64 operator()() {
+        state = state * mult + inc;
+        return output(state);
+    }
+
+    void fill(std::span<u64> out) {
+        auto x = state;
+        for (auto &v : out) {
+            x = x * mult + inc;
+            v = output(x);
+        }
+        state = x;
+    }
+};
+
+/**
+ * Philox4x64-10 (Salmon et al., Random123), counter-based: the i-th block of
+ * four outputs is a pure function of (key, i), so fill() is a loop over
+ * independent counters and jumping ahead is setting the counter. Streams use
+ * distinct counter high words under the same key.
+ */
+class philox4x64 {
+    std::array<u64, 2> key;
+    std::array<u64, 4> ctr{};
+    std::array<u64, 4> out{};
+    unsigned pos = 4;
+
+    static std::array<u64, 4> block(std::array<u64, 4> c, std::array<u64, 2> k) {
+        using u128 = unsigned __int128;
+        for (int r = 0; r < 10; r++) {
+            u128 p0 = (u128)0xd2e7470ee14c6c93ULL * c[0];
+            u128 p1 = (u128)0xca5a826395121157ULL * c[2];
+            c = {(u64)(p1 >> 64) ^ c[1] ^ k[0], (u64)p1, (u64)(p0 >> 64) ^ c[3] ^ k[1], (u64)p0};
+            k[0] += 0x9e3779b97f4a7c15ULL;
+            k[1] += 0xbb67ae8584caa73bULL;
+        }
+        return c;
+    }
+
+public:
+    using result_type = u64;
+    static constexpr u64 min() { return 0; }
+    static constexpr u64 max() { return std::numeric_limits<u64>::max(); }
+
+    explicit philox4x64(u64 seed = 0, u64 stream_id = 0)
+        : key{seed, derive_seed((i64)seed, 0)} {
+        ctr[3] = stream_id;
+    }
+
+    static philox4x64 stream(i64 seed, u64 id) { return philox4x64((u64)seed, id); }
+
+    u64 operator()() {
+        if (pos == 4) {
+            out = block(ctr, key);
+            ctr[0]++;
+            pos = 0;
+        }
+        return out[pos++];
+    }
+
+    void fill(std::span<u64> dst) {
+        size_t i = 0;
+        while (pos < 4 && i < dst.size())
+            dst[i++] = out[pos++];
+        auto c0 = ctr[0];
+        for (; i + 4 <= dst.size(); i += 4) {
+            auto b = block({c0++, ctr[1], ctr[2], ctr[3]}, key);
+            for (int j = 0; j < 4; j++)
+                dst[i + j] = b[j];
+        }
+        ctr[0] = c0;
+        while (i < dst.size())
+            dst[i++] = (*this)();
+    }
+
+    // Skips n blocks of four outputs.
+    void discard_blocks(u64 n) { ctr[0] += n; }
+};
+
+// Buffers outputs of E in blocks filled by E::fill(); the values handed out
+// are exactly E's own sequence.
+template <typename E>
+class block_rng {
+    static constexpr size_t block = 256;
+
+    E engine;
+    std::array<u64, block> buf;
+    size_t pos = block;
+
+public:
+    using result_type = u64;
+    static constexpr u64 min() { return 0; }
+    static constexpr u64 max() { return std::numeric_limits<u64>::max(); }
+
+    block_rng() = default;
+    explicit block_rng(E e) : engine(std::move(e)) {}
+
+    static block_rng stream(i64 seed, u64 id) { return block_rng(E::stream(seed, id)); }
+
+    u64 operator()() {
+        if (pos == block) {
+            engine.fill(buf);
+            pos = 0;
+        }
+        return buf[pos++];
+    }
+
+    void fill(std::span<u64> out) {
+        size_t i = 0;
+        while (pos < block && i < out.size())
+            out[i++] = buf[pos++];
+        if (i < out.size())
+            engine.fill(out.subspan(i));
+    }
+
+    // Every engine's state is a plain array of words.
+    void save(state_writer &w) const {
+        static_assert(std::is_trivially_copyable_v<E>);
+        w.put(engine);
+        w.put(buf);
+        w.put(pos);
+    }
+
+    void load(state_reader &r) {
+        r.get(engine);
+        r.get(buf);
+        r.get(pos);
+    }
+};
+
+// out.size() draws of rng: one bulk fill() where the engine has it, which
+// yields the same values as drawing them one at a time.
+template <typename R>
+void draw_n(R &rng, std::span<u64> out) {
+    if constexpr (requires { rng.fill(out); })
+        rng.fill(out);
+    else
+        for (auto &x : out)
+            x = rng();
+}
+
+/**
+ * Calls f with a default-constructed block_rng of the engine selected by
+ * --rng (mt, xoshiro, pcg or philox); callers create their streams with
+ * decltype(proto)::stream().
+ */
+template <typename F>
+auto with_rng(const str &name, F &&f) {
+    if (name == "mt")
+        return f(block_rng<mt64>{});
+    if (name == "xoshiro")
+        return f(block_rng<xoshiro256pp>{});
+    if (name == "pcg")
+        return f(block_rng<pcg64>{});
+    if (name == "philox")
+        return f(block_rng<philox4x64>{});
+    log_fatal("Invalid rng: {} (expected mt, xoshiro, pcg or philox)", name);
+}
+
+#endif // RNG_H
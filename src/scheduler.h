@@ -0,0 +1,535 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Schedulers order addresses by the virtual time at which they are next due
+// in IRD mode. Entries are any type with an i64 `ird` member holding that
+// time. All schedulers provide:
+//
+//   void init(size_t n, F entry)  initial schedule of entry(0) .. entry(n-1),
+//                                 called in order (one entry per address)
+//   T pop()                       remove and return an entry with minimal ird
+//   void push(const T &e)         reschedule; e.ird must be >= the last pop
+//   i64 next_due()                ird of the entry pop() returns next (size() > 0)
+//   size_t size()
+//   save(w), load(r)              schedule contents, see checkpoint.h
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <random>
+#include <sys/mman.h>
+#include <type_traits>
+#include "checkpoint.h"
+#include "feistel.h"
+#include "utils.h"
+
+struct tadr {
+    i64 ird;
+    i64 addr;
+};
+
+// Binary min-heap over every address (std::make_heap/pop_heap/push_heap).
+// This is the original engine and the reference for existing traces.
+template <typename T>
+class heap_scheduler {
+    vec<T> heap;
+
+    static bool cmp(const T &a, const T &b) { return a.ird > b.ird; }
+
+public:
+    template <typename F>
+    void init(size_t n, F entry) {
+        heap.clear();
+        heap.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            heap.push_back(entry(i));
+        std::make_heap(heap.begin(), heap.end(), cmp);
+    }
+
+    T pop() {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        T min = heap.back();
+        heap.pop_back();
+        return min;
+    }
+
+    i64 next_due() const { return heap.front().ird; }
+
+    void push(const T &e) {
+        heap.push_back(e);
+        std::push_heap(heap.begin(), heap.end(), cmp);
+    }
+
+    size_t size() const { return heap.size(); }
+
+    void save(state_writer &w) const { w.put(heap); }
+    void load(state_reader &r) { r.get(heap); }
+};
+
+/**
+ * Circular bucket (calendar) queue. IRD samples lie in [0, k), so every
+ * pending time is within k of the current minimum and a ring of k buckets
+ * indexed by time covers the whole schedule: push and pop are O(1)
+ * amortised. The ring is sized on demand (to a power of two above the
+ * largest increment seen), so neither k nor the scaling applied by kd-tracegen
+ * has to be known up front.
+ *
+ * Entries due at the same time come out in FIFO order (initial entries in
+ * address order). The heap leaves that order to the layout of the heap, so
+ * the two engines draw the same random numbers but can pop addresses that
+ * share a due time in a different order: traces are statistically
+ * equivalent, not byte-identical.
+ */
+template <typename T>
+class bucket_scheduler {
+    vec<vec<T>> ring{1};
+    i64 now = 0;      // time of the bucket being drained
+    size_t head = 0;  // read position in that bucket
+    size_t live = 0;
+    i64 max_due = 0;  // bound on pending times
+
+    vec<T> &bucket(i64 t) { return ring[t & (ring.size() - 1)]; }
+
+    void grow(i64 span) {
+        vec<vec<T>> next(std::bit_ceil((size_t)span + 1));
+        // every bucket holds a single time, so moving whole buckets keeps
+        // the FIFO order within each time
+        for (auto &b : ring) {
+            auto first = (&b == &bucket(now)) ? b.begin() + head : b.begin();
+            for (auto it = first; it != b.end(); ++it)
+                next[it->ird & (next.size() - 1)].push_back(*it);
+        }
+        ring = std::move(next);
+        head = 0;
+    }
+
+    void insert(const T &e) {
+        assert(e.ird >= now);
+        if (e.ird - now >= (i64)ring.size())
+            grow(e.ird - now);
+        bucket(e.ird).push_back(e);
+        live++;
+        max_due = std::max(max_due, e.ird);
+    }
+
+    // next_due() may have moved past t while the caller (lazy_scheduler)
+    // still pops other entries; step back, widening the ring if needed.
+    void rewind(i64 t) {
+        auto &b = bucket(now);
+        b.erase(b.begin(), b.begin() + head);
+        head = 0;
+        if (max_due - t >= (i64)ring.size())
+            grow(max_due - t);
+        now = t;
+    }
+
+public:
+    template <typename F>
+    void init(size_t n, F entry) {
+        vec<T> entries;
+        entries.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            entries.push_back(entry(i));
+        ring.assign(1, {});
+        head = 0;
+        live = 0;
+        if (entries.empty())
+            return;
+        now = std::min_element(entries.begin(), entries.end(),
+                               [](auto &a, auto &b) { return a.ird < b.ird; })->ird;
+        for (auto &e : entries)
+            insert(e);
+    }
+
+    T pop() {
+        next_due();
+        live--;
+        return bucket(now)[head++];
+    }
+
+    // Advances to the first non-empty bucket.
+    i64 next_due() {
+        while (head == bucket(now).size()) {
+            bucket(now).clear();
+            head = 0;
+            now++;
+        }
+        return now;
+    }
+
+    void push(const T &e) {
+        if (live == 0) {
+            // restart the ring at e so an idle stretch does not widen it
+            bucket(now).clear();
+            head = 0;
+            now = e.ird;
+        } else if (e.ird < now) {
+            rewind(e.ird);
+        }
+        insert(e);
+    }
+
+    size_t size() const { return live; }
+
+    void save(state_writer &w) const {
+        w.put((u64)ring.size());
+        for (auto &b : ring)
+            w.put(b);
+        w.put(now);
+        w.put(head);
+        w.put(live);
+        w.put(max_due);
+    }
+
+    void load(state_reader &r) {
+        u64 n;
+        r.get(n);
+        ensure_fatal(n > 0 && std::has_single_bit(n), "Corrupt bucket schedule in checkpoint");
+        ring.assign(n, {});
+        for (auto &b : ring)
+            r.get(b);
+        r.get(now);
+        r.get(head);
+        r.get(live);
+        r.get(max_due);
+    }
+};
+
+// Allocator mapping memory directly and asking for transparent huge pages,
+// which cuts TLB misses on multi-GB schedules. The advice is ignored where
+// huge pages are unavailable.
+template <typename T>
+struct huge_page_allocator {
+    using value_type = T;
+
+    huge_page_allocator() = default;
+    template <typename U> huge_page_allocator(const huge_page_allocator<U> &) {}
+
+    T *allocate(size_t n) {
+        auto bytes = n * sizeof(T);
+        void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        return (T *)p;
+    }
+
+    void deallocate(T *p, size_t n) { munmap(p, n * sizeof(T)); }
+
+    bool operator==(const huge_page_allocator &) const { return true; }
+};
+
+/**
+ * The binary heap of heap_scheduler in 8 bytes per address instead of 16
+ * (or 24 with a group): each entry packs a 32-bit due time, relative to an
+ * epoch, above a 32-bit address. The heap algorithms see the same
+ * comparisons as heap_scheduler, so traces are bit-identical to it.
+ *
+ * Pending times always lie within one maximal increment of the minimum;
+ * when a push would not fit in 32 bits, all entries are rebased to the
+ * current minimum (O(m), rare). Footprints must be below 2^32 and
+ * increments below 2^32 - this is checked. Entries are T{ird, addr}, so
+ * types carrying more state (kd-tracegen's groups) derive it from the
+ * address. With huge_pages the heap is backed by huge_page_allocator.
+ */
+template <typename T, bool huge_pages = false>
+class compact_scheduler {
+    using allocator = std::conditional_t<huge_pages, huge_page_allocator<u64>, std::allocator<u64>>;
+
+    std::vector<u64, allocator> heap;
+    i64 epoch = 0;
+
+    static bool cmp(u64 a, u64 b) { return (a >> 32) > (b >> 32); }
+
+    void rebase(i64 t) {
+        auto shift = (u64)(t - epoch);
+        if (!heap.empty())
+            shift = std::min(shift, heap.front() >> 32);
+        for (auto &x : heap)
+            x -= shift << 32;
+        epoch += shift;
+    }
+
+    u64 pack(const T &e) {
+        auto off = e.ird - epoch;
+        if (off > (i64)UINT32_MAX) {
+            rebase(e.ird);
+            off = e.ird - epoch;
+            ensure_fatal(off <= (i64)UINT32_MAX,
+                         "IRD increment {} too large for --scheduler compact, use heap", off);
+        }
+        assert(off >= 0 && (u64)e.addr <= UINT32_MAX);
+        return ((u64)off << 32) | (u64)e.addr;
+    }
+
+public:
+    template <typename F>
+    void init(size_t n, F entry) {
+        ensure_fatal(n <= (size_t)UINT32_MAX + 1, "Footprint {} too large for --scheduler compact", n);
+        heap.clear();
+        heap.reserve(n);
+        epoch = 0;
+        for (size_t i = 0; i < n; i++) {
+            auto e = entry(i);
+            ensure_fatal(e.ird >= 0 && e.ird <= (i64)UINT32_MAX,
+                         "Initial IRD {} too large for --scheduler compact, use heap", e.ird);
+            heap.push_back(((u64)e.ird << 32) | (u64)e.addr);
+        }
+        std::make_heap(heap.begin(), heap.end(), cmp);
+    }
+
+    T pop() {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        auto x = heap.back();
+        heap.pop_back();
+        return T{epoch + (i64)(x >> 32), (i64)(x & UINT32_MAX)};
+    }
+
+    i64 next_due() const { return epoch + (i64)(heap.front() >> 32); }
+
+    void push(const T &e) {
+        heap.push_back(pack(e));
+        std::push_heap(heap.begin(), heap.end(), cmp);
+    }
+
+    size_t size() const { return heap.size(); }
+
+    void save(state_writer &w) const {
+        w.put(heap);
+        w.put(epoch);
+    }
+
+    void load(state_reader &r) {
+        r.get(heap);
+        r.get(epoch);
+    }
+};
+
+// Addresses [first, first + count) whose initial due times follow one
+// distribution: times[i] (nondecreasing) with probability probs[i].
+struct lazy_segment {
+    i64 first, count;
+    vec<i64> times;
+    vec<f64> probs;
+};
+
+/**
+ * Lazy initial schedule (--lazy-init) in front of another scheduler. Initial
+ * IRDs only take a few values (the IRD support [0, k), scaled per group in
+ * kd-tracegen), so rather than drawing one per address init_lazy() draws,
+ * per segment, how many addresses are first due at each time (a multinomial,
+ * as k conditional binomials) and lets a keyed Feistel permutation of the
+ * segment decide which addresses those are. Addresses only enter Sched when
+ * they first come due, so setup is O(k) instead of O(m) and the schedule
+ * grows with the part of the footprint touched so far.
+ *
+ * Initial entries due at the same time as scheduled ones come out first.
+ * The initial draws differ from the eager init, so traces are statistically
+ * equivalent to, not identical with, those of Sched alone.
+ */
+template <typename Sched>
+class lazy_scheduler {
+    using T = decltype(std::declval<Sched &>().pop());
+
+    struct due_count {
+        i64 time, count;
+    };
+
+    // Initial entries of a segment not handed out yet.
+    struct run {
+        i64 first;
+        feistel_permutation perm;
+        vec<due_count> due; // counts > 0
+        size_t at = 0;      // current entry of due
+        i64 left = 0;       // addresses left at due[at]
+        u64 next = 0;       // next permutation index
+    };
+
+    // Next due time of each unfinished run, a min-heap.
+    struct head {
+        i64 time;
+        size_t run;
+    };
+
+    static bool later(const head &a, const head &b) { return a.time > b.time; }
+
+    Sched sched;
+    vec<run> runs;
+    vec<head> heads;
+    size_t pending = 0;
+
+    void push_head(head h) {
+        heads.push_back(h);
+        std::push_heap(heads.begin(), heads.end(), later);
+    }
+
+    bool initial_first() {
+        return !heads.empty() && (sched.size() == 0 || heads.front().time <= sched.next_due());
+    }
+
+public:
+    static constexpr bool lazy = true;
+
+    template <typename F>
+    void init(size_t n, F entry) {
+        runs.clear();
+        heads.clear();
+        pending = 0;
+        sched.init(n, entry);
+    }
+
+    template <typename Rng>
+    void init_lazy(const vec<lazy_segment> &segments, Rng &rng) {
+        init(0, [](size_t) { return T{}; });
+        for (auto &seg : segments) {
+            if (seg.count <= 0)
+                continue;
+            run r{seg.first, feistel_permutation(seg.count, (u64)rng()), {}, 0, 0, 0};
+            i64 n = seg.count;
+            f64 mass = 0;
+            for (auto p : seg.probs)
+                mass += p;
+            for (size_t i = 0; i < seg.times.size() && n > 0; i++) {
+                auto p = mass > 0 ? std::min(1.0, seg.probs[i] / mass) : 1.0;
+                auto c = i + 1 == seg.times.size() ? n : std::binomial_distribution<i64>(n, p)(rng);
+                mass -= seg.probs[i];
+                n -= c;
+                if (c == 0)
+                    continue;
+                if (!r.due.empty() && r.due.back().time == seg.times[i])
+                    r.due.back().count += c;
+                else
+                    r.due.push_back({seg.times[i], c});
+            }
+            r.left = r.due.front().count;
+            push_head({r.due.front().time, runs.size()});
+            runs.push_back(std::move(r));
+            pending += seg.count;
+        }
+    }
+
+    T pop() {
+        if (!initial_first())
+            return sched.pop();
+        std::pop_heap(heads.begin(), heads.end(), later);
+        auto [t, i] = heads.back();
+        heads.pop_back();
+        auto &r = runs[i];
+        T e{t, r.first + (i64)r.perm(r.next++)};
+        if (--r.left == 0 && ++r.at < r.due.size())
+            r.left = r.due[r.at].count;
+        if (r.left > 0)
+            push_head({r.due[r.at].time, i});
+        pending--;
+        return e;
+    }
+
+    void push(const T &e) { sched.push(e); }
+
+    i64 next_due() { return initial_first() ? heads.front().time : sched.next_due(); }
+
+    size_t size() const { return sched.size() + pending; }
+
+    void save(state_writer &w) const {
+        sched.save(w);
+        w.put((u64)runs.size());
+        for (auto &r : runs) {
+            w.put(r.first);
+            w.put(r.perm);
+            w.put(r.due);
+            w.put(r.at);
+            w.put(r.left);
+            w.put(r.next);
+        }
+        w.put(heads);
+        w.put(pending);
+    }
+
+    void load(state_reader &r) {
+        sched.load(r);
+        u64 n;
+        r.get(n);
+        runs.assign(n, {});
+        for (auto &x : runs) {
+            r.get(x.first);
+            r.get(x.perm);
+            r.get(x.due);
+            r.get(x.at);
+            r.get(x.left);
+            r.get(x.next);
+        }
+        r.get(heads);
+        r.get(pending);
+        for (auto &h : heads)
+            ensure_fatal(h.run < runs.size() && runs[h.run].at < runs[h.run].due.size(),
+                         "Corrupt lazy schedule in checkpoint");
+    }
+};
+
+template <typename S>
+constexpr bool is_lazy_scheduler = requires { S::lazy; };
+
+/**
+ * Tournament (winner) tree over n keys, smallest key first and ties to the
+ * lower index: the minimum is read in O(1) and updating one key replays its
+ * path to the root in O(log n). Merges per-group or per-shard streams of
+ * entries by their next due time.
+ */
+class tournament_tree {
+    size_t leaves;
+    vec<i64> keys;
+    vec<uint32_t> winner; // winner[1] is the root; leaves start at index `leaves`
+
+    uint32_t better(uint32_t a, uint32_t b) const { return keys[b] < keys[a] ? b : a; }
+
+public:
+    tournament_tree() = default;
+
+    explicit tournament_tree(const vec<i64> &initial)
+        : leaves(std::bit_ceil(std::max<size_t>(initial.size(), 1))),
+          keys(leaves, std::numeric_limits<i64>::max()), winner(2 * leaves) {
+        std::copy(initial.begin(), initial.end(), keys.begin());
+        for (size_t i = 0; i < leaves; i++)
+            winner[leaves + i] = i;
+        for (size_t i = leaves - 1; i > 0; i--)
+            winner[i] = better(winner[2 * i], winner[2 * i + 1]);
+    }
+
+    size_t min() const { return winner[1]; }
+
+    void update(size_t i, i64 key) {
+        keys[i] = key;
+        for (auto node = (leaves + i) / 2; node > 0; node /= 2)
+            winner[node] = better(winner[2 * node], winner[2 * node + 1]);
+    }
+};
+
+/**
+ * Calls f with a default-constructed scheduler of the engine selected by
+ * name; generators are templated on the scheduler type, so each engine gets
+ * its own instantiation of the generation loop. huge_pages only applies to
+ * the compact engine.
+ */
+template <typename T, typename F>
+auto with_scheduler(const str &name, F &&f, bool huge_pages = false) {
+    if (name == "heap")
+        return f(heap_scheduler<T>{});
+    if (name == "bucket")
+        return f(bucket_scheduler<T>{});
+    if (name == "compact")
+        return huge_pages ? f(compact_scheduler<T, true>{}) : f(compact_scheduler<T>{});
+    log_fatal("Invalid scheduler: {} (expected heap, bucket or compact)", name);
+}
+
+// Calls f with sched, or with a lazy_scheduler in front of it if lazy.
+template <typename Sched, typename F>
+auto with_lazy_init(bool lazy, Sched sched, F &&f) {
+    return lazy ? f(lazy_scheduler<Sched>{}) : f(std::move(sched));
+}
+
+#endif // SCHEDULER_H
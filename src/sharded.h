@@ -0,0 +1,201 @@
+#ifndef SHARDED_H
+#define SHARDED_H
+
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <thread>
+#include "rng.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "trace-stream.h"
+#include "tracegen-utils.h"
+#include "utils.h"
+
+// Bounded blocking queue of blocks between one producer and one consumer.
+template <typename T>
+class block_queue {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<vec<T>> q;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit block_queue(size_t capacity) : capacity(capacity) {}
+
+    // Blocks while the queue is full; returns false once closed.
+    bool push(vec<T> &&block) {
+        std::unique_lock lock(mu);
+        cv.wait(lock, [&] { return closed || q.size() < capacity; });
+        if (closed)
+            return false;
+        q.push_back(std::move(block));
+        cv.notify_all();
+        return true;
+    }
+
+    // Takes a block if one is queued, without waiting.
+    bool try_pop(vec<T> &block) {
+        std::lock_guard lock(mu);
+        if (q.empty())
+            return false;
+        block = std::move(q.front());
+        q.pop_front();
+        cv.notify_all();
+        return true;
+    }
+
+    // Blocks while the queue is empty; returns false once closed and drained.
+    bool pop(vec<T> &block) {
+        std::unique_lock lock(mu);
+        cv.wait(lock, [&] { return closed || !q.empty(); });
+        if (q.empty())
+            return false;
+        block = std::move(q.front());
+        q.pop_front();
+        cv.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard lock(mu);
+        closed = true;
+        cv.notify_all();
+    }
+};
+
+// IRM sampler for generators without an IRM component.
+struct no_irm {
+    template <typename R> i64 operator()(R &) { return 0; }
+};
+
+/**
+ * Multi-threaded IRD generation. In IRD mode every address follows its own
+ * renewal process (a running sum of IRD draws); the scheduler only merges
+ * those processes by virtual time. The address space is therefore split
+ * round-robin into one shard per thread (address a lives in shard a % T).
+ * Each shard thread runs its own scheduler with its own RNG stream and emits
+ * its accesses in time order in blocks, and fill() merges the shards by
+ * (time, shard) in a tournament tree. Consumed blocks go back to their shard
+ * to be refilled, so a shard allocates only the blocks in flight. IRM accesses are decided and drawn on the consuming thread
+ * from a separate stream, so the trace is deterministic for a given
+ * (seed, threads) but differs from the single-threaded trace.
+ *
+ * incr(addr, rng) returns the next IRD increment for addr; it is copied into
+ * every shard. Irm is the IRM sampler type (no_irm for pure IRD generators)
+ * and Rng the engine (see rng.h); shard s uses stream stream_shard + s.
+ */
+template <typename Sched, typename Incr, typename Irm, typename Rng>
+class sharded_gen {
+    static constexpr size_t block_size = 4096;
+    static constexpr size_t queue_depth = 8;
+
+    struct shard {
+        block_queue<tadr> queue{queue_depth};
+        block_queue<tadr> spare{queue_depth + 2}; // consumed blocks, back to the worker
+        vec<tadr> block;
+        size_t pos = 0;
+        std::thread worker;
+    };
+
+    static constexpr i64 idle = std::numeric_limits<i64>::max(); // shard without addresses
+
+    i64 remaining;
+    f64 p_irm;
+    Irm d_irm;
+    Rng irm_rng;
+    bernoulli_sampler is_irm;
+    vec<std::unique_ptr<shard>> shards;
+    tournament_tree merge;
+
+    static void run_shard(shard &sh, i64 addrs, size_t index, size_t count, i64 seed, Incr incr) {
+        auto rng = Rng::stream(seed, stream_shard + index);
+        Sched sched;
+        if ((i64)index >= addrs) {
+            sh.queue.close();
+            return;
+        }
+        // addresses index, index + count, ...
+        sched.init((addrs - index + count - 1) / count, [&](size_t i) {
+            i64 a = index + i * count;
+            return tadr{incr(a, rng), a};
+        });
+        stats::max(stats::max_sched_size, sched.size());
+        vec<tadr> block;
+        for (;;) {
+            if (!sh.spare.try_pop(block))
+                block = vec<tadr>(block_size);
+            for (auto &e : block) {
+                e = sched.pop();
+                sched.push({e.ird + incr(e.addr, rng), e.addr});
+            }
+            stats::add(stats::sched_pops, block_size);
+            if (!sh.queue.push(std::move(block)))
+                return;
+        }
+    }
+
+    // Makes the next entry of shard s available; false if the shard is empty.
+    bool refill(size_t s) {
+        auto &sh = *shards[s];
+        if (sh.pos < sh.block.size())
+            return true;
+        if (!sh.block.empty())
+            sh.spare.push(std::move(sh.block));
+        sh.pos = 0;
+        return sh.queue.pop(sh.block);
+    }
+
+public:
+    sharded_gen(i64 addrs, i64 length, f64 p_irm, Irm d_irm, int threads, i64 seed, Incr incr)
+        : remaining(length), p_irm(p_irm), d_irm(std::move(d_irm)),
+          irm_rng(Rng::stream(seed, stream_irm)), is_irm(p_irm) {
+        ensure_fatal(threads > 0, "Invalid number of threads: {}", threads);
+        // wall time until every shard has its initial schedule and first block
+        stats::timer init_timer(stats::init);
+        for (int s = 0; s < threads; s++) {
+            shards.push_back(std::make_unique<shard>());
+            auto &sh = *shards.back();
+            sh.worker = std::thread(run_shard, std::ref(sh), addrs, s, threads, seed, incr);
+        }
+        vec<i64> due;
+        for (size_t s = 0; s < shards.size(); s++)
+            due.push_back(refill(s) ? shards[s]->block[0].ird : idle);
+        merge = tournament_tree(due);
+    }
+
+    ~sharded_gen() {
+        for (auto &sh : shards) {
+            sh->queue.close();
+            sh->spare.close();
+        }
+        for (auto &sh : shards)
+            sh->worker.join();
+    }
+
+    size_t fill(std::span<i64> out) {
+        auto n = (size_t)std::min<i64>(out.size(), remaining);
+        size_t irm_count = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (p_irm > 0 && is_irm(irm_rng)) {
+                out[i] = d_irm(irm_rng);
+                irm_count++;
+                continue;
+            }
+            auto s = merge.min();
+            auto &sh = *shards[s];
+            ensure_fatal(sh.pos < sh.block.size(), "No addresses to schedule");
+            out[i] = sh.block[sh.pos++].addr;
+            merge.update(s, refill(s) ? sh.block[sh.pos].ird : idle);
+        }
+        stats::add(stats::irm_accesses, irm_count);
+        stats::add(stats::ird_accesses, n - irm_count);
+        remaining -= n;
+        return n;
+    }
+};
+
+#endif // SHARDED_H
@@ -0,0 +1,390 @@
+#ifndef STACK_GEN_H
+#define STACK_GEN_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <span>
+#include <utility>
+
+#include "checkpoint.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "tracegen-utils.h"
+#include "utils.h"
+
+/**
+Live time slots of an LRU stack, counted for rank queries: a bitmap of the
+slots under levels of nodes of 16 counts, each of the live slots in one
+word of the bitmap (the bottom level, in bytes) or in one node of the level
+below. select(r) sums one node per level, in a loop without branches, and
+picks the bit within the word found from its bytes' popcounts; insert and
+erase add to one count per level. The counts take about a 32nd of the
+bitmap, so for all but the largest footprints only the bitmap word misses
+the cache, where a Fenwick tree over the same slots would miss on most of
+its log2(n) steps. With huge_pages the bitmap is backed by
+huge_page_allocator.
+ */
+template <bool huge_pages = false> class recency_tree
+{
+    using allocator = std::conditional_t<huge_pages, huge_page_allocator<u64>,
+                                         std::allocator<u64>>;
+
+    std::vector<u64, allocator> bits;
+    vec<uint8_t> words;        // live slots per word of bits
+    // levels[0] counts 16 words each, levels[l] 16 of levels[l - 1]
+    vec<vec<uint32_t>> levels;
+
+    // Index of the child of a node of counts holding the r-th slot under
+    // it, r becoming its rank within that child.
+    template <typename T> static u64 child(const T *c, u64 &r)
+    {
+        u64 sum = 0, below = 0, j = 0;
+        for (int k = 0; k < 16; k++) {
+            sum += c[k];
+            bool before = sum <= r;
+            j += before;
+            below = before ? sum : below;
+        }
+        r -= below;
+        return j;
+    }
+
+    void add(u64 s, int delta)
+    {
+        auto i = s >> 6;
+        words[i] += delta;
+        for (auto &level : levels)
+            level[i >>= 4] += delta;
+    }
+
+    // in_byte[b][r]: position of the r-th set bit of the byte b
+    static constexpr auto in_byte = [] {
+        std::array<std::array<uint8_t, 8>, 256> t{};
+        for (int b = 0; b < 256; b++)
+            for (int i = 0, r = 0; i < 8; i++)
+                if (b >> i & 1)
+                    t[b][r++] = i;
+        return t;
+    }();
+
+    // Position of the r-th (from 0) set bit of w: the byte from the running
+    // sums of its bytes' popcounts, computed in parallel in one word, then
+    // the bit from a table.
+    static unsigned select_bit(u64 w, u64 r)
+    {
+        constexpr u64 ones = 0x0101010101010101, highs = ones << 7;
+        auto c = w - (w >> 1 & 0x5555555555555555);
+        c = (c & 0x3333333333333333) + (c >> 2 & 0x3333333333333333);
+        // byte k of c: the bits set in bytes 0 to k
+        c = ((c + (c >> 4)) & 0x0f0f0f0f0f0f0f0f) * ones;
+        auto past = ((c | highs) - (r + 1) * ones) & highs; // bytes above r
+        auto byte = std::countr_zero(past) / 8;
+        auto before = (c << 8) >> (8 * byte) & 0xff;
+        return 8 * byte + in_byte[w >> (8 * byte) & 0xff][r - before];
+    }
+
+  public:
+    explicit recency_tree(u64 slots = 1)
+    {
+        // every level is whole nodes, the top one a single node
+        auto n = std::max<u64>(16, ((slots + 63) / 64 + 15) / 16 * 16);
+        bits.assign(n, 0);
+        words.assign(n, 0);
+        while (n > 16) {
+            n = (n / 16 + 15) / 16 * 16;
+            levels.emplace_back(n, 0);
+        }
+    }
+
+    u64 size() const { return bits.size() * 64; }
+
+    bool contains(u64 s) const { return bits[s >> 6] >> (s & 63) & 1; }
+
+    void insert(u64 s)
+    {
+        assert(!contains(s));
+        bits[s >> 6] |= 1ull << (s & 63);
+        add(s, 1);
+    }
+
+    void erase(u64 s)
+    {
+        assert(contains(s));
+        bits[s >> 6] &= ~(1ull << (s & 63));
+        add(s, -1);
+    }
+
+    // The r-th (from 0) live slot.
+    u64 select(u64 r) const
+    {
+        u64 i = 0; // node of the level
+        for (auto l = levels.size(); l-- > 0;)
+            i = i * 16 + child(&levels[l][i * 16], r);
+        i = i * 16 + child(&words[i * 16], r);
+        return i * 64 + select_bit(bits[i], r);
+    }
+
+    // Makes exactly the slots [0, live) live.
+    void assign(u64 live)
+    {
+        for (u64 w = 0; w < bits.size(); w++) {
+            auto first = w * 64;
+            bits[w] = live >= first + 64 ? ~0ull
+                      : live > first     ? (1ull << (live - first)) - 1
+                                         : 0;
+            words[w] = std::popcount(bits[w]);
+        }
+        for (size_t l = 0; l < levels.size(); l++) {
+            std::fill(levels[l].begin(), levels[l].end(), 0);
+            for (u64 j = 0; j < (l ? levels[l - 1].size() : words.size()); j++)
+                levels[l][j / 16] += l ? levels[l - 1][j] : words[j];
+        }
+    }
+};
+
+/**
+Like gen_addresses, but the non-IRM accesses follow a target LRU stack
+distance distribution rather than an IRD one (--stack-depths). Each draws a
+depth from d_depth, whose class i of k stands for the depths
+[i, i + 1) * addrs / k (as IRM classes stand for address ranges), uniformly
+within the class, and accesses the address at that depth of the LRU stack.
+Every access, IRM draws included, moves its address to the top. The stack
+starts with all addresses in a random order, so depths are exact from the
+first access; an LRU simulation of the trace sees first touches as cold
+misses instead.
+
+The top of the stack is a window of up to 64 addresses, in order, which
+slides down a buffer as addresses are pushed onto it; the rest is a
+recency_tree of time slots, where an address below the window holds the
+slot of the time it left it. Shallow depths are served from the window
+alone. A deeper access selects its slot by rank and swaps it for the
+window's last address, which takes the next slot; slots are renumbered when
+they run out, every m / 2 such accesses. The slot of each address is only
+kept with IRM draws, which need it to find their address; a deep access
+then touches four random locations of the O(m) arrays (three without), so
+huge_pages, backing them with huge_page_allocator, about halves its cost at
+large m. Addresses are 32-bit, so the footprint is limited to 2^31. Mix is
+drawn or, for -p 0 under --fast-paths, never (see irm_mix), when Irm may be
+std::monostate.
+ */
+template <typename Irm, typename Rng, bool huge_pages = false,
+          irm_mix Mix = irm_mix::drawn>
+class stack_gen
+{
+    using idx = uint32_t;
+    using allocator = std::conditional_t<huge_pages, huge_page_allocator<idx>,
+                                         std::allocator<idx>>;
+    static constexpr idx in_window = std::numeric_limits<idx>::max();
+
+    i64 addrs, remaining;
+    bernoulli_sampler is_irm;
+    ird_sampler d_depth;
+    vec<std::uniform_int_distribution<i64>> depths;
+    Irm d_irm;
+    Rng &rng;
+    static constexpr i64 slack = 1024; // pushes between window moves
+    vec<idx> window;                   // depth d at window[top + d]
+    i64 shallow;                       // depths in the window, [0, shallow)
+    i64 top = slack;
+    bool tracking;                     // slot is kept (p_irm > 0)
+    std::vector<idx, allocator> slot;  // per address: its slot, or in_window
+    std::vector<idx, allocator> owner; // per slot: its address (if live)
+    recency_tree<huge_pages> tree;
+    i64 deep;    // addresses below the window, the live slots
+    i64 now = 0; // next free slot
+
+    idx &at(i64 d) { return window[top + d]; }
+
+    // x^-1 mod m, for x coprime to m.
+    static u64 inverse_mod(u64 x, u64 m)
+    {
+        i64 t = 0, next_t = 1, r = m, next_r = x;
+        while (next_r != 0) {
+            auto q = r / next_r;
+            t = std::exchange(next_t, t - q * next_t);
+            r = std::exchange(next_r, r - q * next_r);
+        }
+        return t < 0 ? t + m : t;
+    }
+
+    // Moves the address at depth d of the window to the top.
+    void raise(i64 d)
+    {
+        auto a = at(d);
+        std::memmove(&at(1), &at(0), d * sizeof(idx));
+        at(0) = a;
+    }
+
+    // Moves the address of slot s to the top, and the window's last address
+    // into the next slot.
+    void promote(i64 s)
+    {
+        auto a = owner[s];
+        tree.erase(s);
+        if (tracking)
+            slot[a] = in_window;
+        if (now == (i64)owner.size())
+            compact();
+        if (top == 0) {
+            std::memmove(&window[slack], &window[0], shallow * sizeof(idx));
+            top = slack;
+        }
+        top--;
+        auto last = at(shallow);
+        at(0) = a;
+        owner[now] = last;
+        if (tracking)
+            slot[last] = now;
+        tree.insert(now++);
+    }
+
+    // Renumbers the live slots from 0, in order.
+    void compact()
+    {
+        i64 k = 0;
+        for (i64 s = 0; s < now; s++)
+            if (tree.contains(s)) {
+                owner[k] = owner[s];
+                if (tracking)
+                    slot[owner[k]] = k;
+                k++;
+            }
+        now = k;
+        tree.assign(k);
+    }
+
+  public:
+    stack_gen(i64 addrs, i64 length, f64 p_irm, ird_sampler d_depth, Irm d_irm,
+              Rng &rng)
+        : addrs(addrs), remaining(length), is_irm(p_irm),
+          d_depth(std::move(d_depth)), d_irm(std::move(d_irm)), rng(rng)
+    {
+        stats::timer init_timer(stats::init);
+        assert(addrs > 0 && addrs <= std::numeric_limits<int32_t>::max());
+        depths = get_intervals(this->d_depth.dis.size(), addrs);
+        shallow = std::min<i64>(addrs, 64);
+        window.resize(slack + shallow);
+        deep = addrs - shallow;
+        tracking = Mix == irm_mix::drawn && p_irm > 0;
+        owner.resize(deep + std::max<i64>(deep / 2, 1024));
+        tree = recency_tree<huge_pages>(owner.size());
+
+        // stack position i (0 at the top) holds the address start + i * step
+        // (mod addrs): the window, then the slots from the newest. Both
+        // arrays are written in order, slot through the inverse of step.
+        u64 m = addrs, step, start = rng() % m;
+        do
+            step = rng() % m;
+        while (std::gcd(step, m) != 1);
+        auto address = [&](u64 i) {
+            return (idx)((start + (unsigned __int128)i * step) % m);
+        };
+        for (i64 i = 0; i < shallow; i++)
+            at(i) = address(i);
+        for (i64 s = 0; s < deep; s++)
+            owner[s] = address(addrs - 1 - s);
+        if (tracking) {
+            auto inverse = inverse_mod(step, m);
+            slot.resize(addrs);
+            for (u64 a = 0; a < m; a++) {
+                auto i = (i64)((unsigned __int128)((a + m - start) % m) *
+                               inverse % m);
+                slot[a] = i < shallow ? in_window : addrs - 1 - i;
+            }
+        }
+        now = deep;
+        tree.assign(deep);
+    }
+
+    size_t fill(std::span<i64> out)
+    {
+        auto n = (size_t)std::min<i64>(out.size(), remaining);
+        size_t irm_count = 0;
+        for (size_t i = 0; i < n; i++) {
+            if constexpr (Mix == irm_mix::drawn) {
+                if (is_irm(rng)) {
+                    auto a = (idx)d_irm(rng);
+                    assert(a < addrs);
+                    out[i] = a;
+                    if (slot[a] != in_window) {
+                        promote(slot[a]);
+                    } else {
+                        i64 d = 0;
+                        while (at(d) != a)
+                            d++;
+                        raise(d);
+                    }
+                    irm_count++;
+                    continue;
+                }
+            }
+
+            // a depth uniformly within the class, from one 64-bit draw
+            auto &c = depths[d_depth(rng)];
+            auto d = c.a() + (i64)((unsigned __int128)rng() *
+                                       (u64)(c.b() - c.a() + 1) >>
+                                   64);
+            assert(d >= 0 && d < addrs);
+            if (d < shallow) {
+                out[i] = at(d);
+                raise(d);
+            } else {
+                // the (d - shallow)-th newest live slot
+                auto s = tree.select(deep - 1 - (d - shallow));
+                out[i] = owner[s];
+                promote(s);
+            }
+        }
+        stats::add(stats::irm_accesses, irm_count);
+        stats::add(stats::ird_accesses, n - irm_count);
+        remaining -= n;
+        return n;
+    }
+
+    // The stack is saved in order, from the top; the engine belongs to the
+    // caller.
+    void save(state_writer &w) const
+    {
+        save_state(w, d_irm);
+        vec<idx> stack;
+        stack.reserve(addrs);
+        for (i64 d = 0; d < shallow; d++)
+            stack.push_back(window[top + d]);
+        for (i64 s = now; s-- > 0;)
+            if (tree.contains(s))
+                stack.push_back(owner[s]);
+        w.put(stack);
+    }
+
+    // Restores the state saved after `done` records of this trace.
+    void load(state_reader &r, i64 done)
+    {
+        load_state(r, d_irm);
+        vec<idx> stack;
+        r.get(stack);
+        ensure_fatal((i64)stack.size() == addrs,
+                     "Checkpoint does not match the footprint");
+        top = slack;
+        for (i64 d = 0; d < shallow; d++) {
+            at(d) = stack[d];
+            if (tracking)
+                slot[stack[d]] = in_window;
+        }
+        for (i64 s = 0; s < deep; s++) {
+            owner[s] = stack[addrs - 1 - s];
+            if (tracking)
+                slot[owner[s]] = s;
+        }
+        now = deep;
+        tree.assign(deep);
+        remaining -= done;
+    }
+};
+
+#endif // STACK_GEN_H
@@ -0,0 +1,133 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Phase timers and counters reported by --stats. Without TRACEGEN_STATS
+// (meson -Dstats=false) every function here is an empty inline and the
+// instrumentation compiles away.
+//
+// Nothing is updated per access: generation loops count into locals and
+// publish them with stats::add() once per fill(), and timers wrap whole
+// phases or chunks. Updates are relaxed atomics so shard threads can report
+// too.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fmt/core.h>
+#include "utils.h"
+
+namespace stats {
+
+enum phase { parse, init, generate, post_process, output, n_phases };
+
+enum counter {
+    records,
+    irm_accesses,
+    ird_accesses,
+    sched_pops,
+    max_sched_size,
+    bytes_written,
+    n_counters,
+};
+
+inline constexpr const char *phase_names[n_phases] = {
+    "parse", "init", "generate", "post_process", "output",
+};
+
+inline constexpr const char *counter_names[n_counters] = {
+    "records", "irm_accesses", "ird_accesses", "sched_pops", "max_sched_size", "bytes_written",
+};
+
+#ifdef TRACEGEN_STATS
+
+using clock_type = std::chrono::steady_clock;
+
+struct registry {
+    clock_type::time_point start = clock_type::now();
+    std::array<std::atomic<u64>, n_phases> ns{};
+    std::array<std::atomic<u64>, n_counters> counts{};
+};
+
+inline registry global;
+
+inline void add(counter c, u64 n) { global.counts[c].fetch_add(n, std::memory_order_relaxed); }
+
+inline void max(counter c, u64 n) {
+    auto &v = global.counts[c];
+    auto cur = v.load(std::memory_order_relaxed);
+    while (cur < n && !v.compare_exchange_weak(cur, n, std::memory_order_relaxed)) {
+    }
+}
+
+// Adds the time from construction to stop() (or destruction) to a phase.
+class timer {
+    phase p;
+    clock_type::time_point t0;
+    bool running = true;
+
+public:
+    explicit timer(phase p) : p(p), t0(clock_type::now()) {}
+    ~timer() { stop(); }
+
+    void stop() {
+        if (!running)
+            return;
+        running = false;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - t0).count();
+        global.ns[p].fetch_add((u64)ns, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Prints everything collected so far to stderr: format "text" is one line
+ * per value, "json" a single JSON object. Records/s is over the wall time
+ * since startup.
+ */
+inline void report(const str &format) {
+    if (format.empty())
+        return;
+    auto total = std::chrono::duration<f64>(clock_type::now() - global.start).count();
+    auto seconds = [](phase p) { return global.ns[p].load() / 1e9; };
+    auto rate = total > 0 ? global.counts[records].load() / total : 0.0;
+
+    if (format == "text") {
+        for (int p = 0; p < n_phases; p++)
+            fmt::print(stderr, "stats: {:<16} {:12.6f} s\n", phase_names[p], seconds((phase)p));
+        fmt::print(stderr, "stats: {:<16} {:12.6f} s\n", "total", total);
+        for (int c = 0; c < n_counters; c++)
+            fmt::print(stderr, "stats: {:<16} {:12}\n", counter_names[c], global.counts[c].load());
+        fmt::print(stderr, "stats: {:<16} {:12.0f}\n", "records_per_sec", rate);
+        return;
+    }
+    str s = "{\"phases\": {";
+    for (int p = 0; p < n_phases; p++)
+        s += fmt::format("{}\"{}\": {:.9f}", p ? ", " : "", phase_names[p], seconds((phase)p));
+    s += fmt::format("}}, \"total\": {:.9f}, \"counters\": {{", total);
+    for (int c = 0; c < n_counters; c++)
+        s += fmt::format("{}\"{}\": {}", c ? ", " : "", counter_names[c], global.counts[c].load());
+    s += fmt::format("}}, \"records_per_sec\": {:.1f}}}\n", rate);
+    fmt::print(stderr, "{}", s);
+}
+
+#else
+
+class timer {
+public:
+    explicit timer(phase) {}
+    void stop() {}
+};
+
+inline void add(counter, u64) {}
+inline void max(counter, u64) {}
+
+inline void report(const str &format) {
+    if (!format.empty())
+        fmt::print(stderr, "stats: not available, built without TRACEGEN_STATS (meson -Dstats=true)\n");
+}
+
+#endif // TRACEGEN_STATS
+
+} // namespace stats
+
+#endif // STATS_H
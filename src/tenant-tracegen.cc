@@ -0,0 +1,121 @@
+// tenant-tracegen: one trace of a shared cache from several tenants. Each
+// line of the --tenants manifest is a generator config in the libtracegen
+// parameter syntax plus rate=<relative request rate>; a tenant without a
+// seed= gets one derived from --seed. Every tenant's generator runs on its
+// own thread and the merged trace interleaves their requests by arrival
+// time, each tenant in its own address range (tenants in manifest order).
+//
+//   # tenants.txt
+//   addresses=1000000 p_irm=0.2 ird=c rate=3
+//   addresses=100000 p_irm=0.9 irm=zipf:0.8,10000 rwratio=0.5 rate=1
+//
+//   tenant-tracegen --tenants tenants.txt -n 100000000 --format packed -o shared.tgp
+
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <fstream>
+#include <iostream>
+#include "cli.h"
+#include "libtracegen.h"
+#include "rng.h"
+#include "stats.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+static vec<tracegen::tenant> read_tenants(const str &path, i64 seed) {
+    std::ifstream in(path);
+    ensure_fatal(in, "Cannot open tenant manifest {}", path);
+    vec<tracegen::tenant> tenants;
+    str line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        str params;
+        tracegen::tenant t;
+        bool seeded = false;
+        for (auto &item : split(line, " ")) {
+            if (item.empty())
+                continue;
+            if (item.starts_with("rate=")) {
+                auto value = item.substr(5);
+                char *end;
+                t.rate = std::strtod(value.c_str(), &end);
+                ensure_fatal(!value.empty() && *end == 0, "Invalid tenant rate: {}", value);
+                continue;
+            }
+            seeded |= item.starts_with("seed=");
+            params += (params.empty() ? "" : " ") + item;
+        }
+        if (params.empty())
+            continue;
+        t.cfg = tracegen::config::parse(params);
+        if (!seeded)
+            t.cfg.seed = (i64)derive_seed(seed, stream_tenant + tenants.size());
+        tenants.push_back(t);
+    }
+    return tenants;
+}
+
+int main(int argc, char **argv) {
+    stats::timer parse_timer(stats::parse);
+    str manifest, interleave;
+    i64 length, seed;
+    output_options out_opts;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Produce this message")
+        ("tenants,t", po::value<str>(&manifest)->required(),
+         "File with one tenant per line: a generator config (\"addresses=... p_irm=... ird=...\", as stored "
+         "in trace headers) and rate=<relative request rate>")
+        ("length,n", po::value<i64>(&length)->required(), "Length of the merged trace")
+        ("seed,s", po::value<i64>(&seed)->default_value(42), "Seed of the tenants without seed=")
+        ("interleave", po::value<str>(&interleave)->default_value("poisson"),
+         "Arrivals of each tenant at its rate: poisson (exponential gaps) or fixed (1 / rate apart)")
+    ;
+    add_output_options(desc, out_opts);
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: tenant-tracegen --tenants <file> -n <length> [options]\n" << desc << std::endl;
+            return 1;
+        }
+        po::notify(vm);
+    } catch (std::exception &e) {
+        fmt::print("Error: {}\n", e.what());
+        std::cout << desc << std::endl;
+        return 1;
+    }
+    ensure_fatal(length >= 0, "Invalid trace length: {}", length);
+    auto tenants = read_tenants(manifest, seed);
+    ensure_fatal(!tenants.empty(), "No tenants in {}", manifest);
+    parse_timer.stop();
+
+    f64 total_rate = 0;
+    for (auto &t : tenants)
+        total_rate += t.rate;
+    fmt::print("Generating trace of {} tenants with the following parameters:\nLength: {}\n", tenants.size(),
+               length);
+    i64 base = 0;
+    for (size_t i = 0; i < tenants.size(); i++) {
+        auto &c = tenants[i].cfg;
+        fmt::print("Tenant {}: offsets [{}, {}), {:.1f}% of requests, addresses={} p_irm={} ird={} irm={} "
+                   "seed={}\n",
+                   i, base, base + c.addresses * c.blocksize, 100 * tenants[i].rate / total_rate, c.addresses,
+                   c.p_irm, c.ird, c.irm, c.seed);
+        base += c.addresses * c.blocksize;
+    }
+
+    tracegen::generator gen(tenants, length, interleave);
+    // the combined footprint, so trace-analyze sees every tenant's addresses
+    auto params = fmt::format("{} addresses={} blocksize={}", params_string(vm), gen.params().addresses,
+                              gen.params().blocksize);
+    auto writer = open_writer(out_opts, length, seed, gen.params().blocksize, params);
+    tracegen::write_trace(gen, *writer);
+
+    stats::report(out_opts.stats);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "utils.h"
+
+/**
+ * Work-stealing pool of a fixed number of workers. Each worker owns a deque
+ * of tasks: it runs its own tasks from the back and, once its deque is
+ * empty, steals from the front of the others', so uneven tasks (traces of
+ * different lengths and footprints) keep every worker busy. submit() spreads
+ * tasks round-robin; wait() blocks until every submitted task has finished.
+ */
+class work_stealing_pool {
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    vec<std::unique_ptr<worker_queue>> queues;
+    vec<std::thread> workers;
+    std::atomic<u64> submitted{0}; // bumped on every submit, workers wait on it
+    std::atomic<u64> unfinished{0};
+    std::atomic<bool> stopping{false};
+
+    bool take(size_t self, std::function<void()> &task) {
+        {
+            auto &q = *queues[self];
+            std::lock_guard guard(q.lock);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            auto &q = *queues[(self + i) % queues.size()];
+            std::lock_guard guard(q.lock);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        std::function<void()> task;
+        for (;;) {
+            auto seen = submitted.load(std::memory_order_acquire);
+            if (take(self, task)) {
+                task();
+                task = nullptr;
+                if (unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    unfinished.notify_all();
+                continue;
+            }
+            if (stopping.load(std::memory_order_acquire))
+                return;
+            submitted.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+public:
+    explicit work_stealing_pool(size_t threads) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; i++)
+            queues.push_back(std::make_unique<worker_queue>());
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this, i] { run(i); });
+    }
+
+    work_stealing_pool(const work_stealing_pool &) = delete;
+    work_stealing_pool &operator=(const work_stealing_pool &) = delete;
+
+    ~work_stealing_pool() {
+        wait();
+        stopping.store(true, std::memory_order_release);
+        submitted.fetch_add(1, std::memory_order_release);
+        submitted.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    size_t size() const { return workers.size(); }
+
+    void submit(std::function<void()> task) {
+        auto n = submitted.load(std::memory_order_relaxed);
+        unfinished.fetch_add(1, std::memory_order_relaxed);
+        {
+            auto &q = *queues[n % queues.size()];
+            std::lock_guard guard(q.lock);
+            q.tasks.push_back(std::move(task));
+        }
+        submitted.fetch_add(1, std::memory_order_release);
+        submitted.notify_all();
+    }
+
+    void wait() {
+        for (auto n = unfinished.load(std::memory_order_acquire); n > 0;
+             n = unfinished.load(std::memory_order_acquire))
+            unfinished.wait(n, std::memory_order_acquire);
+    }
+};
+
+#endif // THREAD_POOL_H
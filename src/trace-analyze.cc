@@ -0,0 +1,443 @@
+// trace-analyze: single-pass statistics of a generated trace, to check that
+// it has the configured reuse and popularity structure.
+//
+// The trace (binary or text, both mmap'd, or packed, decoded block by block)
+// is cut into chunks of records. Chunks are analysed in parallel in batches
+// of one chunk per thread: each chunk's accesses are sorted by (block,
+// position), which gives every reuse inside the chunk and, per block, its
+// first and last position and access count. The batch is then merged by
+// block range, again one range per thread, against the global last-access
+// and count arrays, which resolves the reuses that cross chunk boundaries.
+// Stack distances are inherently sequential; one more thread feeds the
+// batch to stack_distances (mrc.h) while the others work.
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include <iostream>
+#include <thread>
+#include "libtracegen.h"
+#include "mrc.h"
+#include "trace-input.h"
+#include "tracefile.h"
+#include "tracepack.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+// Positions within a chunk are packed below the block address in one sort key.
+constexpr int pos_bits = 24;
+constexpr size_t max_chunk = (size_t)1 << pos_bits;
+constexpr i64 max_block = ((i64)1 << (64 - pos_bits)) - 1;
+constexpr i64 never = -1;
+
+struct access_run {
+    i64 block;
+    u64 first, last; // positions in the chunk
+    u64 count;
+};
+
+// One chunk of the trace and its local analysis.
+struct chunk {
+    i64 start = 0; // index of the first record in the trace
+    vec<i64> blocks;
+    vec<access_run> runs; // sorted by block
+    u64 writes = 0;
+    i64 max_block = -1;
+};
+
+struct group_stats {
+    u64 accesses = 0, distinct = 0, reuses = 0;
+    f64 reuse_sum = 0;
+};
+
+class analyzer {
+    i64 max_reuse;
+    i64 groups, addresses;
+    int threads;
+
+    // global, indexed by block; grown between batches
+    vec<i64> last_seen;
+    vec<u64> counts;
+
+    vec<vec<u64>> reuse_hist; // per thread, [max_reuse + 1] is the overflow bucket
+    vec<vec<group_stats>> group_acc;
+    stack_distances sd;
+    bool stack;
+    u64 total = 0, writes = 0;
+
+public:
+    analyzer(i64 max_reuse, i64 groups, i64 addresses, int threads, bool stack, f64 stack_sample)
+        : max_reuse(max_reuse), groups(groups), addresses(addresses), threads(threads),
+          reuse_hist(threads, vec<u64>(max_reuse + 2, 0)),
+          group_acc(threads, vec<group_stats>(std::max<i64>(groups, 1))), sd(stack_sample), stack(stack) {}
+
+    // Local pass over one chunk; runs on worker `t`.
+    void analyse(chunk &c, int t) {
+        auto n = c.blocks.size();
+        vec<u64> keys(n);
+        c.max_block = -1;
+        for (size_t i = 0; i < n; i++) {
+            auto b = c.blocks[i];
+            ensure_fatal(b >= 0 && b <= max_block, "Block address out of range: {}", b);
+            c.max_block = std::max(c.max_block, b);
+            keys[i] = ((u64)b << pos_bits) | i;
+        }
+        std::sort(keys.begin(), keys.end());
+        auto &hist = reuse_hist[t];
+        c.runs.clear();
+        for (size_t i = 0; i < n;) {
+            auto block = (i64)(keys[i] >> pos_bits);
+            access_run r{block, keys[i] & (max_chunk - 1), 0, 0};
+            auto prev = r.first;
+            for (; i < n && (i64)(keys[i] >> pos_bits) == block; i++) {
+                auto pos = keys[i] & (max_chunk - 1);
+                if (r.count++ > 0)
+                    record_reuse(hist, group_acc[t], block, pos - prev);
+                prev = pos;
+            }
+            r.last = prev;
+            c.runs.push_back(r);
+        }
+    }
+
+    // Merges blocks [lo, hi) of a batch of analysed chunks, in trace order.
+    void merge(std::span<chunk> batch, i64 lo, i64 hi, int t) {
+        auto &hist = reuse_hist[t];
+        auto &gs = group_acc[t];
+        for (auto &c : batch) {
+            auto it = std::lower_bound(c.runs.begin(), c.runs.end(), lo,
+                                       [](const access_run &r, i64 b) { return r.block < b; });
+            for (; it != c.runs.end() && it->block < hi; ++it) {
+                auto &last = last_seen[it->block];
+                if (last != never)
+                    record_reuse(hist, gs, it->block, (u64)(c.start + it->first - last));
+                else
+                    gs[group_of(it->block)].distinct++;
+                last = c.start + it->last;
+                counts[it->block] += it->count;
+                gs[group_of(it->block)].accesses += it->count;
+            }
+        }
+    }
+
+    void run_batch(std::span<chunk> batch) {
+        vec<std::thread> workers;
+        for (size_t i = 0; i < batch.size(); i++)
+            workers.emplace_back([&, i] { analyse(batch[i], i); });
+        std::thread stack_worker;
+        if (stack)
+            stack_worker = std::thread([&] {
+                for (auto &c : batch)
+                    for (auto b : c.blocks)
+                        sd.access(b);
+            });
+        for (auto &w : workers)
+            w.join();
+        workers.clear();
+
+        i64 top = -1;
+        for (auto &c : batch) {
+            top = std::max(top, c.max_block);
+            total += c.blocks.size();
+            writes += c.writes;
+        }
+        if (top >= (i64)last_seen.size()) {
+            auto size = std::max<size_t>(top + 1, last_seen.size() * 3 / 2);
+            last_seen.resize(size, never);
+            counts.resize(size, 0);
+        }
+        i64 span = (top + threads) / threads;
+        for (int t = 0; t < threads; t++)
+            workers.emplace_back([&, t] { merge(batch, t * span, std::min<i64>((t + 1) * span, top + 1), t); });
+        for (auto &w : workers)
+            w.join();
+        if (stack_worker.joinable())
+            stack_worker.join();
+    }
+
+    void report(const str &prefix, i64 top) const;
+
+private:
+    i64 group_of(i64 block) const {
+        if (groups <= 1)
+            return 0;
+        return std::min<i64>(block / std::max<i64>(addresses / groups, 1), groups - 1);
+    }
+
+    void record_reuse(vec<u64> &hist, vec<group_stats> &gs, i64 block, u64 d) const {
+        hist[std::min<u64>(d, max_reuse + 1)]++;
+        auto &g = gs[group_of(block)];
+        g.reuses++;
+        g.reuse_sum += d;
+    }
+};
+
+static FILE *open_out(const str &path) {
+    FILE *f = std::fopen(path.c_str(), "w");
+    ensure_fatal(f, "Cannot open output file {}: {}", path, std::strerror(errno));
+    return f;
+}
+
+void analyzer::report(const str &prefix, i64 top) const {
+    vec<u64> hist(max_reuse + 2, 0);
+    for (auto &h : reuse_hist)
+        for (size_t d = 0; d < h.size(); d++)
+            hist[d] += h[d];
+    vec<group_stats> gs(group_acc[0].size());
+    for (auto &acc : group_acc)
+        for (size_t g = 0; g < gs.size(); g++) {
+            gs[g].accesses += acc[g].accesses;
+            gs[g].distinct += acc[g].distinct;
+            gs[g].reuses += acc[g].reuses;
+            gs[g].reuse_sum += acc[g].reuse_sum;
+        }
+    u64 distinct = 0, reuses = 0;
+    f64 reuse_sum = 0;
+    for (auto &g : gs) {
+        distinct += g.distinct;
+        reuses += g.reuses;
+        reuse_sum += g.reuse_sum;
+    }
+
+    auto f = open_out(prefix + ".reuse");
+    fmt::print(f, "# reuse_time count (accesses since the previous access to the block)\n");
+    for (i64 d = 1; d <= max_reuse; d++)
+        if (hist[d])
+            fmt::print(f, "{} {}\n", d, hist[d]);
+    if (hist[max_reuse + 1])
+        fmt::print(f, "# longer than {}: {}\n", max_reuse, hist[max_reuse + 1]);
+    std::fclose(f);
+
+    if (stack) {
+        f = open_out(prefix + ".stack");
+        fmt::print(f, "# stack_distance count (cold misses: {})\n", sd.cold_misses());
+        sd.each_distance([&](u64 d, u64 count) { fmt::print(f, "{} {}\n", d, count); });
+        std::fclose(f);
+    }
+
+    f = open_out(prefix + ".popularity");
+    if (top > 0) {
+        vec<std::pair<u64, i64>> ranked;
+        for (size_t b = 0; b < counts.size(); b++)
+            if (counts[b])
+                ranked.push_back({counts[b], (i64)b});
+        auto k = std::min<size_t>(top, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(),
+                          [](auto &a, auto &b) { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+        fmt::print(f, "# block count (top {})\n", k);
+        for (size_t i = 0; i < k; i++)
+            fmt::print(f, "{} {}\n", ranked[i].second, ranked[i].first);
+    } else {
+        fmt::print(f, "# block count\n");
+        for (size_t b = 0; b < counts.size(); b++)
+            if (counts[b])
+                fmt::print(f, "{} {}\n", b, counts[b]);
+    }
+    std::fclose(f);
+
+    fmt::print("records: {}\n", total);
+    fmt::print("writes: {} ({:.4f})\n", writes, total ? (f64)writes / total : 0.0);
+    fmt::print("distinct blocks: {}\n", distinct);
+    fmt::print("mean reuse time: {:.2f}\n", reuses ? reuse_sum / reuses : 0.0);
+    if (stack)
+        fmt::print("stack distance: {} tracked, {} cold\n", sd.tracked(), sd.cold_misses());
+    if (groups > 1) {
+        f = open_out(prefix + ".groups");
+        fmt::print(f, "# group accesses fraction distinct mean_reuse_time\n");
+        for (size_t g = 0; g < gs.size(); g++)
+            fmt::print(f, "{} {} {:.6f} {} {:.2f}\n", g, gs[g].accesses, total ? (f64)gs[g].accesses / total : 0.0,
+                       gs[g].distinct, gs[g].reuses ? gs[g].reuse_sum / gs[g].reuses : 0.0);
+        std::fclose(f);
+        for (size_t g = 0; g < gs.size(); g++)
+            fmt::print("group {}: {} accesses ({:.4f}), {} distinct, mean reuse time {:.2f}\n", g,
+                       gs[g].accesses, total ? (f64)gs[g].accesses / total : 0.0, gs[g].distinct,
+                       gs[g].reuses ? gs[g].reuse_sum / gs[g].reuses : 0.0);
+    }
+}
+
+static void parse_text(std::string_view text, i64 blocksize, chunk &c) {
+    c.blocks.clear();
+    c.writes = 0;
+    parse_text_records(text, [&](i64 op, i64, i64 offset) {
+        c.blocks.push_back(offset / blocksize);
+        c.writes += op != 0;
+    });
+}
+
+int main(int argc, char **argv) {
+    str input, output, format;
+    i64 blocksize = 0, groups = 0, addresses = 0, max_reuse, top, chunk_records;
+    int threads;
+    f64 stack_sample;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Produce this message")
+        ("input", po::value<str>(&input)->required(), "Trace file (binary or text)")
+        ("output,o", po::value<str>(&output), "Prefix of the output files (default: the input path)")
+        ("format", po::value<str>(&format)->default_value("auto"), "Input format: auto, bin, packed or text")
+        ("blocksize,b", po::value<i64>(&blocksize),
+         "Block size in bytes (default: from the binary header, else 4096)")
+        ("groups,k", po::value<i64>(&groups),
+         "kd-tracegen groups for per-group stats (default: from the binary header)")
+        ("addresses,m", po::value<i64>(&addresses),
+         "Footprint used to partition groups (default: from the binary header)")
+        ("threads", po::value<int>(&threads)->default_value(std::max(1u, std::thread::hardware_concurrency())),
+         "Worker threads")
+        ("chunk", po::value<i64>(&chunk_records)->default_value(1 << 22), "Records per chunk")
+        ("max-reuse", po::value<i64>(&max_reuse)->default_value(1 << 20),
+         "Largest reuse time with its own histogram bucket")
+        ("stack-sample", po::value<f64>(&stack_sample)->default_value(1),
+         "SHARDS sampling rate for stack distances (1 = exact)")
+        ("no-stack", "Skip stack distances (the only sequential part of the analysis)")
+        ("top", po::value<i64>(&top)->default_value(0),
+         "Write only the N most popular blocks, by count (0 = every block, by address)")
+    ;
+    po::positional_options_description pos;
+    pos.add("input", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: trace-analyze [options] <trace>\n" << desc << std::endl;
+            return 1;
+        }
+        po::notify(vm);
+    } catch (std::exception &e) {
+        fmt::print("Error: {}\n", e.what());
+        std::cout << "Usage: trace-analyze [options] <trace>\n" << desc << std::endl;
+        return 1;
+    }
+    if (output.empty())
+        output = input;
+    ensure_fatal(threads > 0, "Invalid number of threads: {}", threads);
+    ensure_fatal(chunk_records > 0 && (size_t)chunk_records <= max_chunk, "Chunk size must be in [1, {}]",
+                 max_chunk);
+    ensure_fatal(max_reuse > 0, "Invalid max-reuse: {}", max_reuse);
+
+    if (format == "auto")
+        format = detect_format(input);
+    ensure_fatal(format == "bin" || format == "packed" || format == "text", "Invalid input format: {}", format);
+
+    std::unique_ptr<tracefile::reader> bin;
+    std::unique_ptr<tracepack::reader> packed;
+    std::unique_ptr<text_file> text;
+    if (format == "bin" || format == "packed") {
+        try {
+            if (format == "bin")
+                bin = std::make_unique<tracefile::reader>(input);
+            else
+                packed = std::make_unique<tracepack::reader>(input);
+        } catch (std::exception &e) {
+            log_fatal("{}", e.what());
+        }
+        // the generator parameters are in the header
+        auto cfg = tracegen::config::parse(str(bin ? bin->params() : packed->params()));
+        if (!vm.count("blocksize"))
+            blocksize = cfg.blocksize;
+        if (!vm.count("groups"))
+            groups = cfg.groups;
+        if (!vm.count("addresses"))
+            addresses = cfg.addresses;
+    } else {
+        text = std::make_unique<text_file>(input);
+    }
+    if (blocksize == 0)
+        blocksize = 4096;
+    ensure_fatal(blocksize > 0, "Invalid blocksize: {}", blocksize);
+    ensure_fatal(groups <= 1 || addresses > 0, "Per-group stats need --addresses");
+
+    analyzer an(max_reuse, groups, addresses, threads, !vm.count("no-stack"), stack_sample);
+    vec<chunk> batch(threads);
+    i64 next = 0;
+
+    if (bin) {
+        auto records = bin->records();
+        while ((size_t)next < records.size()) {
+            size_t used = 0;
+            for (; used < batch.size() && (size_t)next < records.size(); used++) {
+                auto &c = batch[used];
+                auto n = std::min<size_t>(chunk_records, records.size() - next);
+                c.start = next;
+                c.blocks.resize(n);
+                c.writes = 0;
+                for (size_t i = 0; i < n; i++) {
+                    auto r = tracefile::to_le(records[next + i]);
+                    c.blocks[i] = (i64)(r.offset / blocksize);
+                    c.writes += r.op != 0;
+                }
+                next += n;
+            }
+            an.run_batch(std::span(batch).first(used));
+        }
+    } else if (packed) {
+        // blocks decode sequentially; records are regrouped into chunks
+        vec<tracefile::record> block;
+        size_t at = 0;
+        bool more = true;
+        while (more) {
+            size_t used = 0;
+            for (; used < batch.size() && more; used++) {
+                auto &c = batch[used];
+                c.start = next;
+                c.blocks.clear();
+                c.writes = 0;
+                while (c.blocks.size() < (size_t)chunk_records) {
+                    if (at == block.size()) {
+                        try {
+                            more = packed->next(block);
+                        } catch (std::exception &e) {
+                            log_fatal("{}", e.what());
+                        }
+                        at = 0;
+                        if (!more)
+                            break;
+                    }
+                    auto n = std::min(block.size() - at, chunk_records - c.blocks.size());
+                    for (size_t i = at; i < at + n; i++) {
+                        c.blocks.push_back((i64)(block[i].offset / blocksize));
+                        c.writes += block[i].op != 0;
+                    }
+                    at += n;
+                }
+                next += c.blocks.size();
+                if (c.blocks.empty())
+                    break;
+            }
+            if (used > 0)
+                an.run_batch(std::span(batch).first(used));
+        }
+    } else {
+        auto data = text->data();
+        // chunks are byte ranges ending at a newline; a record line is at
+        // least 6 bytes, so a range holds at most chunk_records records
+        const size_t chunk_bytes = chunk_records * 6;
+        size_t off = 0;
+        vec<std::string_view> ranges;
+        while (off < data.size()) {
+            off = split_text(data, off, chunk_bytes, batch.size(), ranges);
+            vec<std::thread> parsers;
+            for (size_t i = 0; i < ranges.size(); i++)
+                parsers.emplace_back([&, i] { parse_text(ranges[i], blocksize, batch[i]); });
+            for (auto &t : parsers)
+                t.join();
+            size_t used = 0;
+            for (size_t i = 0; i < ranges.size(); i++) {
+                ensure_fatal(batch[i].blocks.size() <= max_chunk, "Text chunk has too many records");
+                batch[i].start = next;
+                next += batch[i].blocks.size();
+                if (!batch[i].blocks.empty())
+                    std::swap(batch[used++], batch[i]);
+            }
+            an.run_batch(std::span(batch).first(used));
+        }
+    }
+
+    an.report(output, top);
+    return 0;
+}
@@ -0,0 +1,625 @@
+// trace-fit: generator parameters that reproduce a block trace. One pass
+// over the trace (binary or text, both mmap'd, or packed, decoded block by
+// block) measures its reuse times, block popularity, op mix and request
+// sizes, and fits them to the generator's model:
+//
+//   - the IRD as irdgen's fgen:k:epsilon:spikes. Reuse times are binned on
+//     k steps, the last at a high quantile, since the generator reproduces
+//     the shape of the IRD and the footprint sets its scale. The spikes are
+//     the bins well above the median bin, and epsilon the ratio between the
+//     two levels;
+//   - p_irm and a zipf:alpha,n IRM. IRD accesses spread evenly over the
+//     footprint, so, ranked by popularity, the mean access count of each of
+//     n classes is a uniform floor plus p_irm times the class's Zipf weight,
+//     a linear least-squares fit in p_irm for each alpha on a grid;
+//   - rwratio and sizedist from the op and size counts;
+//
+// or, with --groups K, kd-tracegen's per-group IRDs and popularities, the
+// groups being K equal slices of the blocks ranked by popularity.
+//
+// Reuses are tracked in hash maps, one per thread, so sparse production
+// block numbers cost memory by distinct block only. Each batch of chunks is
+// partitioned by block hash, one chunk per thread, and each thread then
+// replays its partition of every chunk, in trace order, against its own map:
+// no block is shared between threads and nothing is locked. Each reuse is
+// filed by the block's mean interval before it, which is independent of the
+// reuse itself under the IRD model; the IRD is fitted to the reuses of
+// blocks that IRM draws barely touch, and groups to their own intervals.
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cmath>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+#include "histogram.h"
+#include "libtracegen.h"
+#include "trace-input.h"
+#include "trace-stream.h"
+#include "tracefile.h"
+#include "tracepack.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+// Reuses are filed by the block's mean interval so far, in quarter-octaves;
+// the last bucket holds those of blocks seen fewer than `settled` times,
+// whose mean interval is too noisy to tell their group.
+constexpr size_t interval_buckets = 256;
+constexpr size_t young = interval_buckets;
+constexpr u64 settled = 8;
+
+inline size_t interval_bucket(f64 interval) {
+    int e = std::ilogb(interval);
+    auto m = std::scalbn(interval, -e);
+    int b = 4 * e + (m >= 1.189207115) + (m >= M_SQRT2) + (m >= 1.681792831);
+    return std::clamp<int>(b, 0, interval_buckets - 1);
+}
+
+inline f64 bucket_middle(size_t b) { return std::exp2((b + 0.5) / 4); }
+
+inline u64 mix(u64 x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Open-addressing (linear probing) map from block to its accesses so far.
+class block_map {
+public:
+    struct entry {
+        u64 block, first, last, count;
+    };
+
+private:
+    static constexpr u64 empty = ~0ULL;
+    vec<entry> slots = vec<entry>(1 << 12, entry{empty, 0, 0, 0});
+    size_t used = 0;
+
+    void grow() {
+        vec<entry> old(slots.size() * 2, entry{empty, 0, 0, 0});
+        old.swap(slots);
+        auto mask = slots.size() - 1;
+        for (auto &e : old)
+            if (e.block != empty) {
+                auto i = mix(e.block) & mask;
+                while (slots[i].block != empty)
+                    i = (i + 1) & mask;
+                slots[i] = e;
+            }
+    }
+
+public:
+    // The entry of block (h = mix(block)), added with count 0 if new.
+    entry &get(u64 block, u64 h) {
+        if (10 * (used + 1) > 7 * slots.size())
+            grow();
+        auto mask = slots.size() - 1;
+        for (auto i = h & mask;; i = (i + 1) & mask) {
+            auto &e = slots[i];
+            if (e.block == block)
+                return e;
+            if (e.block == empty) {
+                e = {block, 0, 0, 0};
+                used++;
+                return e;
+            }
+        }
+    }
+
+    size_t size() const { return used; }
+
+    template <typename F>
+    void each(F &&f) const {
+        for (auto &e : slots)
+            if (e.block != empty)
+                f(e);
+    }
+};
+
+struct block_access {
+    u64 block, hash;
+    uint32_t index; // in the chunk
+};
+
+// One chunk of the trace: its records (mapped, or decoded/parsed into
+// `records`), then its accesses partitioned by shard.
+struct chunk {
+    u64 start = 0; // index of the first record in the trace
+    std::span<const tracefile::record> mapped;
+    std::string_view text;
+    vec<trace_record> records;
+    vec<vec<block_access>> parts;
+    u64 writes = 0;
+    std::unordered_map<i64, u64> sizes; // in blocks
+};
+
+struct shard {
+    block_map blocks;
+    vec<log_histogram> reuse = vec<log_histogram>(interval_buckets + 1);
+};
+
+class fitter {
+    i64 blocksize;
+    int threads;
+    vec<shard> shards;
+
+public:
+    u64 total = 0, writes = 0;
+    std::map<i64, u64> sizes;
+
+    fitter(i64 blocksize, int threads) : blocksize(blocksize), threads(threads), shards(threads) {}
+
+    // Partitions the accesses of chunk c by the shard of their block.
+    void partition(chunk &c) {
+        c.parts.assign(threads, {});
+        c.writes = 0;
+        c.sizes.clear();
+        auto add = [&](i64 op, i64 size, i64 offset, uint32_t index) {
+            ensure_fatal(offset >= 0 && size >= 0, "Invalid record: {} {} {}", op, size, offset);
+            u64 block = offset / blocksize, h = mix(block);
+            c.parts[((unsigned __int128)h * threads) >> 64].push_back({block, h, index});
+            c.writes += op != 0;
+            c.sizes[std::max<i64>(1, (size + blocksize - 1) / blocksize)]++;
+        };
+        if (!c.text.empty()) {
+            c.records.clear();
+            parse_text_records(c.text,
+                               [&](i64 op, i64 size, i64 offset) { c.records.push_back({op, size, offset}); });
+        }
+        if (!c.mapped.empty()) {
+            for (size_t i = 0; i < c.mapped.size(); i++) {
+                auto r = tracefile::to_le(c.mapped[i]);
+                add(r.op, r.size, r.offset, i);
+            }
+        } else {
+            for (size_t i = 0; i < c.records.size(); i++)
+                add(c.records[i].op, c.records[i].size, c.records[i].offset, i);
+        }
+    }
+
+    size_t records(const chunk &c) const { return c.mapped.empty() ? c.records.size() : c.mapped.size(); }
+
+    // Replays shard s's accesses of the batch in trace order.
+    void replay(std::span<chunk> batch, int s) {
+        auto &sh = shards[s];
+        for (auto &c : batch)
+            for (auto &a : c.parts[s]) {
+                auto pos = c.start + a.index;
+                auto &e = sh.blocks.get(a.block, a.hash);
+                if (e.count == 0) {
+                    e.first = pos;
+                } else {
+                    auto bucket =
+                        e.count >= settled ? interval_bucket((f64)(e.last - e.first) / (e.count - 1)) : young;
+                    sh.reuse[bucket].add(pos - e.last);
+                }
+                e.last = pos;
+                e.count++;
+            }
+    }
+
+    void run_batch(std::span<chunk> batch) {
+        vec<std::thread> workers;
+        for (size_t i = 0; i < batch.size(); i++)
+            workers.emplace_back([&, i] { partition(batch[i]); });
+        for (auto &w : workers)
+            w.join();
+        workers.clear();
+        for (auto &c : batch) {
+            c.start = total;
+            total += records(c);
+            writes += c.writes;
+            for (auto [size, n] : c.sizes)
+                sizes[size] += n;
+        }
+        for (int s = 0; s < threads; s++)
+            workers.emplace_back([&, s] { replay(batch, s); });
+        for (auto &w : workers)
+            w.join();
+    }
+
+    u64 distinct() const {
+        u64 n = 0;
+        for (auto &sh : shards)
+            n += sh.blocks.size();
+        return n;
+    }
+
+    // Number of blocks by access count.
+    std::map<u64, u64> count_frequencies() const {
+        vec<std::unordered_map<u64, u64>> per(shards.size());
+        vec<std::thread> workers;
+        for (size_t s = 0; s < shards.size(); s++)
+            workers.emplace_back([&, s] { shards[s].blocks.each([&](auto &e) { per[s][e.count]++; }); });
+        for (auto &w : workers)
+            w.join();
+        std::map<u64, u64> freq;
+        for (auto &m : per)
+            for (auto [count, n] : m)
+                freq[count] += n;
+        return freq;
+    }
+
+    // Reuse times of the interval buckets for which keep(bucket) holds.
+    template <typename F>
+    log_histogram reuses(F &&keep) const {
+        log_histogram h;
+        for (auto &sh : shards)
+            for (size_t b = 0; b <= interval_buckets; b++)
+                if (keep(b))
+                    h.merge(sh.reuse[b]);
+        return h;
+    }
+};
+
+// === Fitting ===
+
+struct ird_fit {
+    int k;
+    f64 epsilon;
+    vec<int> spikes;
+    f64 step;      // reuse time per IRD step
+    f64 distance;  // total variation between the fitted and the measured step distribution
+
+    str spec() const {
+        vec<str> s;
+        for (auto x : spikes)
+            s.push_back(std::to_string(x));
+        return fmt::format("fgen:{}:{:.6g}:{}", k, epsilon, fmt::join(s, ","));
+    }
+};
+
+// fgen:k:epsilon:spikes for the reuse times in h; spikes > 0 fixes their number.
+static ird_fit fit_ird(const log_histogram &h, int k, int spikes, f64 quantile) {
+    ird_fit fit{k, 0, {}, 1, 0};
+    vec<f64> mass(k, 0);
+    // step k - 1 at the quantile; each bucket's count spread over the steps its range covers
+    fit.step = std::max<f64>(1, (f64)h.percentile(quantile) / std::max(k - 1, 1));
+    h.each([&](u64 lo, u64 hi, u64 n) {
+        f64 a = ((f64)lo - 0.5) / fit.step + 0.5, b = ((f64)hi - 0.5) / fit.step + 0.5;
+        for (int d = std::max<int>(0, (int)a); d < k && d < b; d++)
+            mass[d] += n * (std::min<f64>(b, d + 1) - std::max<f64>(a, d)) / (b - a);
+        if (b > k)
+            mass[k - 1] += n * (b - std::max<f64>(a, k)) / (b - a);
+    });
+    auto sum = std::accumulate(mass.begin(), mass.end(), 0.0);
+    if (sum > 0)
+        for (auto &m : mass)
+            m /= sum;
+
+    vec<int> order(k);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return mass[a] > mass[b]; });
+    // spikes: fgen gives them all the same mass, so bins near the top one,
+    // and well above the median
+    auto median = mass[order[k / 2]], top = mass[order[0]];
+    auto threshold = std::max(top / 4, std::sqrt(top * std::max(median, 1e-12)));
+    for (int i = 0; i < k; i++)
+        if (spikes > 0 ? i < spikes : (i == 0 || (mass[order[i]] > threshold && top > 3 * median)))
+            fit.spikes.push_back(order[i]);
+    std::sort(fit.spikes.begin(), fit.spikes.end());
+
+    // the levels: the median of the other bins, as IRM draws that split
+    // intervals raise the bins below the spikes
+    f64 spike_mass = 0;
+    vec<f64> others;
+    for (int d = 0; d < k; d++)
+        if (std::binary_search(fit.spikes.begin(), fit.spikes.end(), d))
+            spike_mass += mass[d];
+        else
+            others.push_back(mass[d]);
+    if (!others.empty() && spike_mass > 0) {
+        std::nth_element(others.begin(), others.begin() + others.size() / 2, others.end());
+        auto ratio = others[others.size() / 2] / (spike_mass / fit.spikes.size());
+        fit.epsilon = std::clamp(ratio / (1 + ratio), 1e-9, 0.5);
+    } else {
+        fit.epsilon = 0.5;
+    }
+
+    // the distribution irdgen builds from the fit
+    vec<f64> w(k, fit.epsilon);
+    for (auto d : fit.spikes)
+        w[d] = 1 - fit.epsilon;
+    auto wsum = std::accumulate(w.begin(), w.end(), 0.0);
+    for (int d = 0; d < k; d++)
+        fit.distance += std::abs(w[d] / wsum - mass[d]) / 2;
+    return fit;
+}
+
+struct irm_fit {
+    f64 p = 0, alpha = 1;
+    int classes;
+    f64 rms = 0; // of the fitted class means, relative to the mean count
+};
+
+// Mean access count of n equal classes of blocks ranked by popularity.
+static vec<std::pair<u64, f64>> rank_classes(const std::map<u64, u64> &freq, u64 blocks, int n) {
+    vec<std::pair<u64, f64>> classes; // (blocks, accesses)
+    u64 per = blocks / n;
+    classes.push_back({0, 0});
+    for (auto it = freq.rbegin(); it != freq.rend(); ++it) {
+        auto [count, left] = *it;
+        while (left > 0) {
+            auto &c = classes.back();
+            auto cap = classes.size() == (size_t)n ? left : per - c.first;
+            auto take = std::min(left, cap);
+            c.first += take;
+            c.second += (f64)take * count;
+            left -= take;
+            if (c.first == per && classes.size() < (size_t)n)
+                classes.push_back({0, 0});
+        }
+    }
+    return classes;
+}
+
+// Accesses of class c are a floor (1 - p) / blocks plus p w_c / size_c per
+// block, so y_c = mean_c * blocks / total - 1 = p x_c with x_c = w_c * blocks / size_c - 1.
+static irm_fit fit_irm(const std::map<u64, u64> &freq, u64 blocks, u64 total, int n) {
+    irm_fit best{0, 1, n, std::numeric_limits<f64>::max()};
+    n = (int)std::min<u64>(n, blocks);
+    best.classes = n;
+    auto classes = rank_classes(freq, blocks, n);
+    vec<f64> y;
+    for (auto [size, accesses] : classes)
+        y.push_back(size ? accesses / size * blocks / total - 1 : 0);
+    // ranking alone makes the class means fall off, evenly about the floor;
+    // an IRM lifts the top classes well above it, the floor being 1 - p_irm
+    if (n < 2 || y[0] < 2 * std::abs(y[n - 1])) {
+        best.rms = 0;
+        for (auto v : y)
+            best.rms += v * v;
+        best.rms = std::sqrt(best.rms / n);
+        return best;
+    }
+    for (f64 alpha = 0.05; alpha <= 4.0001; alpha += 0.01) {
+        f64 h = 0;
+        for (int c = 1; c <= n; c++)
+            h += std::pow(c, -alpha);
+        vec<f64> x(n);
+        f64 xx = 0, xy = 0;
+        for (int c = 0; c < n; c++) {
+            x[c] = classes[c].first ? std::pow(c + 1, -alpha) / h * blocks / classes[c].first - 1 : 0;
+            xx += x[c] * x[c];
+            xy += x[c] * y[c];
+        }
+        auto p = xx > 0 ? std::clamp(xy / xx, 0.0, 1.0) : 0.0;
+        f64 sse = 0;
+        for (int c = 0; c < n; c++)
+            sse += (y[c] - p * x[c]) * (y[c] - p * x[c]);
+        if (sse < best.rms) {
+            best.rms = sse;
+            best.p = p;
+            best.alpha = alpha;
+        }
+    }
+    best.rms = std::sqrt(best.rms / n);
+    return best;
+}
+
+static str sizedist_spec(const std::map<i64, u64> &sizes, u64 total) {
+    vec<std::pair<u64, i64>> ranked;
+    for (auto [size, n] : sizes)
+        ranked.push_back({n, size});
+    std::sort(ranked.rbegin(), ranked.rend());
+    ranked.resize(std::min<size_t>(ranked.size(), 16)); // the rest are renormalised away
+    std::sort(ranked.begin(), ranked.end(), [](auto &a, auto &b) { return a.second < b.second; });
+    vec<str> w, s;
+    for (auto [n, size] : ranked) {
+        w.push_back(fmt::format("{:.4g}", (f64)n / total));
+        s.push_back(std::to_string(size));
+    }
+    if (ranked.empty())
+        return "1:1";
+    return fmt::format("{}:{}", fmt::join(w, ","), fmt::join(s, ","));
+}
+
+int main(int argc, char **argv) {
+    str input, format, output;
+    i64 blocksize = 0, chunk_records;
+    int threads, k, spikes, classes, groups;
+    f64 quantile;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Produce this message")
+        ("input", po::value<str>(&input)->required(), "Trace file (binary, packed or text)")
+        ("format", po::value<str>(&format)->default_value("auto"), "Input format: auto, bin, packed or text")
+        ("blocksize,b", po::value<i64>(&blocksize),
+         "Block size in bytes (default: from the binary header, else 4096)")
+        ("threads", po::value<int>(&threads)->default_value(std::max(1u, std::thread::hardware_concurrency())),
+         "Worker threads")
+        ("chunk", po::value<i64>(&chunk_records)->default_value(1 << 20), "Records per chunk")
+        ("ird-classes", po::value<int>(&k)->default_value(20), "k of the fitted fgen IRD")
+        ("spikes", po::value<int>(&spikes)->default_value(0), "Number of IRD spikes (0: chosen from the data)")
+        ("quantile", po::value<f64>(&quantile)->default_value(0.999),
+         "Reuse-time quantile mapped to the last IRD step")
+        ("irm-classes", po::value<int>(&classes)->default_value(20), "n of the fitted zipf:alpha,n IRM")
+        ("groups,k", po::value<int>(&groups)->default_value(0),
+         "Fit kd-tracegen with this many groups instead of the trace-gen IRD/IRM mix")
+        ("output,o", po::value<str>(&output),
+         "Also write the fitted config (libtracegen/trace-sweep syntax) to this file")
+    ;
+    po::positional_options_description pos;
+    pos.add("input", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: trace-fit [options] <trace>\n" << desc << std::endl;
+            return 1;
+        }
+        po::notify(vm);
+    } catch (std::exception &e) {
+        fmt::print("Error: {}\n", e.what());
+        std::cout << "Usage: trace-fit [options] <trace>\n" << desc << std::endl;
+        return 1;
+    }
+    ensure_fatal(threads > 0, "Invalid number of threads: {}", threads);
+    ensure_fatal(chunk_records > 0 && chunk_records <= (i64)UINT32_MAX, "Invalid chunk size: {}", chunk_records);
+    ensure_fatal(k > 1, "Invalid number of IRD classes: {}", k);
+    ensure_fatal(classes > 0, "Invalid number of IRM classes: {}", classes);
+    ensure_fatal(spikes >= 0 && spikes < k, "Invalid number of spikes: {}", spikes);
+    ensure_fatal(quantile > 0 && quantile <= 1, "Invalid quantile: {}", quantile);
+    ensure_fatal(groups >= 0, "Invalid number of groups: {}", groups);
+
+    if (format == "auto")
+        format = detect_format(input);
+    ensure_fatal(format == "bin" || format == "packed" || format == "text", "Invalid input format: {}", format);
+    std::unique_ptr<tracefile::reader> bin;
+    std::unique_ptr<tracepack::reader> packed;
+    std::unique_ptr<text_file> text;
+    try {
+        if (format == "bin")
+            bin = std::make_unique<tracefile::reader>(input);
+        else if (format == "packed")
+            packed = std::make_unique<tracepack::reader>(input);
+        else
+            text = std::make_unique<text_file>(input);
+    } catch (std::exception &e) {
+        log_fatal("{}", e.what());
+    }
+    if (!vm.count("blocksize"))
+        blocksize = bin || packed ? tracegen::config::parse(str(bin ? bin->params() : packed->params())).blocksize
+                                  : 4096;
+    ensure_fatal(blocksize > 0, "Invalid blocksize: {}", blocksize);
+
+    fitter fit(blocksize, threads);
+    vec<chunk> batch(threads);
+    if (bin) {
+        auto records = bin->records();
+        for (size_t next = 0; next < records.size();) {
+            size_t used = 0;
+            for (; used < batch.size() && next < records.size(); used++) {
+                auto n = std::min<size_t>(chunk_records, records.size() - next);
+                batch[used].mapped = records.subspan(next, n);
+                next += n;
+            }
+            fit.run_batch(std::span(batch).first(used));
+        }
+    } else if (packed) {
+        vec<tracefile::record> block;
+        size_t at = 0;
+        bool more = true;
+        while (more) {
+            size_t used = 0;
+            for (; used < batch.size() && more; used++) {
+                auto &c = batch[used];
+                c.records.clear();
+                while (c.records.size() < (size_t)chunk_records) {
+                    if (at == block.size()) {
+                        try {
+                            more = packed->next(block);
+                        } catch (std::exception &e) {
+                            log_fatal("{}", e.what());
+                        }
+                        at = 0;
+                        if (!more)
+                            break;
+                    }
+                    auto n = std::min(block.size() - at, chunk_records - c.records.size());
+                    for (size_t i = at; i < at + n; i++)
+                        c.records.push_back({(i64)block[i].op, (i64)block[i].size, (i64)block[i].offset});
+                    at += n;
+                }
+                if (c.records.empty())
+                    break;
+            }
+            if (used > 0)
+                fit.run_batch(std::span(batch).first(used));
+        }
+    } else {
+        // a record line is at least 6 bytes, so a range holds at most chunk_records records
+        auto data = text->data();
+        vec<std::string_view> ranges;
+        for (size_t off = 0; off < data.size();) {
+            off = split_text(data, off, chunk_records * 6, batch.size(), ranges);
+            for (size_t i = 0; i < ranges.size(); i++)
+                batch[i].text = ranges[i];
+            fit.run_batch(std::span(batch).first(ranges.size()));
+        }
+    }
+
+    auto total = fit.total, blocks = fit.distinct();
+    ensure_fatal(total > 0 && blocks > 0, "No records in {}", input);
+    auto freq = fit.count_frequencies();
+    auto rwratio = 1 - (f64)fit.writes / total;
+    auto sizedist = sizedist_spec(fit.sizes, total);
+    fmt::print("records: {}\ndistinct blocks: {}\nreads: {:.4f}\n", total, blocks, rwratio);
+
+    str config, command;
+    if (groups == 0) {
+        auto irm = fit_irm(freq, blocks, total, classes);
+        // blocks IRM draws barely touch: mean interval near the IRD-only one, blocks / (1 - p)
+        auto ird_interval = blocks / std::max(1 - irm.p, 1e-3);
+        auto reuses =
+            fit.reuses([&](size_t b) { return b < interval_buckets && bucket_middle(b) >= 0.9 * ird_interval; });
+        auto all = fit.reuses([](size_t) { return true; });
+        if (reuses.count() < std::max<u64>(10000, all.count() / 100))
+            reuses = all;
+        auto ird = fit_ird(reuses, k, spikes, quantile);
+        fmt::print("IRM: p_irm {:.4f}, zipf alpha {:.2f} over {} classes (rms error {:.4f})\n", irm.p, irm.alpha,
+                   irm.classes, irm.rms);
+        fmt::print("IRD: {} from {} reuses ({:.1f} records per step, total variation {:.4f})\n", ird.spec(),
+                   reuses.count(), ird.step, ird.distance);
+        auto irm_spec = fmt::format("zipf:{:.2f},{}", irm.alpha, irm.classes);
+        config = fmt::format("addresses={} length={} p_irm={:.4f} ird={} irm={} rwratio={:.4f} sizedist={} "
+                             "blocksize={}",
+                             blocks, total, irm.p, ird.spec(), irm_spec, rwratio, sizedist, blocksize);
+        command = fmt::format("trace-gen -m {} -n {} -p {:.4f} -f {} -g {} -r {:.4f} -z {} -b {}", blocks, total,
+                              irm.p, ird.spec(), irm_spec, rwratio, sizedist, blocksize);
+    } else {
+        // slices of the ranking; a group's blocks have mean intervals around total / count
+        auto ranked = rank_classes(freq, blocks, std::min<u64>(groups, blocks));
+        groups = ranked.size();
+        vec<f64> interval(groups);
+        for (int g = 0; g < groups; g++)
+            interval[g] = ranked[g].second > 0 ? total * ranked[g].first / ranked[g].second : total;
+        auto group_of = [&](size_t b) {
+            auto mid = bucket_middle(b);
+            int best = 0;
+            for (int g = 1; g < groups; g++)
+                if (std::abs(std::log(interval[g] / mid)) < std::abs(std::log(interval[best] / mid)))
+                    best = g;
+            return best;
+        };
+        vec<str> irds;
+        vec<f64> pop(groups);
+        f64 pop_sum = 0;
+        for (int g = 0; g < groups; g++) {
+            auto reuses = fit.reuses([&](size_t b) { return b < interval_buckets && group_of(b) == g; });
+            auto ird = fit_ird(reuses, k, spikes, quantile);
+            irds.push_back(ird.spec());
+            // kd-tracegen stretches a group's IRD steps by 1 / pop, the fit
+            // maps one step to ird.step records
+            pop[g] = 1 / ird.step;
+            pop_sum += pop[g];
+            fmt::print("group {}: {:.4f} of accesses, IRD {} from {} reuses (total variation {:.4f})\n", g,
+                       ranked[g].second / total, ird.spec(), reuses.count(), ird.distance);
+        }
+        vec<str> pops;
+        for (auto p : pop)
+            pops.push_back(fmt::format("{:.4f}", std::max(p / pop_sum, 1e-4)));
+        auto ird_spec = fmt::format("{}", fmt::join(irds, ";"));
+        auto irm_spec = fmt::format("{}", fmt::join(pops, ","));
+        config = fmt::format("addresses={} length={} groups={} ird={} irm={} rwratio={:.4f} sizedist={} "
+                             "blocksize={}",
+                             blocks, total, groups, ird_spec, irm_spec, rwratio, sizedist, blocksize);
+        command = fmt::format("kd-tracegen -m {} -n {} -k {} -f \"{}\" -g \"{}\" -r {:.4f} -z {} -b {}", blocks,
+                              total, groups, ird_spec, irm_spec, rwratio, sizedist, blocksize);
+    }
+    fmt::print("config: {}\n{}\n", config, command);
+    if (!output.empty()) {
+        std::ofstream out(output);
+        ensure_fatal(out, "Cannot open output file {}", output);
+        out << config << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef TRACE_INPUT_H
+#define TRACE_INPUT_H
+
+// Reading traces back in, shared by trace-analyze and trace-fit: format
+// detection, a read-only mapping of text traces and the parser of their
+// "<op> <size> <offset>" lines. Binary traces are mapped by
+// tracefile::reader and packed ones decoded by tracepack::reader.
+
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tracefile.h"
+#include "tracepack.h"
+#include "utils.h"
+
+// Read-only mapping of a text trace.
+class text_file {
+    const char *base = nullptr;
+    size_t length = 0;
+
+public:
+    explicit text_file(const str &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        ensure_fatal(fd >= 0, "Cannot open {}: {}", path, std::strerror(errno));
+        struct stat st;
+        ensure_fatal(fstat(fd, &st) == 0, "Cannot stat {}: {}", path, std::strerror(errno));
+        length = st.st_size;
+        if (length > 0) {
+            void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            ensure_fatal(p != MAP_FAILED, "Cannot mmap {}: {}", path, std::strerror(errno));
+            madvise(p, length, MADV_SEQUENTIAL);
+            base = (const char *)p;
+        }
+        ::close(fd);
+    }
+
+    text_file(const text_file &) = delete;
+    text_file &operator=(const text_file &) = delete;
+
+    ~text_file() {
+        if (base)
+            munmap((void *)base, length);
+    }
+
+    std::string_view data() const { return {base, length}; }
+};
+
+// "bin", "packed" or "text", from the file's magic number.
+inline str detect_format(const str &path) {
+    FILE *f = std::fopen(path.c_str(), "rb");
+    ensure_fatal(f, "Cannot open {}: {}", path, std::strerror(errno));
+    char m[sizeof(tracefile::magic)] = {};
+    auto got = std::fread(m, 1, sizeof(m), f);
+    std::fclose(f);
+    if (got == sizeof(m) && std::memcmp(m, tracefile::magic, sizeof(m)) == 0)
+        return "bin";
+    if (got == sizeof(m) && std::memcmp(m, tracepack::magic, sizeof(m)) == 0)
+        return "packed";
+    return "text";
+}
+
+// Calls f(op, size, offset) for each "<op> <size> <offset>" line of text;
+// other lines (the tools' parameter banner) are skipped.
+template <typename F>
+void parse_text_records(std::string_view text, F &&f) {
+    const char *p = text.data(), *end = p + text.size();
+    while (p < end) {
+        auto eol = (const char *)std::memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        i64 op, size, offset;
+        auto r1 = std::from_chars(p, eol, op);
+        if (r1.ec == std::errc() && r1.ptr < eol && *r1.ptr == ' ') {
+            auto r2 = std::from_chars(r1.ptr + 1, eol, size);
+            if (r2.ec == std::errc() && r2.ptr < eol && *r2.ptr == ' ') {
+                auto r3 = std::from_chars(r2.ptr + 1, eol, offset);
+                if (r3.ec == std::errc())
+                    f(op, size, offset);
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+// Cuts text at or after `from` into up to `count` ranges of about `bytes`
+// each, ending at newlines, so the ranges can be parsed in parallel; returns
+// the offset after the last one.
+inline size_t split_text(std::string_view text, size_t from, size_t bytes, size_t count,
+                         vec<std::string_view> &ranges) {
+    ranges.clear();
+    while (ranges.size() < count && from < text.size()) {
+        auto end = std::min(text.size(), from + bytes);
+        if (end < text.size()) {
+            auto nl = text.find('\n', end);
+            end = nl == str::npos ? text.size() : nl + 1;
+        }
+        ranges.push_back(text.substr(from, end - from));
+        from = end;
+    }
+    return from;
+}
+
+#endif // TRACE_INPUT_H
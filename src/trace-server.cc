@@ -0,0 +1,313 @@
+// trace-server: generators resident in a daemon, feeding simulators through
+// shared memory. A client connects to the Unix socket, receives a ring of
+// records (tracering.h) and drives a generator of its own with create, seek
+// and advance requests; advance publishes the records into the ring in the
+// --format=bin layout while the client consumes them, so a simulator pays
+// neither a process start nor any formatting or parsing per run.
+//
+//   trace-server --socket /tmp/tracegen.sock --preload configs.txt
+//
+//   tracering::client c("/tmp/tracegen.sock");
+//   c.create("addresses=1000000 length=100000000 p_irm=0.3 ird=c seed=7");
+//   while (c.advance(1 << 20, [&](auto records) { simulate(records); }) > 0) {}
+//
+// Each connection is served by a process forked from the server, so a
+// request the generator rejects (fatal in libtracegen, as in the tools) ends
+// that session only. The server builds the distribution tables and initial
+// schedules of the --preload configs once, before it accepts anyone; every
+// session inherits them copy-on-write, and a create of a preloaded config
+// takes its ready generator instead of building one. Seeking backwards
+// rebuilds the generator and replays it, from the latest of the session's
+// snapshots (--snapshot-every) at or before the target if there is one.
+
+#include <bit>
+#include <boost/program_options.hpp>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <fmt/core.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <optional>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "libtracegen.h"
+#include "tracefile.h"
+#include "tracering.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+// Preloaded generators by config key and length (which the key leaves out).
+using resident_map = std::map<str, tracegen::generator>;
+
+static str resident_key(const tracegen::config &c) {
+    return fmt::format("{} length={}", tracegen::generator_key(c), c.length);
+}
+
+static resident_map preload(const str &path, tracegen::table_cache &tables) {
+    std::ifstream in(path);
+    ensure_fatal(in, "Cannot open preload manifest {}", path);
+    resident_map resident;
+    str line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(' ') == str::npos)
+            continue;
+        auto cfg = tracegen::config::parse(line);
+        // fork() copies only the calling thread, so shard threads cannot be inherited
+        ensure_fatal(cfg.threads <= 1, "Preloaded configs must be single-threaded: {}", line);
+        resident.emplace(resident_key(cfg), tracegen::generator(cfg, tables));
+    }
+    return resident;
+}
+
+// One client: its ring, its generator and the snapshots taken along it.
+class session {
+    int sock;
+    tracering::header *ring = nullptr;
+    size_t mapped = 0;
+    u64 capacity, head = 0;
+    tracegen::table_cache &tables;
+    resident_map &resident;
+    u64 every;
+    tracegen::config cfg;
+    std::optional<tracegen::generator> gen;
+    std::map<u64, vec<uint8_t>> snapshots;
+    vec<trace_record> buf = vec<trace_record>(chunk_size);
+
+    // The client hung up (checked only while waiting on it).
+    bool peer_closed() const {
+        char c;
+        return ::recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+    }
+
+    void publish(std::span<const trace_record> records) {
+        auto slots = tracering::slots(ring);
+        tracering::backoff wait;
+        for (size_t i = 0; i < records.size();) {
+            auto free = capacity - (head - ring->tail.load(std::memory_order_acquire));
+            if (free == 0) {
+                wait();
+                if (wait.sleeping() && peer_closed())
+                    _exit(0);
+                continue;
+            }
+            wait = {};
+            auto first = head & (capacity - 1);
+            auto k = std::min<u64>({free, records.size() - i, capacity - first});
+            for (u64 j = 0; j < k; j++) {
+                auto &r = records[i + j];
+                slots[first + j] = tracefile::to_le({(uint32_t)r.op, (uint32_t)r.size, (uint64_t)r.offset});
+            }
+            head += k;
+            i += k;
+            ring->head.store(head, std::memory_order_release);
+        }
+    }
+
+    // Runs the generator n records on, publishing them or not; returns how
+    // many there were. Stops at snapshot points to take one.
+    u64 generate(u64 n, bool publishing) {
+        bool snapshotting = every > 0 && cfg.threads <= 1;
+        u64 done = 0;
+        while (done < n) {
+            auto want = std::min<u64>(n - done, buf.size());
+            if (snapshotting)
+                want = std::min(want, every - gen->position() % every);
+            auto k = gen->fill(std::span(buf).first(want));
+            if (k == 0)
+                break;
+            if (publishing)
+                publish(std::span(buf).first(k));
+            done += k;
+            if (snapshotting && gen->position() % every == 0)
+                snapshots.try_emplace(gen->position(), gen->snapshot());
+        }
+        return done;
+    }
+
+    str create(const str &params) {
+        cfg = tracegen::config::parse(params);
+        gen.reset();
+        snapshots.clear();
+        if (auto it = resident.find(resident_key(cfg)); it != resident.end()) {
+            gen.emplace(std::move(it->second));
+            resident.erase(it);
+        } else {
+            gen.emplace(cfg, tables);
+        }
+        return fmt::format("ok length={} addresses={} blocksize={} seed={}", gen->length(), cfg.addresses,
+                           cfg.blocksize, cfg.seed);
+    }
+
+    str seek(u64 target) {
+        if ((i64)target > gen->length())
+            return fmt::format("error position {} is past the end of the trace ({} records)", target,
+                               gen->length());
+        auto at = snapshots.upper_bound(target);
+        bool have = at != snapshots.begin();
+        if (have)
+            --at;
+        if (target < gen->position() || (have && at->first > gen->position())) {
+            gen.reset(); // before its replacement takes the memory
+            gen.emplace(cfg, tables);
+            if (have)
+                gen->restore(at->second);
+        }
+        generate(target - gen->position(), false);
+        return fmt::format("ok position={}", gen->position());
+    }
+
+    str advance(u64 n) {
+        auto k = generate(n, true);
+        return fmt::format("ok records={} position={}", k, gen->position());
+    }
+
+    // Marks an advance request complete for the client, which waits for it.
+    void complete() {
+        ring->end.store(head, std::memory_order_relaxed);
+        ring->done.fetch_add(1, std::memory_order_release);
+    }
+
+    static bool parse_count(const str &s, u64 &x) {
+        auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+        return ec == std::errc() && end == s.data() + s.size();
+    }
+
+    str handle(const str &line) {
+        auto space = line.find(' ');
+        auto cmd = line.substr(0, space), arg = space == str::npos ? str() : line.substr(space + 1);
+        u64 n = 0;
+        if (cmd == "create")
+            return arg.empty() ? "error create needs a config" : create(arg);
+        if (cmd == "seek" || cmd == "advance") {
+            str reply;
+            if (!parse_count(arg, n))
+                reply = fmt::format("error invalid {} count: {}", cmd, arg);
+            else if (!gen)
+                reply = "error no generator (create one first)";
+            else
+                reply = cmd == "seek" ? seek(n) : advance(n);
+            if (cmd == "advance")
+                complete();
+            return reply;
+        }
+        return fmt::format("error unknown command: {}", cmd);
+    }
+
+public:
+    session(int sock, u64 capacity, tracegen::table_cache &tables, resident_map &resident, u64 every)
+        : sock(sock), capacity(capacity), tables(tables), resident(resident), every(every) {}
+
+    ~session() {
+        if (ring)
+            munmap(ring, mapped);
+        ::close(sock);
+    }
+
+    void run() {
+        int fd = memfd_create("tracering", MFD_CLOEXEC);
+        ensure_fatal(fd >= 0, "Cannot create the ring: {}", std::strerror(errno));
+        mapped = tracering::bytes_for(capacity);
+        ensure_fatal(::ftruncate(fd, mapped) == 0, "Cannot size the ring: {}", std::strerror(errno));
+        void *p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ensure_fatal(p != MAP_FAILED, "Cannot map the ring: {}", std::strerror(errno));
+        ring = new (p) tracering::header{};
+        std::memcpy(ring->magic, tracering::magic, sizeof(tracering::magic));
+        ring->version = tracering::version;
+        ring->record_size = sizeof(tracefile::record);
+        ring->capacity = capacity;
+        try {
+            tracering::detail::send_with_fd(
+                sock, fmt::format("ok tracering {} capacity={}", tracering::version, capacity), fd);
+            ::close(fd);
+            tracering::detail::line_reader in(sock);
+            str line;
+            while (in.next(line))
+                tracering::detail::send_all(sock, handle(line) + "\n");
+        } catch (std::runtime_error &) {
+            // the client went away
+        }
+    }
+};
+
+int main(int argc, char **argv) {
+    str socket_path, manifest;
+    i64 ring_records, every;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Produce this message")
+        ("socket,s", po::value<str>(&socket_path)->required(), "Unix socket to listen on")
+        ("ring-records", po::value<i64>(&ring_records)->default_value(1 << 20),
+         "Records per client ring, a power of two (16 bytes each)")
+        ("preload", po::value<str>(&manifest),
+         "File with one generator config per line to build before accepting clients; sessions creating "
+         "one of them start from its ready generator")
+        ("snapshot-every", po::value<i64>(&every)->default_value(0),
+         "Keep an in-memory snapshot of each session's generator every N records, so seeking back "
+         "replays at most N records (0: replay from the start; single-threaded generators only)")
+    ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: trace-server --socket <path> [options]\n" << desc << std::endl;
+            return 1;
+        }
+        po::notify(vm);
+    } catch (std::exception &e) {
+        fmt::print("Error: {}\n", e.what());
+        std::cout << desc << std::endl;
+        return 1;
+    }
+    ensure_fatal(ring_records > 0 && std::has_single_bit((u64)ring_records),
+                 "--ring-records must be a power of two: {}", ring_records);
+    ensure_fatal(every >= 0, "Invalid --snapshot-every: {}", every);
+
+    tracegen::table_cache tables;
+    resident_map resident;
+    if (!manifest.empty())
+        resident = preload(manifest, tables);
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    ensure_fatal(socket_path.size() < sizeof(addr.sun_path), "Socket path too long: {}", socket_path);
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ensure_fatal(listener >= 0, "Cannot create socket: {}", std::strerror(errno));
+    ::unlink(socket_path.c_str()); // a previous server's
+    ensure_fatal(::bind(listener, (sockaddr *)&addr, sizeof(addr)) == 0 && ::listen(listener, 64) == 0,
+                 "Cannot listen on {}: {}", socket_path, std::strerror(errno));
+    std::signal(SIGCHLD, SIG_IGN); // sessions are reaped by the kernel
+    fmt::print("Listening on {} ({} preloaded generators)\n", socket_path, resident.size());
+    std::fflush(stdout);
+
+    for (;;) {
+        int sock = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (sock < 0) {
+            ensure_fatal(errno == EINTR || errno == ECONNABORTED, "accept failed: {}", std::strerror(errno));
+            continue;
+        }
+        auto pid = ::fork();
+        if (pid == 0) {
+            ::close(listener);
+            {
+                session s(sock, ring_records, tables, resident, every);
+                s.run();
+            }
+            std::fflush(stdout);
+            _exit(0);
+        }
+        if (pid < 0)
+            fmt::print(stderr, "Cannot fork a session: {}\n", std::strerror(errno));
+        ::close(sock);
+    }
+}
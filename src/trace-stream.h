@@ -0,0 +1,546 @@
+#ifndef TRACE_STREAM_H
+#define TRACE_STREAM_H
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <future>
+#include <memory>
+#include <optional>
+#include <random>
+#include <span>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include "arrowfile.h"
+#include "async-output.h"
+#include "rng.h"
+#include "stats.h"
+#include "text-format.h"
+#include "thread-pool.h"
+#include "tracefile.h"
+#include "tracepack.h"
+#include "tracegen-utils.h"
+#include "utils.h"
+
+// === Streaming pipeline ===
+//
+// Generators produce addresses in fixed-size chunks through
+// `size_t fill(std::span<i64> out)`, which writes up to out.size() addresses
+// and returns how many were written (0 once the trace is exhausted). Each
+// chunk is turned into records by the post_processor and handed to a
+// trace_writer (tracegen::write_trace in libtracegen.h), so peak memory is
+// O(footprint + chunk_size) regardless of the trace length.
+
+constexpr size_t chunk_size = 1 << 16;
+
+struct trace_record {
+    i64 op;     // 0 = read, 1 = write
+    i64 size;   // in bytes
+    i64 offset; // in bytes
+};
+
+class trace_writer {
+public:
+    virtual ~trace_writer() = default;
+    virtual void write(std::span<const trace_record> records) = 0;
+    // Pushes buffered records out, e.g. before a checkpoint.
+    virtual void flush() {}
+    virtual void finish() {}
+};
+
+/**
+ * Destination of the byte-stream writers: a stdio stream, or an async_output
+ * I/O thread for --io thread|uring. Write errors are fatal.
+ */
+class byte_output {
+    FILE *f = nullptr;
+    bool owned = false;
+    std::unique_ptr<async_output> async;
+    str path;
+
+public:
+    explicit byte_output(FILE *f) : f(f), path("-") {}
+
+    // path "-" is stdout.
+    byte_output(const str &path, const str &io) : path(path) {
+        if (io != "stdio") {
+            async = std::make_unique<async_output>(path, io);
+        } else if (path == "-") {
+            f = stdout;
+        } else {
+            f = std::fopen(path.c_str(), "wb");
+            owned = true;
+            ensure_fatal(f, "Cannot open output file {}: {}", path, std::strerror(errno));
+        }
+    }
+
+    ~byte_output() {
+        if (owned)
+            std::fclose(f);
+    }
+
+    void write(const void *data, size_t n) {
+        if (async)
+            return async->write(data, n);
+        ensure_fatal(std::fwrite(data, 1, n, f) == n, "Cannot write {}: {}", path, std::strerror(errno));
+    }
+
+    void flush() {
+        if (async)
+            async->flush();
+        else
+            std::fflush(f);
+    }
+
+    // Overwrites n bytes at offset at, leaving the position at the end;
+    // false if the output is not seekable.
+    bool patch(u64 at, const void *data, size_t n) {
+        if (async)
+            return async->patch(at, data, n);
+        if (std::fseek(f, at, SEEK_SET) != 0)
+            return false;
+        auto ok = std::fwrite(data, 1, n, f) == n;
+        std::fseek(f, 0, SEEK_END);
+        return ok;
+    }
+
+    // Everything written and, for async output, the I/O thread joined.
+    void close() {
+        if (async)
+            async->close();
+        else
+            std::fflush(f);
+    }
+};
+
+/**
+ * "<op> <size> <offset>\n" per record, the historical output format. Each
+ * chunk is formatted into a reusable buffer (text-format.h) and written at
+ * once; with threads > 1, large chunks are split and their parts formatted
+ * concurrently, on the calling thread and threads - 1 pool workers kept for
+ * the whole trace, then written in order.
+ */
+class text_writer : public trace_writer {
+    static constexpr size_t min_part = 1 << 12;
+
+    byte_output out;
+    size_t threads;
+    vec<vec<char>> bufs;
+    std::unique_ptr<work_stealing_pool> pool;
+
+public:
+    explicit text_writer(FILE *out = stdout) : out(out), threads(1), bufs(1) {}
+
+    explicit text_writer(const str &path, const str &io = "stdio", int threads = 1)
+        : out(path, io), threads(std::max(threads, 1)), bufs(this->threads) {
+        if (this->threads > 1)
+            pool = std::make_unique<work_stealing_pool>(this->threads - 1);
+    }
+
+    void write(std::span<const trace_record> records) override {
+        auto parts = std::min(threads, std::max<size_t>(records.size() / min_part, 1));
+        auto per = (records.size() + parts - 1) / parts;
+        vec<size_t> lens(parts);
+        for (size_t i = 1; i < parts; i++) {
+            auto part = records.subspan(std::min(i * per, records.size()));
+            part = part.first(std::min(per, part.size()));
+            pool->submit([&, i, part] { lens[i] = text_format::format(part, bufs[i]); });
+        }
+        lens[0] = text_format::format(records.first(std::min(per, records.size())), bufs[0]);
+        if (parts > 1)
+            pool->wait();
+        for (size_t i = 0; i < parts; i++) {
+            out.write(bufs[i].data(), lens[i]);
+            stats::add(stats::bytes_written, lens[i]);
+        }
+    }
+
+    void flush() override { out.flush(); }
+    void finish() override { out.close(); }
+};
+
+/**
+ * Writes the packed format from tracefile.h. The file is preallocated for
+ * the expected number of records and filled through a sliding mmap window,
+ * so records are copied straight into the page cache without any
+ * formatting or write(2) calls. If fewer records arrive than announced, the
+ * header and file size are fixed up in finish().
+ */
+class bin_writer : public trace_writer {
+    static constexpr size_t window_size = 256 << 20;
+
+    int fd;
+    str path;
+    u64 expected, written = 0;
+    u64 header_size;
+    uint8_t *window = nullptr;
+    u64 window_off = 0, window_len = 0;
+
+public:
+    bin_writer(const str &path, u64 records, i64 seed, const str &params)
+        : path(path), expected(records) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        ensure_fatal(fd >= 0, "Cannot open output file {}: {}", path, std::strerror(errno));
+
+        tracefile::header hdr{};
+        std::memcpy(hdr.magic, tracefile::magic, sizeof(hdr.magic));
+        header_size = tracefile::header_size_for(params.size());
+        hdr.version = tracefile::le(tracefile::version);
+        hdr.header_size = tracefile::le((uint32_t)header_size);
+        hdr.record_count = tracefile::le(records);
+        hdr.seed = tracefile::le((u64)seed);
+        hdr.record_size = tracefile::le((uint32_t)sizeof(tracefile::record));
+        hdr.params_size = tracefile::le((uint32_t)params.size());
+
+        vec<uint8_t> head(header_size, 0);
+        std::memcpy(head.data(), &hdr, sizeof(hdr));
+        std::memcpy(head.data() + sizeof(hdr), params.data(), params.size());
+        ensure_fatal(::pwrite(fd, head.data(), head.size(), 0) == (ssize_t)head.size(),
+                     "Cannot write {}: {}", path, std::strerror(errno));
+        stats::add(stats::bytes_written, head.size());
+
+        auto total = header_size + records * sizeof(tracefile::record);
+        ensure_fatal(::ftruncate(fd, total) == 0, "Cannot resize {}: {}", path, std::strerror(errno));
+        posix_fallocate(fd, 0, total);
+    }
+
+    ~bin_writer() override {
+        unmap();
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    void write(std::span<const trace_record> records) override {
+        ensure_fatal(written + records.size() <= expected,
+                     "More records than announced in the header of {}", path);
+        for (auto &r : records) {
+            auto pos = header_size + written * sizeof(tracefile::record);
+            if (pos >= window_off + window_len)
+                remap(pos);
+            ensure_fatal((u64)r.size <= UINT32_MAX, "Request size {} does not fit the binary format", r.size);
+            auto rec = tracefile::to_le({(uint32_t)r.op, (uint32_t)r.size, (uint64_t)r.offset});
+            std::memcpy(window + (pos - window_off), &rec, sizeof(rec));
+            written++;
+        }
+        stats::add(stats::bytes_written, records.size() * sizeof(tracefile::record));
+    }
+
+    void finish() override {
+        unmap();
+        if (written != expected) {
+            auto count = tracefile::le(written);
+            ::pwrite(fd, &count, sizeof(count), offsetof(tracefile::header, record_count));
+            ensure_fatal(::ftruncate(fd, header_size + written * sizeof(tracefile::record)) == 0,
+                         "Cannot resize {}: {}", path, std::strerror(errno));
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+private:
+    void remap(u64 pos) {
+        unmap();
+        // window_size is a multiple of the page size and of the record size,
+        // so records never straddle two windows.
+        window_off = pos / window_size * window_size;
+        auto end = header_size + expected * sizeof(tracefile::record);
+        window_len = std::min<u64>(window_size, end - window_off);
+        auto p = mmap(nullptr, window_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, window_off);
+        ensure_fatal(p != MAP_FAILED, "Cannot mmap {}: {}", path, std::strerror(errno));
+        madvise(p, window_len, MADV_SEQUENTIAL);
+        window = (uint8_t *)p;
+    }
+
+    void unmap() {
+        if (window)
+            munmap(window, window_len);
+        window = nullptr;
+        window_len = 0;
+    }
+};
+
+/**
+ * Writes the compressed format from tracepack.h (--format=packed). Every
+ * write() becomes one or more blocks that are encoded and compressed on a
+ * pool of `threads` workers, up to `threads` blocks in flight, and are
+ * written in order as they complete, so compression overlaps with
+ * generation. With threads == 0 blocks are compressed inline. The record
+ * count in the header is fixed up in finish() if fewer records arrive than
+ * announced and the output is seekable.
+ */
+class packed_writer : public trace_writer {
+    static constexpr size_t max_block = 1 << 16;
+
+    byte_output out;
+    tracepack::codec codec;
+    int level;
+    u64 unit;
+    size_t threads;
+    u64 expected, written = 0;
+    std::deque<std::future<vec<uint8_t>>> inflight;
+    std::unique_ptr<work_stealing_pool> pool;
+
+    static vec<uint8_t> pack(vec<trace_record> records, u64 unit, tracepack::codec codec, int level) {
+        vec<uint8_t> raw;
+        tracepack::encode(std::span<const trace_record>(records), unit, raw);
+        auto stored = tracepack::compress(codec, level, raw);
+        tracepack::block_header bh{tracefile::le((uint32_t)records.size()), tracefile::le((uint32_t)raw.size()),
+                                   tracefile::le((uint32_t)stored.size()), 0};
+        vec<uint8_t> block(sizeof(bh) + stored.size());
+        std::memcpy(block.data(), &bh, sizeof(bh));
+        std::memcpy(block.data() + sizeof(bh), stored.data(), stored.size());
+        return block;
+    }
+
+    void emit(const vec<uint8_t> &bytes) {
+        out.write(bytes.data(), bytes.size());
+        stats::add(stats::bytes_written, bytes.size());
+    }
+
+    // Writes completed blocks until at most keep are in flight.
+    void drain(size_t keep) {
+        while (inflight.size() > keep) {
+            vec<uint8_t> block;
+            try {
+                block = inflight.front().get();
+            } catch (std::exception &e) {
+                log_fatal("Cannot pack trace block: {}", e.what());
+            }
+            inflight.pop_front();
+            emit(block);
+        }
+    }
+
+public:
+    packed_writer(const str &path, u64 unit, u64 records, i64 seed, const str &params, const str &codec_name,
+                  int level, int threads, const str &io = "stdio")
+        : out(path, io), level(level), unit(unit), threads(std::max(threads, 0)), expected(records) {
+        ensure_fatal(unit > 0, "Invalid blocksize: {}", unit);
+        try {
+            codec = tracepack::codec_from_name(codec_name);
+        } catch (std::exception &e) {
+            log_fatal("Invalid codec: {} (expected zstd, lz4 or none)", codec_name);
+        }
+        ensure_fatal(tracepack::available(codec), "Codec {} is not compiled in (use none)", codec_name);
+        if (this->threads > 0)
+            pool = std::make_unique<work_stealing_pool>(this->threads);
+
+        tracepack::header hdr{};
+        std::memcpy(hdr.magic, tracepack::magic, sizeof(hdr.magic));
+        hdr.version = tracefile::le(tracepack::version);
+        hdr.codec = tracefile::le((uint32_t)codec);
+        hdr.unit = tracefile::le(unit);
+        hdr.record_count = tracefile::le(records);
+        hdr.seed = tracefile::le((u64)seed);
+        hdr.params_size = tracefile::le((uint32_t)params.size());
+        vec<uint8_t> head(sizeof(hdr) + params.size());
+        std::memcpy(head.data(), &hdr, sizeof(hdr));
+        std::memcpy(head.data() + sizeof(hdr), params.data(), params.size());
+        emit(head);
+    }
+
+    void write(std::span<const trace_record> records) override {
+        for (size_t i = 0; i < records.size(); i += max_block) {
+            auto part = records.subspan(i, std::min(max_block, records.size() - i));
+            vec<trace_record> copy(part.begin(), part.end());
+            if (threads == 0) {
+                try {
+                    emit(pack(std::move(copy), unit, codec, level));
+                } catch (std::exception &e) {
+                    log_fatal("Cannot pack trace block: {}", e.what());
+                }
+            } else {
+                // the pool takes copyable tasks; errors reach drain() through the future
+                auto task = std::make_shared<std::packaged_task<vec<uint8_t>()>>(
+                    [copy = std::move(copy), unit = unit, codec = codec, level = level]() mutable {
+                        return pack(std::move(copy), unit, codec, level);
+                    });
+                inflight.push_back(task->get_future());
+                pool->submit([task] { (*task)(); });
+                drain(threads);
+            }
+            written += part.size();
+        }
+    }
+
+    void flush() override {
+        drain(0);
+        out.flush();
+    }
+
+    void finish() override {
+        drain(0);
+        emit(vec<uint8_t>(sizeof(tracepack::block_header), 0));
+        if (written != expected) {
+            auto count = tracefile::le(written);
+            out.patch(offsetof(tracepack::header, record_count), &count, sizeof(count));
+        }
+        out.close();
+    }
+};
+
+/**
+ * Writes the columnar format from arrowfile.h (--format=arrow): records are
+ * encoded into column buffers as they arrive and written as one record batch
+ * per batch_size records, so memory stays O(batch_size).
+ */
+class arrow_writer : public trace_writer {
+    byte_output out;
+    arrowfile::encoder enc;
+    size_t batch_size;
+    vec<uint8_t> bytes;
+
+    void emit() {
+        out.write(bytes.data(), bytes.size());
+        stats::add(stats::bytes_written, bytes.size());
+        bytes.clear();
+    }
+
+public:
+    arrow_writer(const str &path, i64 seed, const str &params, size_t batch_size, const str &io = "stdio")
+        : out(path, io), enc({{"tracegen.params", params}, {"tracegen.seed", std::to_string(seed)}}),
+          batch_size(batch_size) {
+        ensure_fatal(batch_size > 0 && batch_size <= INT32_MAX, "Invalid batch size: {}", batch_size);
+        enc.start(bytes);
+        emit();
+    }
+
+    void write(std::span<const trace_record> records) override {
+        for (auto &r : records) {
+            enc.add(r.op, r.size, r.offset);
+            if (enc.pending() == batch_size) {
+                enc.batch(bytes);
+                emit();
+            }
+        }
+    }
+
+    void flush() override {
+        if (enc.pending() > 0) {
+            enc.batch(bytes);
+            emit();
+        }
+        out.flush();
+    }
+
+    void finish() override {
+        enc.finish(bytes);
+        emit();
+        out.close();
+    }
+};
+
+/**
+ * Writer for --format/--output. Text goes to stdout when path is "-"; the
+ * binary format needs a real file to map, so it ignores io. Text is
+ * formatted on up to `threads` threads.
+ */
+inline std::unique_ptr<trace_writer> make_writer(const str &format, const str &path, u64 records,
+                                                 i64 seed, const str &params, const str &io = "stdio",
+                                                 int threads = 1) {
+    if (format == "text")
+        return std::make_unique<text_writer>(path, io, threads);
+    if (format == "bin") {
+        ensure_fatal(path != "-", "--format=bin requires --output <file>");
+        return std::make_unique<bin_writer>(path, records, seed, params);
+    }
+    log_fatal("Invalid output format: {}", format);
+}
+
+/**
+ * Draws r/w and size for each generated address and converts the block
+ * address to a byte offset. Ops and sizes come from their own RNG streams
+ * (derived from the seed), independent of the address generator, so a chunk
+ * can be processed as soon as it is generated. A constant op (rwratio 0 or
+ * 1) or size (one size with all the weight, as the default 1:1) is not
+ * drawn at all: the loop for the chunk is specialised on which of the two
+ * are. Those streams are used for nothing else, so the records are the same.
+ */
+template <typename Rng>
+class post_processor {
+    bernoulli_sampler is_read;
+    size_sampler sizedist;
+    i64 blocksize;
+    Rng op_rng, size_rng;
+    std::optional<i64> fixed_op, fixed_size; // in bytes
+    vec<uint8_t> reads;
+    vec<i64> sizes;
+
+    // The only size with any weight, if there is one.
+    static std::optional<i64> constant_size(const size_sampler &d) {
+        auto p = d.dis.probabilities();
+        std::optional<i64> size;
+        for (size_t i = 0; i < p.size(); i++)
+            if (p[i] > 0) {
+                if (size && *size != d.sizes[i])
+                    return std::nullopt;
+                size = d.sizes[i];
+            }
+        return size;
+    }
+
+    template <bool draw_ops, bool draw_sizes>
+    void apply(std::span<const i64> addrs, std::span<trace_record> out) {
+        auto n = addrs.size();
+        if constexpr (draw_ops) {
+            reads.resize(n);
+            is_read.sample_mask(op_rng, reads);
+        }
+        if constexpr (draw_sizes) {
+            sizes.resize(n);
+            sizedist.sample_n(size_rng, sizes);
+        }
+        for (size_t i = 0; i < n; i++) {
+            i64 op, size;
+            if constexpr (draw_ops)
+                op = !reads[i];
+            else
+                op = *fixed_op;
+            if constexpr (draw_sizes)
+                size = sizes[i] * blocksize;
+            else
+                size = *fixed_size;
+            out[i] = {.op = op, .size = size, .offset = addrs[i] * blocksize};
+        }
+    }
+
+public:
+    post_processor(f64 frac_read, size_sampler sizedist, i64 blocksize, i64 seed)
+        : is_read(frac_read), sizedist(std::move(sizedist)),
+          blocksize(blocksize), op_rng(Rng::stream(seed, stream_op)),
+          size_rng(Rng::stream(seed, stream_size)) {
+        // the trials' outcomes when every draw succeeds or none does
+        if (frac_read >= 1 || frac_read <= 0)
+            fixed_op = is_read.test(0) ? 0 : 1;
+        if (auto size = constant_size(this->sizedist))
+            fixed_size = *size * blocksize;
+    }
+
+    // out must hold addrs.size() records. Ops and sizes come from separate
+    // streams, so each is drawn for the whole chunk at once.
+    void apply(std::span<const i64> addrs, std::span<trace_record> out) {
+        if (fixed_op && fixed_size)
+            apply<false, false>(addrs, out);
+        else if (fixed_op)
+            apply<false, true>(addrs, out);
+        else if (fixed_size)
+            apply<true, false>(addrs, out);
+        else
+            apply<true, true>(addrs, out);
+    }
+
+    void save(state_writer &w) const {
+        op_rng.save(w);
+        size_rng.save(w);
+    }
+
+    void load(state_reader &r) {
+        op_rng.load(r);
+        size_rng.load(r);
+    }
+};
+
+#endif // TRACE_STREAM_H
@@ -0,0 +1,202 @@
+// trace-sweep: many traces from one process. Jobs come from a manifest (one
+// "name=value ..." generator config per line, as config::parse reads them)
+// or from a grid, the cross product of --grid axes over a --base config.
+// Each distinct IRD, IRM and size spec is parsed and its alias table built
+// once, then shared read-only by every job (tracegen::table_cache). Jobs run
+// on a work-stealing pool, one generator and one writer per job, so a sweep
+// of short traces costs neither a process start nor a table build per
+// configuration.
+//
+//   trace-sweep --base "addresses=100000 length=10000000 ird=c"
+//       --grid "p_irm=0.1 0.3 0.5" --grid "seed=1 2 3"
+//       --format mrc -o "mrc-{p_irm}-{seed}.txt"
+//
+// Every job holds its own schedule, so peak memory is --jobs times the
+// largest footprint.
+
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <fmt/core.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "cli.h"
+#include "libtracegen.h"
+#include "stats.h"
+#include "thread-pool.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+struct job {
+    str params; // generator config, "name=value ..."
+    output_options out;
+};
+
+// name=value pairs of a config line, in order.
+static vec<std::pair<str, str>> items(const str &params) {
+    vec<std::pair<str, str>> out;
+    for (auto &item : split(params, " ")) {
+        if (item.empty())
+            continue;
+        auto eq = item.find('=');
+        ensure_fatal(eq != str::npos, "Invalid parameter (expected name=value): {}", item);
+        out.emplace_back(item.substr(0, eq), item.substr(eq + 1));
+    }
+    return out;
+}
+
+// pattern with {job} replaced by the job number and {name} by the job's
+// value of parameter name (the last one given).
+static str expand(const str &pattern, size_t index, const str &params) {
+    std::map<str, str> values{{"job", std::to_string(index)}};
+    for (auto &[name, value] : items(params))
+        values[name] = value;
+    str out;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        auto close = pattern.find('}', i);
+        if (pattern[i] == '{' && close != str::npos) {
+            auto name = pattern.substr(i + 1, close - i - 1);
+            auto it = values.find(name);
+            ensure_fatal(it != values.end(), "Unknown parameter {{{}}} in output pattern {}", name, pattern);
+            out += it->second;
+            i = close;
+        } else {
+            out += pattern[i];
+        }
+    }
+    return out;
+}
+
+// Manifest lines; output= and format= set that job's output, '#' starts a
+// comment.
+static vec<job> read_manifest(const str &path, const output_options &defaults) {
+    std::ifstream in(path);
+    ensure_fatal(in, "Cannot open manifest {}", path);
+    vec<job> jobs;
+    str line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        job j{"", defaults};
+        for (auto &[name, value] : items(line)) {
+            if (name == "output")
+                j.out.output = value;
+            else if (name == "format")
+                j.out.format = value;
+            else
+                j.params += fmt::format("{}{}={}", j.params.empty() ? "" : " ", name, value);
+        }
+        if (!j.params.empty())
+            jobs.push_back(std::move(j));
+    }
+    return jobs;
+}
+
+// Cross product of the axes ("name=v1 v2 ..."), last axis fastest.
+static vec<job> expand_grid(const str &base, const vec<str> &axes, const output_options &defaults) {
+    vec<str> configs{base};
+    for (auto &axis : axes) {
+        auto eq = axis.find('=');
+        ensure_fatal(eq != str::npos, "Invalid grid axis (expected name=v1 v2 ...): {}", axis);
+        auto name = axis.substr(0, eq);
+        vec<str> next;
+        for (auto &c : configs)
+            for (auto &v : split(axis.substr(eq + 1), " "))
+                if (!v.empty())
+                    next.push_back(c + (c.empty() ? "" : " ") + name + "=" + v);
+        configs = std::move(next);
+    }
+    vec<job> jobs;
+    for (auto &c : configs)
+        jobs.push_back({c, defaults});
+    return jobs;
+}
+
+int main(int argc, char **argv) {
+    stats::timer parse_timer(stats::parse);
+    str manifest, base;
+    vec<str> grid;
+    int threads;
+    output_options out_opts;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Produce this message")
+        ("manifest", po::value<str>(&manifest),
+         "File with one generator config per line (\"addresses=... length=... p_irm=...\", as stored in "
+         "trace headers); output= and format= per line override the options below")
+        ("base", po::value<str>(&base)->default_value(""), "Config shared by every grid job")
+        ("grid", po::value<vec<str>>(&grid)->composing(),
+         "Grid axis \"name=v1 v2 ...\"; repeat for more axes (jobs are the cross product)")
+        ("jobs,j", po::value<int>(&threads)->default_value(std::max(1u, std::thread::hardware_concurrency())),
+         "Traces generated at once")
+    ;
+    add_output_options(desc, out_opts);
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: trace-sweep (--manifest <file> | --base <config> --grid <axis>...) "
+                         "-o <pattern> [options]\n"
+                      << desc << std::endl;
+            return 1;
+        }
+        po::notify(vm);
+    } catch (std::exception &e) {
+        fmt::print("Error: {}\n", e.what());
+        std::cout << desc << std::endl;
+        return 1;
+    }
+    ensure_fatal(manifest.empty() != grid.empty(), "Give either --manifest or --grid");
+    ensure_fatal(threads > 0, "Invalid number of jobs: {}", threads);
+
+    auto jobs = manifest.empty() ? expand_grid(base, grid, out_opts) : read_manifest(manifest, out_opts);
+    ensure_fatal(!jobs.empty(), "No jobs to run");
+    std::set<str> outputs;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        auto &j = jobs[i];
+        ensure_fatal(j.out.output != "-" || jobs.size() == 1, "Job {} has no --output (pattern with {{job}} "
+                     "or {{name}}, or output= in the manifest)", i);
+        j.out.output = expand(j.out.output, i, j.params);
+        ensure_fatal(j.out.output == "-" || outputs.insert(j.out.output).second,
+                     "Jobs write the same output {}; add {{job}} or a parameter to the pattern", j.out.output);
+    }
+    // reject bad configs before any job starts
+    vec<tracegen::config> configs;
+    for (auto &j : jobs)
+        configs.push_back(tracegen::config::parse(j.params));
+    parse_timer.stop();
+
+    fmt::print("Running {} jobs on {} threads\n", jobs.size(), std::min<size_t>(threads, jobs.size()));
+    tracegen::table_cache tables;
+    std::mutex print_lock;
+    size_t done = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        work_stealing_pool pool(std::min<size_t>(threads, jobs.size()));
+        for (size_t i = 0; i < jobs.size(); i++)
+            pool.submit([&, i] {
+                auto &j = jobs[i];
+                auto &c = configs[i];
+                auto t0 = std::chrono::steady_clock::now();
+                tracegen::generator gen(c, tables);
+                auto writer = open_writer(j.out, gen.length(), c.seed, c.blocksize, j.params, c.threads,
+                                          c.sample_rate);
+                tracegen::write_trace(gen, *writer);
+                writer.reset();
+                auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                std::lock_guard guard(print_lock);
+                fmt::print("[{}/{}] {} -> {} ({:.2f} s)\n", ++done, jobs.size(), j.params, j.out.output, secs);
+                std::fflush(stdout);
+            });
+    }
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fmt::print("{} jobs in {:.2f} s\n", jobs.size(), secs);
+
+    stats::report(out_opts.stats);
+    return 0;
+}
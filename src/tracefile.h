@@ -0,0 +1,142 @@
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+// Packed binary trace format written by `--format=bin`.
+//
+// Layout (all integers little-endian):
+//
+//   header        48 bytes, see tracefile::header
+//   params        header.params_size bytes of text ("name=value ..."),
+//                 zero-padded so records start at header.header_size
+//   records       header.record_count * 16 bytes, see tracefile::record
+//
+// This header only depends on the standard library and POSIX so simulators
+// can include it directly to read traces.
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tracefile {
+
+constexpr char magic[8] = {'T', 'R', 'G', 'N', 'B', 'I', 'N', '\0'};
+constexpr uint32_t version = 1;
+
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;   // file offset of the first record
+    uint64_t record_count;
+    uint64_t seed;
+    uint32_t record_size;   // sizeof(record)
+    uint32_t params_size;   // length of the params text after the header
+    uint64_t reserved;
+};
+static_assert(sizeof(header) == 48);
+
+struct record {
+    uint32_t op;      // 0 = read, 1 = write
+    uint32_t size;    // in bytes
+    uint64_t offset;  // in bytes
+};
+static_assert(sizeof(record) == 16);
+
+inline uint32_t le(uint32_t x) {
+    if constexpr (std::endian::native == std::endian::big)
+        return __builtin_bswap32(x);
+    return x;
+}
+
+inline uint64_t le(uint64_t x) {
+    if constexpr (std::endian::native == std::endian::big)
+        return __builtin_bswap64(x);
+    return x;
+}
+
+inline record to_le(record r) { return {le(r.op), le(r.size), le(r.offset)}; }
+
+// Offset of the first record for a given params length; records are kept
+// 16-byte aligned.
+inline uint32_t header_size_for(size_t params_size) {
+    return (uint32_t)((sizeof(header) + params_size + 15) & ~size_t(15));
+}
+
+/**
+ * Read-only view of a binary trace. The file is mmap'd; records() points
+ * straight into the mapping, so on little-endian hosts no copy or parsing
+ * takes place. Throws std::runtime_error on I/O errors or a malformed file.
+ */
+class reader {
+    const uint8_t *base = nullptr;
+    size_t length = 0;
+    header hdr{};
+
+public:
+    explicit reader(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header)) {
+            ::close(fd);
+            throw std::runtime_error("not a trace file: " + path);
+        }
+        length = st.st_size;
+        void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("cannot mmap " + path);
+        base = (const uint8_t *)p;
+        madvise(p, length, MADV_SEQUENTIAL);
+
+        std::memcpy(&hdr, base, sizeof(hdr));
+        hdr.version = le(hdr.version);
+        hdr.header_size = le(hdr.header_size);
+        hdr.record_count = le(hdr.record_count);
+        hdr.seed = le(hdr.seed);
+        hdr.record_size = le(hdr.record_size);
+        hdr.params_size = le(hdr.params_size);
+        if (std::memcmp(hdr.magic, magic, sizeof(magic)) != 0 ||
+            hdr.version != version || hdr.record_size != sizeof(record) ||
+            hdr.header_size < sizeof(header) + hdr.params_size ||
+            hdr.header_size + hdr.record_count * sizeof(record) > length) {
+            unmap();
+            throw std::runtime_error("not a trace file: " + path);
+        }
+    }
+
+    reader(const reader &) = delete;
+    reader &operator=(const reader &) = delete;
+    ~reader() { unmap(); }
+
+    const header &info() const { return hdr; }
+
+    std::string_view params() const {
+        return {(const char *)base + sizeof(header), hdr.params_size};
+    }
+
+    // Records as stored on disk; use tracefile::to_le() on big-endian hosts.
+    std::span<const record> records() const {
+        return {(const record *)(base + hdr.header_size),
+                (size_t)hdr.record_count};
+    }
+
+private:
+    void unmap() {
+        if (base)
+            munmap((void *)base, length);
+        base = nullptr;
+    }
+};
+
+} // namespace tracefile
+
+#endif // TRACEFILE_H
@@ -0,0 +1,50 @@
+#ifndef TRACEGEN_C_H
+#define TRACEGEN_C_H
+
+/*
+ * C interface to libtracegen (see libtracegen.h).
+ *
+ *   tracegen_generator *gen = tracegen_create("addresses=100000 length=1000000 p_irm=0.3");
+ *   tracegen_record buf[4096];
+ *   size_t n;
+ *   while ((n = tracegen_fill(gen, buf, 4096)) > 0)
+ *       simulate(buf, n);
+ *   tracegen_destroy(gen);
+ *
+ * Parameters are "name=value" pairs separated by spaces, with the names of
+ * the command-line options. Invalid parameters are fatal, as in the tools.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tracegen_generator tracegen_generator;
+
+typedef struct {
+    int64_t op;     /* 0 = read, 1 = write */
+    int64_t size;   /* in bytes */
+    int64_t offset; /* in bytes */
+} tracegen_record;
+
+tracegen_generator *tracegen_create(const char *params);
+
+/* Writes up to n records to out; returns how many (0 at the end of the trace). */
+size_t tracegen_fill(tracegen_generator *gen, tracegen_record *out, size_t n);
+
+/* Like tracegen_create, continuing from a snapshot written by tracegen_save. */
+tracegen_generator *tracegen_resume(const char *params, const char *checkpoint);
+
+/* Atomically writes a snapshot of gen after the records filled so far. */
+void tracegen_save(const tracegen_generator *gen, const char *checkpoint);
+
+void tracegen_destroy(tracegen_generator *gen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACEGEN_C_H */
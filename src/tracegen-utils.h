@@ -5,16 +5,31 @@
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
-#include <functional>
 #include <iostream>
+#include <limits>
 #include <random>
+#include <span>
 #include <sstream>
 #include <string>
+#include <variant>
 #include <vector>
 #include <fmt/core.h>
 #include <fmt/format.h>
 #include <fmt/printf.h>
-#include "utils.h"  
+#include "alias.h"
+#include "checkpoint.h"
+#include "utils.h"
+
+// Distributions are concrete sampler types with a templated
+// `i64 operator()(URBG &rng)`, so the generation loops can be instantiated
+// per distribution and the sampling code inlined. The *_dist/irdgen/parse_*
+// functions build them from the command-line specs; parse_irm() returns an
+// irm_dist variant that callers std::visit once, outside the hot loop.
+// Discrete choices (classes, bins, IRDs, sizes) are drawn from alias tables.
+// sample_n() draws a whole span at once, in bulk where the sampler supports
+// it (sample_n member), with the same values as one draw at a time. The IRM
+// samplers' masses() give their probability of each of a sorted list of
+// addresses, for the --sample-rate generators (subset_sampler).
 
 inline vec<std::uniform_int_distribution<i64>> get_intervals(i64 classes, i64 max) {
     assert(classes > 0 && max > 0 && classes <= max);
@@ -29,19 +44,310 @@ inline vec<std::uniform_int_distribution<i64>> get_intervals(i64 classes, i64 ma
     return intervals;
 }
 
-inline dist normal_dist(f64 mean, f64 stddev, i64 max) {
-    std::normal_distribution<f64> dis(mean, stddev);
-    return [dis, max](std::mt19937_64 &rng) mutable -> i64 {
+// Probability of each address in sorted under a choice of interval by dis,
+// then of an address uniformly within it (class_sampler and bin_sampler).
+inline vec<f64> interval_masses(const alias_table &dis, const vec<std::uniform_int_distribution<i64>> &ivs,
+                                std::span<const i64> sorted) {
+    auto p = dis.probabilities();
+    vec<f64> q;
+    q.reserve(sorted.size());
+    size_t c = 0;
+    for (auto a : sorted) {
+        while (c < ivs.size() && a > ivs[c].b())
+            c++;
+        bool inside = c < ivs.size() && a >= ivs[c].a();
+        q.push_back(inside ? p[c] / (ivs[c].b() - ivs[c].a() + 1) : 0);
+    }
+    return q;
+}
+
+struct normal_sampler {
+    std::normal_distribution<f64> dis;
+    i64 max;
+
+    template <typename R> i64 operator()(R &rng) {
         auto sample = dis(rng);
         if (sample < 0)
             return 0;
         if (sample > max)
             return max;
         return (i64)std::round(sample);
+    }
+
+    // Samples round to the nearest address; the tails fall on 0 and max.
+    vec<f64> masses(std::span<const i64> sorted) const {
+        auto cdf = [&](f64 x) { return 0.5 * std::erfc((dis.mean() - x) / (dis.stddev() * std::sqrt(2.0))); };
+        vec<f64> q;
+        q.reserve(sorted.size());
+        for (auto a : sorted)
+            q.push_back((a >= max ? 1 : cdf(a + 0.5)) - (a <= 0 ? 0 : cdf(a - 0.5)));
+        return q;
+    }
+
+    // The distribution caches the second value of each Box-Muller pair.
+    void save(state_writer &w) const { w.put(dis); }
+    void load(state_reader &r) { r.get(dis); }
+};
+
+// Picks a class from weights, then an address uniformly within the class's
+// interval of [0, max) (zipf and pareto).
+struct class_sampler {
+    alias_table dis;
+    vec<std::uniform_int_distribution<i64>> ivs;
+
+    template <typename R> i64 operator()(R &rng) {
+        auto idx = dis(rng);
+        return ivs[idx](rng);
+    }
+
+    vec<f64> masses(std::span<const i64> sorted) const { return interval_masses(dis, ivs, sorted); }
+};
+
+/**
+ * Zipf classes 1..n (weight k^-alpha) by rejection-inversion (Hörmann and
+ * Derflinger, "Rejection-inversion to generate variates from monotone
+ * discrete distributions", 1996), then an address uniformly within the
+ * class's interval of [0, max), as class_sampler does for zipf_dist. The
+ * same distribution in constant memory and setup: a draw inverts the
+ * integral of x^-alpha at a uniform point and accepts its rounding to the
+ * nearest class, which fails rarely enough that a draw takes about one
+ * trial whatever n is.
+ */
+class zipf_rejection_sampler {
+    f64 alpha;
+    i64 n, width, max;
+    f64 h_x1, h_n, shortcut;
+
+    // log1p(x) / x and expm1(x) / x, by their series near 0
+    static f64 helper1(f64 x) {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+    static f64 helper2(f64 x) {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+    }
+
+    // H(x) = (x^(1-alpha) - 1) / (1 - alpha) (log x for alpha = 1), its inverse, and h(x) = x^-alpha
+    f64 h_integral(f64 x) const {
+        auto log_x = std::log(x);
+        return helper2((1 - alpha) * log_x) * log_x;
+    }
+    f64 h_integral_inverse(f64 x) const {
+        auto t = std::max(x * (1 - alpha), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+    f64 h(f64 x) const { return std::exp(-alpha * std::log(x)); }
+
+public:
+    zipf_rejection_sampler(f64 alpha, i64 classes, i64 max)
+        : alpha(alpha), n(classes), width(max / classes), max(max), h_x1(h_integral(1.5) - 1),
+          h_n(h_integral(classes + 0.5)), shortcut(2 - h_integral_inverse(h_integral(2.5) - h(2))) {}
+
+    // Class in [1, n].
+    template <typename R> i64 sample_class(R &rng) {
+        std::uniform_real_distribution<f64> uniform(0, 1);
+        for (;;) {
+            auto u = h_n + uniform(rng) * (h_x1 - h_n);
+            auto x = h_integral_inverse(u);
+            auto k = std::clamp<i64>((i64)(x + 0.5), 1, n);
+            if (k - x <= shortcut || u >= h_integral(k + 0.5) - h((f64)k))
+                return k;
+        }
+    }
+
+    template <typename R> i64 operator()(R &rng) {
+        auto lower = (sample_class(rng) - 1) * width;
+        return std::uniform_int_distribution<i64>(lower, std::min(lower + width, max) - 1)(rng);
+    }
+
+    /**
+     * The normalising sum of k^-alpha over the n classes is added up term by
+     * term for n up to 2^20 and past that continued by the Euler-Maclaurin
+     * formula, whose error there is far below double rounding.
+     */
+    vec<f64> masses(std::span<const i64> sorted) const {
+        const i64 exact = std::min<i64>(n, 1 << 20);
+        f64 sum = 0;
+        for (i64 k = exact; k >= 1; k--)
+            sum += h((f64)k);
+        if (n > exact) {
+            f64 a = exact, b = n;
+            auto integral = std::abs(alpha - 1) < 1e-12 ? std::log(b / a)
+                                                        : (std::pow(b, 1 - alpha) - std::pow(a, 1 - alpha)) / (1 - alpha);
+            sum += integral + (h(b) - h(a)) / 2 + alpha / 12 * (h(a) / a - h(b) / b);
+        }
+        vec<f64> q;
+        q.reserve(sorted.size());
+        for (auto a : sorted) {
+            auto k = a / width + 1;
+            q.push_back(k <= n ? h((f64)k) / sum / (std::min(k * width, max) - (k - 1) * width) : 0);
+        }
+        return q;
+    }
+};
+
+struct uniform_sampler {
+    std::uniform_int_distribution<i64> dis;
+
+    template <typename R> i64 operator()(R &rng) { return dis(rng); }
+
+    vec<f64> masses(std::span<const i64> sorted) const {
+        vec<f64> q;
+        q.reserve(sorted.size());
+        for (auto a : sorted)
+            q.push_back(a >= dis.a() && a <= dis.b() ? 1.0 / (dis.b() - dis.a() + 1) : 0);
+        return q;
+    }
+};
+
+// IRM draws restricted to a sample of the addresses: index i of the sample
+// with probability proportional to its mass under the full IRM (see the
+// --sample-rate generators in libtracegen.cc).
+struct subset_sampler {
+    alias_table dis;
+
+    template <typename R> i64 operator()(R &rng) { return dis(rng); }
+};
+
+struct sequential_sampler {
+    i64 i = 0;
+
+    template <typename R> i64 operator()(R &) { return i++; }
+
+    void save(state_writer &w) const { w.put(i); }
+    void load(state_reader &r) { r.get(i); }
+};
+
+// Weighted bins of the address space, e.g. "2,8" (non-canonical IRM spec).
+struct bin_sampler {
+    alias_table bin_dis;
+    vec<std::uniform_int_distribution<i64>> bins;
+
+    template <typename R> i64 operator()(R &rng) { return bins[bin_dis(rng)](rng); }
+
+    vec<f64> masses(std::span<const i64> sorted) const { return interval_masses(bin_dis, bins, sorted); }
+};
+
+// Group popularities for kd-tracegen, returned in a fixed order (scaled by
+// 10000); the rng is unused.
+struct pop_sampler {
+    vec<double> weights;
+    size_t counter = 0;
+    double scale;
+
+    template <typename R> i64 operator()(R &) {
+        assert(counter < weights.size() && "Not enough weights for all groups");
+        return (i64)std::llround(weights[counter++] * scale);
+    }
+};
+
+// IRD distribution over [0, k), see irdgen().
+struct ird_sampler {
+    alias_table dis;
+
+    template <typename R> i64 operator()(R &rng) { return dis(rng); }
+    template <typename R> void sample_n(R &rng, std::span<i64> out) { dis.sample_n(rng, out); }
+};
+
+// Request sizes in blocks.
+struct size_sampler {
+    alias_table dis;
+    vec<i64> sizes;
+
+    template <typename R> i64 operator()(R &rng) { return sizes[dis(rng)]; }
+
+    template <typename R> void sample_n(R &rng, std::span<i64> out) {
+        dis.sample_n(rng, out);
+        for (auto &x : out)
+            x = sizes[x];
+    }
+};
+
+template <typename D, typename R>
+void sample_n(D &dist, R &rng, std::span<i64> out) {
+    if constexpr (requires { dist.sample_n(rng, out); })
+        dist.sample_n(rng, out);
+    else
+        for (auto &x : out)
+            x = dist(rng);
+}
+
+/**
+ * The trial `std::uniform_real_distribution<>{0, 1}(rng) < p`, decided on
+ * the raw 64-bit draw: the uniform is monotone in the draw, so the trial
+ * succeeds exactly for draws below a threshold, found once by bisection.
+ * This skips the conversion to double per trial. sample_mask() runs a span of
+ * trials from one bulk draw in a loop the compiler vectorises. In both cases
+ * the outcomes and the draws consumed match the floating-point comparison.
+ */
+class bernoulli_sampler {
+    u64 below = 0; // draws below this succeed
+    bool all = false; // every draw succeeds (p above the largest uniform)
+
+    struct fixed_draw {
+        using result_type = u64;
+        u64 value;
+        static constexpr u64 min() { return 0; }
+        static constexpr u64 max() { return std::numeric_limits<u64>::max(); }
+        u64 operator()() { return value; }
     };
+
+    static f64 uniform(u64 draw) {
+        fixed_draw d{draw};
+        return std::uniform_real_distribution<>{0, 1}(d);
+    }
+
+public:
+    bernoulli_sampler() = default;
+
+    explicit bernoulli_sampler(f64 p) {
+        if (uniform(std::numeric_limits<u64>::max()) < p) {
+            all = true;
+            return;
+        }
+        // smallest draw whose uniform is not below p
+        u64 lo = 0, hi = std::numeric_limits<u64>::max();
+        while (lo < hi) {
+            auto mid = lo + (hi - lo) / 2;
+            if (uniform(mid) < p)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        below = lo;
+    }
+
+    bool test(u64 draw) const { return all || draw < below; }
+
+    template <typename R> bool operator()(R &rng) const { return test(rng()); }
+
+    // out[i] = outcome of the i-th trial, 1 on success.
+    template <typename R> void sample_mask(R &rng, std::span<uint8_t> out) const {
+        u64 draws[256];
+        for (size_t i = 0; i < out.size(); i += std::size(draws)) {
+            auto k = std::min(std::size(draws), out.size() - i);
+            draw_n(rng, std::span(draws, k));
+            for (size_t j = 0; j < k; j++)
+                out[i + j] = all | (draws[j] < below);
+        }
+    }
+};
+
+/**
+ * How a generator decides which accesses are IRM draws: by a bernoulli trial
+ * per access (the reference stream), or, for p_irm 0 or 1 under
+ * --fast-paths, never or always without drawing. The constant cases consume
+ * fewer draws, so they produce a different trace than the trials would.
+ */
+enum class irm_mix { drawn, never, always };
+
+using irm_dist = std::variant<class_sampler, zipf_rejection_sampler, uniform_sampler, normal_sampler, bin_sampler,
+                              pop_sampler, subset_sampler>;
+
+inline normal_sampler normal_dist(f64 mean, f64 stddev, i64 max) {
+    return {std::normal_distribution<f64>(mean, stddev), max};
 }
 
-inline dist zipf_dist(f64 alpha, i64 classes, i64 max) {
+inline class_sampler zipf_dist(f64 alpha, i64 classes, i64 max) {
     assert(alpha > 0 && classes > 0);
     fmt::print("IRM: zipf: alpha: {} n: {}\n", alpha, classes);
     auto intervals = get_intervals(classes, max);
@@ -50,19 +356,14 @@ inline dist zipf_dist(f64 alpha, i64 classes, i64 max) {
         weights.push_back(1.0 / std::pow(i, alpha));
     normalise_vec(weights);
     assert(weights.size() == intervals.size());
-    std::discrete_distribution<i64> dis(weights.begin(), weights.end());
-    return [dis, ivs = std::move(intervals)](std::mt19937_64 &rng) mutable {
-        auto idx = dis(rng);
-        return ivs[idx](rng);
-    };
+    return {alias_table(weights.begin(), weights.end()), std::move(intervals)};
 }
 
-inline dist uniform_dist(i64 max) {
-    std::uniform_int_distribution<i64> dis(0, max - 1);
-    return [dis](std::mt19937_64 &rng) mutable { return dis(rng); };
+inline uniform_sampler uniform_dist(i64 max) {
+    return {std::uniform_int_distribution<i64>(0, max - 1)};
 }
 
-inline dist pareto_dist(f64 xm, f64 alpha, i64 classes, i64 max) {
+inline class_sampler pareto_dist(f64 xm, f64 alpha, i64 classes, i64 max) {
     assert(xm > 0 && alpha > 0 && classes > 0);
     fmt::print("IRM: pareto: xm: {} n: {}\n", xm, classes);
     auto intervals = get_intervals(classes, max);
@@ -71,20 +372,32 @@ inline dist pareto_dist(f64 xm, f64 alpha, i64 classes, i64 max) {
         weights.push_back(std::pow(xm / i, alpha));
     normalise_vec(weights);
     assert(weights.size() == intervals.size());
-    std::discrete_distribution<i64> dis(weights.begin(), weights.end());
-    return [dis, ivs = std::move(intervals)](std::mt19937_64 &rng) mutable {
-        auto idx = dis(rng);
-        return ivs[idx](rng);
-    };
+    return {alias_table(weights.begin(), weights.end()), std::move(intervals)};
+}
+
+// zipf_dist for class counts too large for a table (zipfr:alpha,n).
+inline zipf_rejection_sampler zipfr_dist(f64 alpha, i64 classes, i64 max) {
+    ensure_fatal(alpha > 0 && classes > 0 && classes <= max, "Invalid zipfr: alpha {} n {} (addresses {})", alpha,
+                 classes, max);
+    fmt::print("IRM: zipfr: alpha: {} n: {}\n", alpha, classes);
+    return {alpha, classes, max};
 }
 
-inline dist sequential_dist() {
+// pareto_dist's class weights (xm / k)^alpha are Zipf weights once
+// normalised, so paretor:xm,a,n draws the same distribution, in O(1) memory.
+inline zipf_rejection_sampler paretor_dist(f64 xm, f64 alpha, i64 classes, i64 max) {
+    ensure_fatal(xm > 0 && alpha > 0 && classes > 0 && classes <= max,
+                 "Invalid paretor: xm {} alpha {} n {} (addresses {})", xm, alpha, classes, max);
+    fmt::print("IRM: paretor: xm: {} n: {}\n", xm, classes);
+    return {alpha, classes, max};
+}
+
+inline sequential_sampler sequential_dist() {
     fmt::print("IRM: sequential\n");
-    i64 i = 0;
-    return [i](std::mt19937_64 &rng) mutable { return i++; };
+    return {};
 }
 
-inline dist irdgen(i64 k, f64 epsilon, vec<i64> spikes) {
+inline ird_sampler irdgen(i64 k, f64 epsilon, vec<i64> spikes) {
     vec<f64> weights;
     for (i64 i = 0; i < k; i++)
         weights.push_back(epsilon);
@@ -95,11 +408,10 @@ inline dist irdgen(i64 k, f64 epsilon, vec<i64> spikes) {
     for (auto s : spikes)
         fmt::print("{} ", s);
     fmt::print("\n");
-    std::discrete_distribution<i64> dis(weights.begin(), weights.end());
-    return [dis](std::mt19937_64 &rng) mutable { return dis(rng); };
+    return {alias_table(weights.begin(), weights.end())};
 }
 
-inline dist parse_request_sizes(str arg) {
+inline size_sampler parse_request_sizes(str arg) {
     vec<str> parts = split(arg, ":");
     ensure_fatal(parts.size() == 2, "Invalid size dist string: {}", arg);
     vec<str> weights_str = split(parts[0], ",");
@@ -112,11 +424,7 @@ inline dist parse_request_sizes(str arg) {
     for (auto &x : sizes_str)
         s.push_back(std::stoi(x));
     normalise_vec(w);
-    std::discrete_distribution<i64> dis(w.begin(), w.end());
-    return [dis, s](std::mt19937_64 &rng) mutable {
-        auto idx = dis(rng);
-        return s[idx];
-    };
+    return {alias_table(w.begin(), w.end()), std::move(s)};
 }
 
 inline vec<double> parse_probabilities(const str &s) {
@@ -128,7 +436,7 @@ inline vec<double> parse_probabilities(const str &s) {
     return probs;
 }
 
-inline dist parse_fgen(vec<str> args) {
+inline ird_sampler parse_fgen(vec<str> args) {
     assert(args[0] == "fgen");
     ensure_fatal(args.size() == 4, "fgen requires 3 arguments - fgen:k:epsilon:spikes");
     i64 k = std::stoi(args[1]);
@@ -141,7 +449,7 @@ inline dist parse_fgen(vec<str> args) {
     return irdgen(k, epsilon, spike_idxs);
 }
 
-inline dist parse_ird(str s) {
+inline ird_sampler parse_ird(str s) {
     if (s == "b")
         return irdgen(20, 0.005, {0, 3});
     if (s == "c")
@@ -159,7 +467,7 @@ inline dist parse_ird(str s) {
     exit(1);
 }
 
-inline dist parse_irm(str dist_str, i64 max, bool pop_mode = false) {
+inline irm_dist parse_irm(str dist_str, i64 max, bool pop_mode = false) {
     const double scale = 10000.0;
     if (pop_mode) {
         vec<double> weights;
@@ -179,12 +487,7 @@ inline dist parse_irm(str dist_str, i64 max, bool pop_mode = false) {
             }
         }
         normalise_vec(weights);
-        size_t counter = 0;
-        return [weights, counter, scale](std::mt19937_64 &rng) mutable -> i64 {
-            (void)rng;  // rng is unused since we use fixed ordering
-            assert(counter < weights.size() && "Not enough weights for all groups");
-            return (i64)std::llround(weights[counter++] * scale);
-        };
+        return pop_sampler{weights, 0, scale};
     } else {
         if(dist_str.find(":") == str::npos) {
             vec<str> tokens = split(dist_str, ",");
@@ -199,14 +502,10 @@ inline dist parse_irm(str dist_str, i64 max, bool pop_mode = false) {
                 sum += vals[i];
                 boundaries.push_back((i64)std::floor(sum * max));
             }
-            std::discrete_distribution<int> bin_dis(vals.begin(), vals.end());
-            return [bin_dis, boundaries](std::mt19937_64 &rng) mutable -> i64 {
-                int bin = bin_dis(rng);
-                i64 start = boundaries[bin];
-                i64 end = boundaries[bin+1] - 1;
-                std::uniform_int_distribution<i64> u(start, end);
-                return u(rng);
-            };
+            vec<std::uniform_int_distribution<i64>> bins;
+            for (size_t i = 0; i < vals.size(); i++)
+                bins.push_back(std::uniform_int_distribution<i64>(boundaries[i], boundaries[i + 1] - 1));
+            return bin_sampler{alias_table(vals.begin(), vals.end()), std::move(bins)};
         }
         // Canonical specification for address mode.
         vec<str> args = split(dist_str, ":");
@@ -228,6 +527,21 @@ inline dist parse_irm(str dist_str, i64 max, bool pop_mode = false) {
             log_info("Zipf dist: alpha: {} n: {}", alpha, n);
             return zipf_dist(alpha, n, max);
         }
+        if (dist_type == "zipfr") {
+            ensure_fatal(dist_args.size() == 2, "Zipfr dist requires 2 args");
+            f64 alpha = std::stod(dist_args[0]);
+            i64 n = std::stoll(dist_args[1]);
+            log_info("Zipfr dist: alpha: {} n: {}", alpha, n);
+            return zipfr_dist(alpha, n, max);
+        }
+        if (dist_type == "paretor") {
+            ensure_fatal(dist_args.size() == 3, "Paretor dist requires 3 args");
+            f64 xm = std::stod(dist_args[0]);
+            f64 alpha = std::stod(dist_args[1]);
+            i64 n = std::stoll(dist_args[2]);
+            log_info("Paretor dist: xm: {} alpha: {} n: {}", xm, alpha, n);
+            return paretor_dist(xm, alpha, n, max);
+        }
         if (dist_type == "uniform") {
             log_info("Uniform dist: max: {}", max);
             return uniform_dist(max);
@@ -243,5 +557,5 @@ inline dist parse_irm(str dist_str, i64 max, bool pop_mode = false) {
         exit(1);
     }
 }
-  
+
 #endif // TRACEGEN_UTILS_H
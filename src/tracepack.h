@@ -0,0 +1,396 @@
+#ifndef TRACEPACK_H
+#define TRACEPACK_H
+
+// Compressed trace format written by `--format=packed`.
+//
+// Layout (all integers little-endian):
+//
+//   header        48 bytes, see tracepack::header
+//   params        header.params_size bytes of text ("name=value ..."), as in
+//                 tracefile.h
+//   blocks        until one with records == 0, each a block_header followed
+//                 by stored_size bytes: the payload below, compressed with
+//                 header.codec (stored verbatim with codec_none)
+//
+// Offsets and sizes are stored in units of header.unit bytes (the block
+// size of the generator), and each block payload is
+//
+//   varint  d             number of distinct sizes in the block
+//   varint  sizes[d]      the sizes, in order of first appearance
+//   bytes   ops           ceil(n / 8) bytes, bit i is the op of record i
+//   bits    codes         ceil(n * b / 8) bytes, record i's index into sizes
+//                         in b = bit_width(d - 1) bits, LSB first
+//   varint  deltas[n]     zigzag(block_i - block_{i-1}), block_{-1} = 0
+//
+// Blocks are independent, so they can be (de)compressed in parallel. zstd
+// and LZ4 are compiled in with -DTRACEGEN_ZSTD / -DTRACEGEN_LZ4 (linking
+// libzstd / liblz4); without them only codec_none is available and files
+// using the others are rejected. Apart from those libraries this header,
+// like tracefile.h, only needs the standard library and POSIX. Errors throw
+// std::runtime_error.
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "tracefile.h"
+#ifdef TRACEGEN_ZSTD
+#include <zstd.h>
+#endif
+#ifdef TRACEGEN_LZ4
+#include <lz4.h>
+#endif
+
+namespace tracepack {
+
+constexpr char magic[8] = {'T', 'R', 'G', 'N', 'P', 'A', 'K', '\0'};
+constexpr uint32_t version = 1;
+
+enum codec : uint32_t {
+    codec_none = 0,
+    codec_zstd = 1,
+    codec_lz4 = 2,
+};
+
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t codec;
+    uint64_t unit;          // bytes per offset/size unit
+    uint64_t record_count;
+    uint64_t seed;
+    uint32_t params_size;
+    uint32_t reserved;
+};
+static_assert(sizeof(header) == 48);
+
+struct block_header {
+    uint32_t records;
+    uint32_t raw_size;      // payload size before compression
+    uint32_t stored_size;   // bytes that follow
+    uint32_t reserved;
+};
+static_assert(sizeof(block_header) == 16);
+
+inline bool available(codec c) {
+    switch (c) {
+    case codec_none:
+        return true;
+    case codec_zstd:
+#ifdef TRACEGEN_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    case codec_lz4:
+#ifdef TRACEGEN_LZ4
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+// "none", "zstd" or "lz4"; throws on anything else.
+inline codec codec_from_name(std::string_view name) {
+    if (name == "none")
+        return codec_none;
+    if (name == "zstd")
+        return codec_zstd;
+    if (name == "lz4")
+        return codec_lz4;
+    throw std::runtime_error("unknown codec: " + std::string(name));
+}
+
+// The best codec compiled in.
+inline const char *default_codec_name() {
+    return available(codec_zstd) ? "zstd" : available(codec_lz4) ? "lz4" : "none";
+}
+
+inline void put_varint(std::vector<uint8_t> &out, uint64_t x) {
+    while (x >= 0x80) {
+        out.push_back((uint8_t)(x | 0x80));
+        x >>= 7;
+    }
+    out.push_back((uint8_t)x);
+}
+
+inline uint64_t get_varint(const uint8_t *&p, const uint8_t *end) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end)
+            throw std::runtime_error("truncated trace block");
+        auto b = *p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return x;
+    }
+    throw std::runtime_error("invalid varint in trace block");
+}
+
+inline uint64_t zigzag(int64_t x) { return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); }
+inline int64_t unzigzag(uint64_t x) { return (int64_t)(x >> 1) ^ -(int64_t)(x & 1); }
+
+/**
+ * Appends the payload of one block to out. R is any record type with op,
+ * size and offset members (trace_record, tracefile::record); sizes and
+ * offsets must be multiples of unit.
+ */
+template <typename R>
+void encode(std::span<const R> records, uint64_t unit, std::vector<uint8_t> &out) {
+    auto n = records.size();
+    std::vector<uint64_t> sizes;
+    std::unordered_map<uint64_t, uint32_t> index;
+    std::vector<uint32_t> codes(n);
+    for (size_t i = 0; i < n; i++) {
+        auto s = (uint64_t)records[i].size;
+        if (s % unit != 0 || (uint64_t)records[i].offset % unit != 0)
+            throw std::runtime_error("record not aligned to the trace unit");
+        s /= unit;
+        // linear scan while the dictionary is small, as it usually is
+        uint32_t code = 0;
+        if (sizes.size() <= 16) {
+            while (code < sizes.size() && sizes[code] != s)
+                code++;
+            if (code == sizes.size()) {
+                index[s] = code;
+                sizes.push_back(s);
+            }
+        } else {
+            auto [it, added] = index.try_emplace(s, (uint32_t)sizes.size());
+            if (added)
+                sizes.push_back(s);
+            code = it->second;
+        }
+        codes[i] = code;
+    }
+
+    put_varint(out, sizes.size());
+    for (auto s : sizes)
+        put_varint(out, s);
+
+    auto ops = out.size();
+    out.resize(ops + (n + 7) / 8, 0);
+    for (size_t i = 0; i < n; i++)
+        if (records[i].op)
+            out[ops + i / 8] |= (uint8_t)(1 << (i % 8));
+
+    int bits = sizes.size() > 1 ? std::bit_width(sizes.size() - 1) : 0;
+    uint64_t acc = 0;
+    int filled = 0;
+    for (size_t i = 0; bits && i < n; i++) {
+        acc |= (uint64_t)codes[i] << filled;
+        for (filled += bits; filled >= 8; filled -= 8, acc >>= 8)
+            out.push_back((uint8_t)acc);
+    }
+    if (filled > 0)
+        out.push_back((uint8_t)acc);
+
+    uint64_t prev = 0;
+    for (auto &r : records) {
+        auto block = (uint64_t)r.offset / unit;
+        put_varint(out, zigzag((int64_t)(block - prev)));
+        prev = block;
+    }
+}
+
+// Decodes a payload of n records, appending to out.
+inline void decode(std::span<const uint8_t> payload, size_t n, uint64_t unit,
+                   std::vector<tracefile::record> &out) {
+    auto p = payload.data(), end = p + payload.size();
+    auto d = get_varint(p, end);
+    if (d > n || (n > 0 && d == 0))
+        throw std::runtime_error("invalid size dictionary in trace block");
+    std::vector<uint64_t> sizes(d);
+    for (auto &s : sizes)
+        s = get_varint(p, end) * unit;
+
+    int bits = d > 1 ? std::bit_width(d - 1) : 0;
+    auto ops = p, codes = ops + (n + 7) / 8;
+    p = codes + (n * bits + 7) / 8;
+    if (p > end)
+        throw std::runtime_error("truncated trace block");
+
+    uint64_t acc = 0, mask = (1ULL << bits) - 1, block = 0;
+    int filled = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (; filled < bits; filled += 8)
+            acc |= (uint64_t)*codes++ << filled;
+        auto code = acc & mask;
+        acc >>= bits;
+        filled -= bits;
+        if (code >= d)
+            throw std::runtime_error("invalid size code in trace block");
+        block += (uint64_t)unzigzag(get_varint(p, end));
+        out.push_back({(uint32_t)(ops[i / 8] >> (i % 8) & 1), (uint32_t)sizes[code], block * unit});
+    }
+}
+
+inline std::vector<uint8_t> compress(codec c, [[maybe_unused]] int level, std::span<const uint8_t> raw) {
+    std::vector<uint8_t> out;
+    switch (c) {
+    case codec_none:
+        out.assign(raw.begin(), raw.end());
+        return out;
+#ifdef TRACEGEN_ZSTD
+    case codec_zstd: {
+        out.resize(ZSTD_compressBound(raw.size()));
+        auto n = ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), level);
+        if (ZSTD_isError(n))
+            throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+        out.resize(n);
+        return out;
+    }
+#endif
+#ifdef TRACEGEN_LZ4
+    case codec_lz4: {
+        out.resize(LZ4_compressBound((int)raw.size()));
+        // level > 1 trades ratio for speed (LZ4's acceleration)
+        auto n = LZ4_compress_fast((const char *)raw.data(), (char *)out.data(), (int)raw.size(),
+                                   (int)out.size(), level > 1 ? level : 1);
+        if (n <= 0)
+            throw std::runtime_error("lz4: compression failed");
+        out.resize(n);
+        return out;
+    }
+#endif
+    default:
+        throw std::runtime_error("codec not compiled in");
+    }
+}
+
+inline std::vector<uint8_t> decompress(codec c, std::span<const uint8_t> stored, size_t raw_size) {
+    std::vector<uint8_t> out(raw_size);
+    switch (c) {
+    case codec_none:
+        if (stored.size() != raw_size)
+            throw std::runtime_error("corrupt trace block");
+        std::memcpy(out.data(), stored.data(), raw_size);
+        return out;
+#ifdef TRACEGEN_ZSTD
+    case codec_zstd: {
+        auto n = ZSTD_decompress(out.data(), raw_size, stored.data(), stored.size());
+        if (ZSTD_isError(n) || n != raw_size)
+            throw std::runtime_error("corrupt zstd trace block");
+        return out;
+    }
+#endif
+#ifdef TRACEGEN_LZ4
+    case codec_lz4: {
+        auto n = LZ4_decompress_safe((const char *)stored.data(), (char *)out.data(), (int)stored.size(),
+                                     (int)raw_size);
+        if (n < 0 || (size_t)n != raw_size)
+            throw std::runtime_error("corrupt lz4 trace block");
+        return out;
+    }
+#endif
+    default:
+        throw std::runtime_error("codec not compiled in");
+    }
+}
+
+/**
+ * Sequential reader of a packed trace. The file is mmap'd and decoded one
+ * block at a time:
+ *
+ *   tracepack::reader in(path);
+ *   std::vector<tracefile::record> block;
+ *   while (in.next(block))
+ *       simulate(block);
+ *
+ * Records are returned in host byte order.
+ */
+class reader {
+    const uint8_t *base = nullptr;
+    size_t length = 0, pos = 0;
+    header hdr{};
+
+public:
+    explicit reader(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header)) {
+            ::close(fd);
+            throw std::runtime_error("not a packed trace: " + path);
+        }
+        length = st.st_size;
+        void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("cannot mmap " + path);
+        base = (const uint8_t *)p;
+        madvise(p, length, MADV_SEQUENTIAL);
+
+        std::memcpy(&hdr, base, sizeof(hdr));
+        hdr.version = tracefile::le(hdr.version);
+        hdr.codec = tracefile::le(hdr.codec);
+        hdr.unit = tracefile::le(hdr.unit);
+        hdr.record_count = tracefile::le(hdr.record_count);
+        hdr.seed = tracefile::le(hdr.seed);
+        hdr.params_size = tracefile::le(hdr.params_size);
+        if (std::memcmp(hdr.magic, magic, sizeof(magic)) != 0 || hdr.version != version || hdr.unit == 0 ||
+            sizeof(header) + hdr.params_size > length) {
+            unmap();
+            throw std::runtime_error("not a packed trace: " + path);
+        }
+        if (!available((codec)hdr.codec)) {
+            unmap();
+            throw std::runtime_error("codec of " + path + " is not compiled in");
+        }
+        pos = sizeof(header) + hdr.params_size;
+    }
+
+    reader(const reader &) = delete;
+    reader &operator=(const reader &) = delete;
+    ~reader() { unmap(); }
+
+    const header &info() const { return hdr; }
+
+    std::string_view params() const { return {(const char *)base + sizeof(header), hdr.params_size}; }
+
+    // Replaces out with the next block of records; false at the end.
+    bool next(std::vector<tracefile::record> &out) {
+        out.clear();
+        if (pos + sizeof(block_header) > length)
+            throw std::runtime_error("truncated packed trace");
+        block_header bh;
+        std::memcpy(&bh, base + pos, sizeof(bh));
+        bh.records = tracefile::le(bh.records);
+        bh.raw_size = tracefile::le(bh.raw_size);
+        bh.stored_size = tracefile::le(bh.stored_size);
+        if (bh.records == 0)
+            return false;
+        pos += sizeof(bh);
+        if (bh.stored_size > length - pos)
+            throw std::runtime_error("truncated packed trace");
+        std::span<const uint8_t> stored(base + pos, bh.stored_size);
+        pos += bh.stored_size;
+        out.reserve(bh.records);
+        if (hdr.codec == codec_none) {
+            decode(stored, bh.records, hdr.unit, out);
+        } else {
+            auto raw = decompress((codec)hdr.codec, stored, bh.raw_size);
+            decode(raw, bh.records, hdr.unit, out);
+        }
+        return true;
+    }
+
+private:
+    void unmap() {
+        if (base)
+            munmap((void *)base, length);
+        base = nullptr;
+    }
+};
+
+} // namespace tracepack
+
+#endif // TRACEPACK_H
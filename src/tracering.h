@@ -0,0 +1,318 @@
+#ifndef TRACERING_H
+#define TRACERING_H
+
+// Shared-memory record rings of trace-server, and the client a simulator
+// drives the server with.
+//
+// Control channel: a Unix stream socket with one request line per command
+// and one reply line each, "ok ..." or "error <message>":
+//
+//   create <params>   new generator for a libtracegen config ("name=value
+//                     ..."), replacing the session's previous one
+//                     -> ok length=<records> addresses=<n> blocksize=<n> seed=<n>
+//   seek <position>   -> ok position=<record>
+//   advance <n>       publishes the next n records to the ring (fewer at
+//                     the end of the trace) -> ok records=<k> position=<record>
+//
+// On connect the server sends "ok tracering <version> capacity=<records>"
+// together with the ring, a memfd passed as SCM_RIGHTS. The ring is this
+// header followed by capacity records in the layout of --format=bin
+// (tracefile::record, little-endian): record i of the session is slot
+// i % capacity. The server publishes head after writing slots, the client
+// tail after reading them; when an advance is complete the server sets end
+// to head and then increments done, before its reply. Both sides wait by
+// spinning, yielding and then sleeping, so a consumer keeping up with the
+// server never enters the kernel.
+//
+// This header only depends on the standard library and POSIX so simulators
+// can include it directly.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "tracefile.h"
+
+namespace tracering {
+
+constexpr char magic[8] = {'T', 'R', 'G', 'N', 'R', 'I', 'N', 'G'};
+constexpr uint32_t version = 1;
+
+// Lock-free atomics work on shared mappings across processes.
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size; // sizeof(tracefile::record)
+    uint64_t capacity;    // records, a power of two
+    alignas(64) std::atomic<uint64_t> head; // records published by the server
+    alignas(64) std::atomic<uint64_t> tail; // records consumed by the client
+    alignas(64) std::atomic<uint64_t> done; // advance requests completed
+    std::atomic<uint64_t> end;              // head when the last one completed
+};
+
+// Records start one page in.
+constexpr size_t records_offset = 4096;
+static_assert(sizeof(header) <= records_offset);
+
+inline size_t bytes_for(uint64_t capacity) { return records_offset + capacity * sizeof(tracefile::record); }
+
+inline tracefile::record *slots(header *h) {
+    return (tracefile::record *)((char *)h + records_offset);
+}
+
+// Waiting on the other side of a ring: spins, then yields, then sleeps.
+class backoff {
+    unsigned n = 0;
+
+public:
+    void operator()() {
+        if (++n < 256)
+            return;
+        if (n < 512)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    // The sleeping stage, where checking on the peer costs nothing extra.
+    bool sleeping() const { return n >= 512; }
+};
+
+namespace detail {
+
+inline void send_all(int sock, const std::string &s) {
+    for (size_t at = 0; at < s.size();) {
+        auto n = ::send(sock, s.data() + at, s.size() - at, MSG_NOSIGNAL);
+        if (n <= 0)
+            throw std::runtime_error("tracering: connection lost");
+        at += n;
+    }
+}
+
+// Sends line (without its newline) with fd attached.
+inline void send_with_fd(int sock, const std::string &line, int fd) {
+    auto s = line + "\n";
+    iovec io{s.data(), s.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &io;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    if (::sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)s.size())
+        throw std::runtime_error("tracering: connection lost");
+}
+
+// Lines from a socket; the first read may carry a passed fd.
+class line_reader {
+    int sock;
+    std::string buf;
+
+public:
+    explicit line_reader(int sock) : sock(sock) {}
+
+    // The next line without its newline; false at the end of the stream.
+    // *fd, if given, receives a descriptor passed with the data (or -1).
+    bool next(std::string &line, int *fd = nullptr) {
+        if (fd)
+            *fd = -1;
+        for (;;) {
+            auto nl = buf.find('\n');
+            if (nl != std::string::npos) {
+                line = buf.substr(0, nl);
+                buf.erase(0, nl + 1);
+                return true;
+            }
+            char data[4096];
+            iovec io{data, sizeof(data)};
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+            msghdr msg{};
+            msg.msg_iov = &io;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            auto n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+            if (n <= 0)
+                return false;
+            for (auto c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+                if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                    int passed;
+                    std::memcpy(&passed, CMSG_DATA(c), sizeof(int));
+                    if (fd)
+                        *fd = passed;
+                    else
+                        ::close(passed);
+                }
+            buf.append(data, n);
+        }
+    }
+};
+
+// Value of name=<value> in an "ok ..." reply.
+inline uint64_t field(const std::string &reply, const std::string &name) {
+    auto at = (" " + reply).find(" " + name + "=");
+    if (at == std::string::npos)
+        throw std::runtime_error("tracering: no " + name + " in reply: " + reply);
+    return std::stoull(reply.substr(at + name.size() + 1));
+}
+
+} // namespace detail
+
+/**
+ * A session with trace-server: its own generator and ring. Records reach
+ * the consumer of advance() as spans of the ring, so on little-endian hosts
+ * nothing is copied or parsed on the client side. Throws std::runtime_error
+ * on connection errors and "error" replies. Not thread-safe.
+ */
+class client {
+    int sock = -1;
+    detail::line_reader in{-1};
+    header *ring = nullptr;
+    size_t mapped = 0;
+    uint64_t requests = 0;
+
+public:
+    explicit client(const std::string &socket_path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("tracering: socket path too long: " + socket_path);
+        std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+        sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0 || ::connect(sock, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            close();
+            throw std::runtime_error("tracering: cannot connect to " + socket_path);
+        }
+        in = detail::line_reader(sock);
+        std::string hello;
+        int fd;
+        if (!in.next(hello, &fd) || hello.rfind("ok tracering ", 0) != 0 || fd < 0) {
+            if (fd >= 0)
+                ::close(fd);
+            close();
+            throw std::runtime_error("tracering: not a trace server: " + socket_path);
+        }
+        auto capacity = detail::field(hello, "capacity");
+        void *p = mmap(nullptr, bytes_for(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            close();
+            throw std::runtime_error("tracering: cannot map the ring");
+        }
+        ring = (header *)p;
+        mapped = bytes_for(capacity);
+        if (std::memcmp(ring->magic, magic, sizeof(magic)) != 0 || ring->version != version ||
+            ring->record_size != sizeof(tracefile::record) || ring->capacity != capacity) {
+            close();
+            throw std::runtime_error("tracering: unsupported ring from " + socket_path);
+        }
+    }
+
+    client(const client &) = delete;
+    client &operator=(const client &) = delete;
+    ~client() { close(); }
+
+    uint64_t capacity() const { return ring->capacity; }
+
+    // New generator; returns its length in records.
+    uint64_t create(const std::string &params) { return detail::field(command("create " + params), "length"); }
+
+    // Moves the generator to record position (backwards too); returns it.
+    uint64_t seek(uint64_t position) {
+        return detail::field(command("seek " + std::to_string(position)), "position");
+    }
+
+    /**
+     * Requests the next n records and calls consume(span of records) as
+     * they arrive, in order, until all of them have; returns how many there
+     * were (fewer than n at the end of the trace). The ring slots in a span
+     * are handed back to the server when consume returns.
+     */
+    template <typename F>
+    uint64_t advance(uint64_t n, F &&consume) {
+        detail::send_all(sock, "advance " + std::to_string(n) + "\n");
+        auto id = ++requests;
+        auto cap = ring->capacity;
+        auto base = slots(ring);
+        auto tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t got = 0;
+        backoff wait;
+        for (;;) {
+            auto head = ring->head.load(std::memory_order_acquire);
+            if (head == tail) {
+                if (ring->done.load(std::memory_order_acquire) >= id &&
+                    ring->end.load(std::memory_order_relaxed) == tail)
+                    break;
+                wait();
+                if (wait.sleeping() && peer_closed())
+                    throw std::runtime_error("tracering: the server closed the connection");
+                continue;
+            }
+            wait = {};
+            auto first = tail & (cap - 1);
+            auto k = std::min(head - tail, cap - first);
+            consume(std::span<const tracefile::record>(base + first, k));
+            tail += k;
+            got += k;
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        auto r = reply();
+        if (detail::field(r, "records") != got)
+            throw std::runtime_error("tracering: ring out of step with reply: " + r);
+        return got;
+    }
+
+private:
+    // Sends a command line and returns its "ok" reply. advance() goes
+    // through the ring instead, so it is not one of these.
+    std::string command(const std::string &line) {
+        detail::send_all(sock, line + "\n");
+        return reply();
+    }
+
+    // The session went away (checked only while waiting on it).
+    bool peer_closed() const {
+        char c;
+        auto n = ::recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+    }
+
+    std::string reply() {
+        std::string line;
+        if (!in.next(line))
+            throw std::runtime_error("tracering: the server closed the connection");
+        if (line.rfind("ok", 0) != 0)
+            throw std::runtime_error("tracering: " + line);
+        return line;
+    }
+
+    void close() {
+        if (ring)
+            munmap(ring, mapped);
+        ring = nullptr;
+        if (sock >= 0)
+            ::close(sock);
+        sock = -1;
+    }
+};
+
+} // namespace tracering
+
+#endif // TRACERING_H
@@ -1,14 +1,21 @@
+#ifndef UTILS_H
+#define UTILS_H
+
 #include <algorithm>
+#include <cstdint>
 #include <fmt/color.h>
+#include <functional>
 #include <numeric>
+#include <random>
+#include <string>
 #include <vector>
 
 template <typename T> using vec = std::vector<T>;
 using i64 = int64_t;
+using u64 = uint64_t;
 using f64 = double;
 using nvec = std::vector<i64>;
 using str = std::string;
-using dist = std::function<i64(std::mt19937_64 &)>;
 
 #define log_info(MSG, ...)                                                     \
     do {                                                                       \
@@ -59,3 +66,5 @@ inline auto normalise_vec(vec<f64> &weights)
     for (auto &w : weights)
         w /= sum;
 }
+
+#endif // UTILS_H